@@ -56,6 +56,8 @@ main(int argc, char * argv[]) {
     // Assign journal
     typename ppt::journaling::Traits<const Event>::Journal j;
     p.assign_journal(j);
+    // Record every second event only
+    j.sample_every(2);
     # endif
     // Process events
     for( unsigned int i = 0; i < sizeof(events)/sizeof(*events); ++i ) {
@@ -0,0 +1,103 @@
+# include "new.tcc"
+
+# include <cstdlib>
+# include <iostream>
+
+// "Compressed" event: samples are stored as chunks of 8-bit deltas, so
+// each chunk has to be decoded before it can be inspected.
+struct Event {
+    static constexpr size_t nChunks = 16
+                          , chunkSize = 64
+                          ;
+    signed char deltas[nChunks][chunkSize];
+    int bases[nChunks];
+};
+
+static size_t nDecoded = 0;
+
+namespace ppt {
+// Chunked extraction traits: Span decodes the chunks on demand, so the
+// rest of event is not decoded once the inner pipeline has stopped the
+// iteration, and only the modified chunks are encoded back.
+template<>
+struct ExtractionTraits<int, Event> {
+    static bool decode_chunk( const Event & e, size_t n, std::vector<int> & items ) {
+        if( n >= Event::nChunks ) return false;
+        int v = e.bases[n];
+        for( size_t i = 0; i < Event::chunkSize; ++i ) {
+            items.push_back( v += e.deltas[n][i] );
+        }
+        ++nDecoded;
+        return true;
+    }
+    static void encode_chunk( Event & e, size_t n, const std::vector<int> & items ) {
+        int prev = e.bases[n] = items.front();
+        e.deltas[n][0] = 0;
+        for( size_t i = 1; i < Event::chunkSize; ++i ) {
+            e.deltas[n][i] = items[i] - prev;
+            prev = items[i];
+        }
+    }
+    static Traits<Event>::Routing::ResultCode
+    translate_results( Traits<int>::Routing::ResultCode rc ) {
+        // Stopped inner iteration means event was rejected.
+        return Traits<int>::Routing::do_stop_iteration(rc)
+             ? DefaultRoutingFlags::noPropFlag
+             : 0x0
+             ;
+    }
+};
+}
+
+// Rejects the event once the threshold is exceeded.
+struct Threshold : public ppt::iObserver<int> {
+    int threshold;
+    Threshold( int t ) : threshold(t) {}
+protected:
+    virtual typename ppt::Traits<int>::Routing::ResultCode
+    _V_eval( int v ) override {
+        return ppt::Traits<int>::Routing::mark_intact(
+                    v > threshold ? ppt::DefaultRoutingFlags::noPropFlag
+                                  | ppt::DefaultRoutingFlags::noNextFlag
+                                  : 0x0 );
+    }
+};
+
+struct Counter : public ppt::iObserver<Event> {
+    size_t n;
+    Counter() : n(0) {}
+protected:
+    virtual typename ppt::Traits<Event>::Routing::ResultCode
+    _V_eval( const Event & ) override {
+        ++n;
+        return ppt::Traits<Event>::Routing::mark_intact(0);
+    }
+};
+
+int
+main(int argc, char * argv[]) {
+    static Event events[100];
+    for( size_t i = 0; i < sizeof(events)/sizeof(*events); ++i ) {
+        int v = 0;
+        for( size_t n = 0; n < Event::nChunks; ++n ) {
+            events[i].bases[n] = v;
+            for( size_t j = 0; j < Event::chunkSize; ++j ) {
+                v += events[i].deltas[n][j] = rand()%5 - 1;
+            }
+        }
+    }
+    ppt::Pipe<int> ip;
+    ip.push_back( new Threshold(1000) );
+    Counter * cPtr;
+    ppt::Pipe<Event> p;
+    p.push_back( new ppt::Span<Event, int>(ip) );
+    p.push_back( cPtr = new Counter() );
+    for( size_t i = 0; i < sizeof(events)/sizeof(*events); ++i ) {
+        p << events[i];
+    }
+    std::cout << "Events passed: " << cPtr->n
+              << ", chunks decoded: " << nDecoded
+              << " of " << Event::nChunks*sizeof(events)/sizeof(*events)
+              << std::endl;
+    return 0;
+}
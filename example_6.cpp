@@ -0,0 +1,67 @@
+# include "new.tcc"
+
+# include <cstdlib>
+# include <iostream>
+
+// Stateful observer accumulating sum of values. The state is checkpointed;
+// version counter makes checkpoints incremental.
+struct Summator : public ppt::iObserver<int> {
+    long sum;
+    uint64_t version;
+    Summator() : sum(0), version(0) {}
+
+    virtual void save_state( ppt::checkpointing::Blob & b ) const override {
+        ppt::checkpointing::put( b, sum );
+    }
+    virtual void load_state( const ppt::checkpointing::Blob & b ) override {
+        size_t offset = 0;
+        ppt::checkpointing::get( b, offset, sum );
+    }
+    virtual uint64_t state_version() const override { return version; }
+protected:
+    virtual typename ppt::Traits<int>::Routing::ResultCode
+    _V_eval( int v ) override {
+        if( v % 3 ) {
+            sum += v;
+            ++version;
+        }
+        return ppt::Traits<int>::Routing::mark_intact(0);
+    }
+};
+
+// Runs the pipeline over the source starting from the checkpointed position
+// (if any), aborting after `nMax' messages to mimic the failure.
+static long
+run( const std::vector<int> & src, size_t nMax ) {
+    Summator s;
+    ppt::Pipe<int> p;
+    p.push_back( &s );
+    ppt::checkpointing::Checkpointer cp( p, "example6.ckpt", 100 );
+    uint64_t cursor = 0;
+    if( cp.restore( cursor ) ) {
+        std::cout << "Restored at " << cursor << ", sum=" << s.sum << std::endl;
+    }
+    for( size_t n = 0; cursor < src.size() && n < nMax; ++n ) {
+        int v = src[cursor];
+        p << v;
+        cp.message_done( ++cursor );
+    }
+    cp.wait();
+    return s.sum;
+}
+
+int
+main(int argc, char * argv[]) {
+    std::vector<int> src;
+    for( int i = 0; i < 1000; ++i ) {
+        src.push_back( rand() % 100 );
+    }
+    remove( "example6.ckpt" );
+    long expected = run( src, src.size() );
+    remove( "example6.ckpt" );
+    run( src, 550 );  // "killed" in the middle
+    long restarted = run( src, src.size() );
+    std::cout << "Expected " << expected << ", got " << restarted << std::endl;
+    remove( "example6.ckpt" );
+    return expected == restarted ? 0 : 1;
+}
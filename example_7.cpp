@@ -0,0 +1,93 @@
+# include "new.tcc"
+
+# include <cstdlib>
+# include <iostream>
+
+// Large event of hits, stored as chunks that can be decoded independently.
+struct Event {
+    static constexpr size_t nChunks = 256
+                          , chunkSize = 1024
+                          ;
+    std::vector<double> hits;
+};
+
+namespace ppt {
+// Chunked extraction traits let the const Span distribute the chunks among
+// the workers of thread pool.
+template<>
+struct ExtractionTraits<const double, const Event> {
+    static bool decode_chunk( const Event & e, size_t n, std::vector<double> & items ) {
+        if( n >= Event::nChunks ) return false;
+        items.insert( items.end()
+                    , e.hits.begin() + n*Event::chunkSize
+                    , e.hits.begin() + (n + 1)*Event::chunkSize );
+        return true;
+    }
+    static Traits<Event>::Routing::ResultCode
+    translate_results( Traits<double>::Routing::ResultCode ) {
+        return 0x0;
+    }
+};
+}
+
+// Fills histogram of hit amplitudes. Supports cloning and merging, so it
+// can be evaluated concurrently.
+struct Histogram : public ppt::iObserver<double> {
+    std::vector<size_t> bins;
+    Histogram() : bins(10, 0) {}
+    virtual ppt::iProcessor<const double> * clone() const override {
+        return new Histogram();
+    }
+    virtual void merge( ppt::iProcessor<const double> & o ) override {
+        Histogram & h = static_cast<Histogram &>(o);
+        for( size_t i = 0; i < bins.size(); ++i ) {
+            bins[i] += h.bins[i];
+            h.bins[i] = 0;
+        }
+    }
+protected:
+    virtual typename ppt::Traits<double>::Routing::ResultCode
+    _V_eval( double v ) override {
+        size_t n = size_t(v*bins.size());
+        ++bins[n < bins.size() ? n : bins.size() - 1];
+        return ppt::Traits<double>::Routing::mark_intact(0);
+    }
+};
+
+static std::vector<size_t>
+fill( std::vector<Event> & events, ppt::ThreadPool * pool ) {
+    ppt::Pipe<const double> ip;
+    Histogram * h = new Histogram();
+    ip.push_back( h );
+    ppt::Span<const Event, const double> * span
+            = new ppt::Span<const Event, const double>(ip);
+    span->set_thread_pool( pool );
+    ppt::Pipe<const Event> p;
+    p.push_back( span );
+    for( auto & e : events ) {
+        p << e;
+    }
+    return h->bins;
+}
+
+int
+main(int argc, char * argv[]) {
+    std::vector<Event> events(10);
+    for( auto & e : events ) {
+        e.hits.resize( Event::nChunks*Event::chunkSize );
+        for( auto & v : e.hits ) {
+            v = rand()/(RAND_MAX + 1.);
+        }
+    }
+    ppt::ThreadPool pool(4);
+    auto serial = fill( events, nullptr )
+       , parallel = fill( events, &pool )
+       ;
+    for( size_t i = 0; i < serial.size(); ++i ) {
+        std::cout << std::setw(3) << i << " : " << std::setw(8) << serial[i]
+                  << " " << std::setw(8) << parallel[i] << std::endl;
+    }
+    std::cout << (serial == parallel ? "Results match." : "Results differ!")
+              << std::endl;
+    return serial == parallel ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,97 @@
+# include "new.tcc"
+
+# include <chrono>
+# include <cmath>
+# include <cstdlib>
+# include <iostream>
+
+struct Event {
+    std::vector<double> samples;
+    double sum;
+};
+
+// Mutator computing the sum of samples
+static ppt::Traits<Event>::Routing::ResultCode _compute_sum( Event & e ) {
+    e.sum = 0;
+    for( double v : e.samples ) e.sum += v;
+    return 0;
+}
+
+// Expensive monitoring observer: accumulates a moment of given order.
+class Moment : public ppt::iObserver<Event> {
+private:
+    int _order;
+protected:
+    virtual typename ppt::Traits<Event>::Routing::ResultCode
+    _V_eval( const Event & e ) override {
+        for( double v : e.samples ) {
+            value += std::pow( v, _order );
+        }
+        return ppt::Traits<Event>::Routing::mark_intact( 0 );
+    }
+public:
+    double value;
+    Moment( int order ) : _order(order), value(0) {}
+};
+
+// Discriminates events with the sum exceeding threshold.
+class Veto : public ppt::iObserver<Event> {
+protected:
+    virtual typename ppt::Traits<Event>::Routing::ResultCode
+    _V_eval( const Event & e ) override {
+        return ppt::Traits<Event>::Routing::mark_intact(
+                    e.sum > 2010 ? ppt::DefaultRoutingFlags::noPropFlag : 0x0 );
+    }
+};
+
+// Counts events passed the pipe.
+static size_t nPassed = 0;
+static ppt::Traits<Event>::Routing::ResultCode _count( Event & ) {
+    ++nPassed;
+    return ppt::Traits<Event>::Routing::mark_intact( 0 );
+}
+
+// Evaluates the pipe with (or without) pool, returning the moments sum and
+// the elapsed time.
+static std::pair<double, double>
+evaluate( std::vector<Event> & events, ppt::ThreadPool * pool ) {
+    ppt::Pipe<Event> p;
+    p.push_back( new ppt::StatelessMutator<Event, int>(_compute_sum) );
+    std::vector<Moment *> moments;
+    for( int order = 1; order <= 8; ++order ) {
+        moments.push_back( new Moment(order) );
+        p.push_back( moments.back() );
+        if( 4 == order ) p.push_back( new Veto() );
+    }
+    p.push_back( new ppt::StatelessMutator<Event, int>(_count) );
+    p.set_observers_pool( pool );
+    nPassed = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for( auto & e : events ) {
+        p << e;
+    }
+    double sum = 0;
+    for( auto m : moments ) sum += m->value;
+    return std::make_pair( sum, std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - t0 ).count() );
+}
+
+int
+main(int argc, char * argv[]) {
+    std::vector<Event> events(200);
+    for( auto & e : events ) {
+        e.samples.resize( 4000 );
+        for( auto & v : e.samples ) v = rand()/(RAND_MAX + 1.);
+    }
+    ppt::ThreadPool pool(4);
+    auto serial = evaluate( events, nullptr );
+    size_t nSerial = nPassed;
+    auto parallel = evaluate( events, &pool );
+    std::cout << "serial: " << serial.second << "s, "
+              << "parallel: " << parallel.second << "s" << std::endl
+              << "passed: " << nSerial << " / " << nPassed
+              << " of " << events.size() << std::endl;
+    // Observers of the run after the vetoing one still see the message, so
+    // only the pass count (determined by results combination) has to match.
+    return nSerial == nPassed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -28,6 +28,8 @@
 # include <type_traits>
 # include <vector>
 # include <functional>
+# include <utility>
+# include <new>
 
 namespace pipet {
 
@@ -37,6 +39,17 @@ namespace interfaces {
 template<typename MessageT>
 struct Source {
     virtual MessageT * get() = 0;
+    /// Invoked by the processing loop once the propagation of message
+    /// previously returned by get() is over and none of the handlers has
+    /// kept it. Sources handing out pooled slots shall take them back here.
+    virtual void release( MessageT * ) {}
+    /// Shall return true if content of the released messages is not needed
+    /// anymore by the source, so it may be moved out instead of copying.
+    virtual bool messages_disposable() const { return false; }
+    /// Shall return false if get() would block now, waiting for the data
+    /// (but not at the end of stream). Used by composite sources to skip
+    /// the inputs temporarily having no data.
+    virtual bool ready() const { return true; }
 };
 
 template< typename HandlerResultT
@@ -94,6 +107,41 @@ template< typename CallableT
     typedef CallableT & CallableRef;
 };  // CallableTraits (classes)
 
+/**@brief Storage of the handler's callable.
+ * @class CallableStorage
+ *
+ * Lvalue callables are referenced (so the caller may keep accessing them),
+ * while the rvalue ones (lambdas, temporaries) are moved into the owning
+ * storage, keeping them within the handler instance itself and avoiding
+ * separate allocation. Referencing storage is of pointer size regardless of
+ * the callable type. Functions are always referenced.
+ * */
+template< typename CallableT
+        , bool owning=false
+        > class CallableStorage {
+private:
+    CallableT * _cPtr;
+public:
+    CallableStorage( CallableT & c ) : _cPtr(&c) {}
+    CallableStorage( const CallableStorage & ) = delete;
+    CallableT & callable() const { return *_cPtr; }
+    /// Returns true if callable is kept by value.
+    bool owns_callable() const { return false; }
+};  // CallableStorage (referencing)
+
+template< typename CallableT
+        > class CallableStorage<CallableT, true> {
+private:
+    static_assert( !std::is_function<CallableT>::value
+                 , "Functions can not be owned by handler." );
+    mutable CallableT _c;
+public:
+    CallableStorage( CallableT && c ) : _c(std::move(c)) {}
+    CallableStorage( const CallableStorage & ) = delete;
+    CallableT & callable() const { return _c; }
+    bool owns_callable() const { return true; }
+};  // CallableStorage (owning)
+
 template< typename SourceT
         , typename MessageT>
 struct SourceTraits {
@@ -132,9 +180,49 @@ struct SourceTraits<interfaces::Source<MessageT>, MessageT> {
         virtual MessageT * get() override {
             return _src->get();
         }
+        virtual void release( MessageT * m ) override {
+            _src->release( m );
+        }
+        virtual bool messages_disposable() const override {
+            return _src->messages_disposable();
+        }
     };
 };
 
+/// Defines how the processing loop treats the handlers chain container. By
+/// default chain is considered to be immutable during the processing.
+template<typename ChainT>
+struct ChainTraits {
+    /// Invoked by processing loop between the messages, when no handler
+    /// iterator is kept. Shall return true if chain content was changed (so
+    /// iterators have to be re-obtained).
+    static bool update( ChainT & ) { return false; }
+};
+
+// Forwards message back to the source if it supports ownership handoff
+// (i.e. has a release() method).
+template< typename SourceT
+        , typename MessageT >
+auto release_message( SourceT & src, MessageT * m, int )
+                            -> decltype( src.release(m), void() ) {
+    src.release( m );
+}
+
+template< typename SourceT
+        , typename MessageT >
+void release_message( SourceT &, MessageT *, long ) {}
+
+// Returns true if source supports ownership handoff and does not need the
+// content of released messages.
+template< typename SourceT >
+auto messages_disposable( const SourceT & src, int )
+                            -> decltype( src.messages_disposable() ) {
+    return src.messages_disposable();
+}
+
+template< typename SourceT >
+bool messages_disposable( const SourceT &, long ) { return false; }
+
 template<typename MessageT>
 struct MessageTraits {
     typedef MessageT Message;
@@ -144,8 +232,92 @@ struct MessageTraits {
     static void delete_copy( const Message * target ) {
         delete target;
     }
+    /// Delivers message content to the target. Disposable messages are
+    /// swapped, so the target's previous content (and its allocated memory)
+    /// gets back to the source for re-use.
+    static void extract( Message & target, Message & src, bool disposable ) {
+        if( disposable ) {
+            using std::swap;
+            swap( target, src );
+        } else {
+            target = src;
+        }
+    }
 };
 
+/**@brief Lease on the message instance owned by the source.
+ * @class MessageLease
+ *
+ * Provides access to the message that has passed the pipeline with no
+ * copying. Message is given back to the source it came from once the lease is
+ * reset or destroyed, so the lease must not outlive the source.
+ * */
+template<typename MessageT>
+class MessageLease {
+public:
+    typedef MessageT Message;
+private:
+    Message * _msg;
+    void * _owner;
+    void (* _release)( void *, Message * );
+    bool _disposable;
+
+    template<typename SourceT>
+    static void _release_to( void * owner, Message * m ) {
+        release_message( *static_cast<SourceT *>(owner), m, 0 );
+    }
+public:
+    MessageLease() : _msg(nullptr), _owner(nullptr), _release(nullptr)
+                   , _disposable(false) {}
+    MessageLease( const MessageLease & ) = delete;
+    MessageLease( MessageLease && o ) : _msg(o._msg), _owner(o._owner)
+                                      , _release(o._release)
+                                      , _disposable(o._disposable) {
+        o._msg = nullptr;
+    }
+    MessageLease & operator=( MessageLease && o ) {
+        if( this != &o ) {
+            reset();
+            _msg = o._msg; _owner = o._owner;
+            _release = o._release; _disposable = o._disposable;
+            o._msg = nullptr;
+        }
+        return *this;
+    }
+    ~MessageLease() { reset(); }
+
+    /// Takes the message emitted by given source.
+    template<typename SourceT>
+    void assign( Message * m, SourceT & owner ) {
+        reset();
+        _msg = m;
+        _owner = &owner;
+        _release = &_release_to<SourceT>;
+        _disposable = messages_disposable( owner, 0 );
+    }
+
+    /// Gives the message back to its source.
+    void reset() {
+        if( _msg ) {
+            _release( _owner, _msg );
+            _msg = nullptr;
+        }
+    }
+
+    /// Moves (or copies, if source needs it) the message content into the
+    /// target and releases the lease.
+    void extract( Message & target ) {
+        MessageTraits<Message>::extract( target, *_msg, _disposable );
+        reset();
+    }
+
+    Message * get() const { return _msg; }
+    Message & operator*() const { return *_msg; }
+    Message * operator->() const { return _msg; }
+    explicit operator bool() const { return _msg; }
+    bool disposable() const { return _disposable; }
+};  // class MessageLease
+
 }  // namespace aux
 
 /// The most basic pipeline handler class. Is an abstract base for linear
@@ -173,6 +345,7 @@ template< typename MessageT
         , typename ResultT
         , typename CallableT
         , template<typename, typename> class ParentTClass=iBasicHandler
+        , bool ownsCallable=false
         > class PrimitiveHandler;
 
 //
@@ -186,12 +359,21 @@ iBasicHandler<MessageT, ProcessingResultT>::processor() {
             , Result
             , CallableT
             > TargetHandlerType;
-    auto hPtr = dynamic_cast<TargetHandlerType *>(this);
+    typedef PrimitiveHandler< Message
+            , Result
+            , CallableT
+            , iBasicHandler
+            , !std::is_function<CallableT>::value
+            > OwningHandlerType;
+    if( auto hPtr = dynamic_cast<TargetHandlerType *>(this) ) {
+        return hPtr->processor();
+    }
+    auto hPtr = dynamic_cast<OwningHandlerType *>(this);
     if( !hPtr ) {
         pipet_error( BadCast, "Handler type cast mismatch. Requesting "
                 "processor handle of type %s while real handler is of type %s."
             , typeid(TargetHandlerType).name()
-            , typeid(hPtr).name());
+            , typeid(*this).name());
     }
     return hPtr->processor();
 };
@@ -209,8 +391,10 @@ template< typename MessageT
         , typename ResultT
         , typename CallableT
         , template<typename, typename> class ParentTClass
+        , bool ownsCallable
         >
-class PrimitiveHandler : public ParentTClass<MessageT, ResultT>
+class PrimitiveHandler : private aux::CallableStorage<CallableT, ownsCallable>  // must precede parent
+                       , public ParentTClass<MessageT, ResultT>
                        , public HandlerResultConverter< ResultT
                                                       , typename aux::CallableTraits<CallableT, MessageT>::CallableResult
                                                       > {
@@ -222,13 +406,18 @@ public:
                                   , typename TheCallableTraits::CallableResult
                                   > ResultConverter;
     typedef ParentTClass<MessageT, ResultT>             Parent;
-private:
-    CallableRef _cRef;
+    typedef aux::CallableStorage<CallableT, ownsCallable> Storage;
 public:
-    PrimitiveHandler( CallableRef cRef ) : Parent(cRef), _cRef( cRef ) {}
-    virtual Result process( MessageT & m ) { return ResultConverter::convert(_cRef( m )); }
-    CallableRef processor() { return _cRef; }
-    const CallableRef processor() const { return _cRef; }
+    /// Refers to the callable (referencing handler only).
+    PrimitiveHandler( CallableRef cRef ) : Storage(cRef)
+                                         , Parent(Storage::callable()) {}
+    /// Takes ownership over the (moved) callable (owning handler only).
+    PrimitiveHandler( CallableT && c ) : Storage(std::move(c))
+                                       , Parent(Storage::callable()) {}
+    virtual Result process( MessageT & m ) { return ResultConverter::convert(Storage::callable()( m )); }
+    CallableRef processor() { return Storage::callable(); }
+    const CallableRef processor() const { return Storage::callable(); }
+    using Storage::owns_callable;
 };
 
 
@@ -252,7 +441,12 @@ struct HandlerTraits< MessageT
     typedef iBasicHandler<Message, HandlerResult>   AbstractHandler;
     typedef AbstractHandler *                       AbstractHandlerRef;
 
-    template<typename CallableT> using Handler = PrimitiveHandler<Message, HandlerResult, CallableT>;
+    template< typename CallableT
+            , bool ownsCallable=false > using Handler = PrimitiveHandler< Message
+                                                                        , HandlerResult
+                                                                        , CallableT
+                                                                        , iBasicHandler
+                                                                        , ownsCallable >;
 
     /// Major processing function performing full pipeline iterative processing
     /// over the given source instance, with given assessing logic.
@@ -314,12 +508,14 @@ public:
             delete ahPtr;
         }
     }
-    /// Shortcut for inserting processor at the back of pipeline.
+    /// Shortcut for inserting processor at the back of pipeline. Lvalue
+    /// callables are referenced, rvalues are moved into the handler.
     template<typename CallableArgT>
     void push_back( CallableArgT && p ) {
         typedef typename std::remove_reference<CallableArgT>::type CallableType;
-        Chain::push_back(
-                new typename TheHandlerTraits::template Handler<CallableType>(p) );
+        Chain::push_back( new typename TheHandlerTraits::template Handler< CallableType
+                                , !std::is_lvalue_reference<CallableArgT>::value >(
+                                        std::forward<CallableArgT>(p) ) );
     }
 
     TChainT<AbstractHandlerRef> & upcast() { return *this; }
@@ -327,7 +523,7 @@ public:
 
     template<typename CallableArgT>
     friend Self & operator|=( Self & s, CallableArgT && p ) {
-        s.push_back( p );
+        s.push_back( std::forward<CallableArgT>(p) );
         return s;
     }
 
@@ -335,7 +531,15 @@ public:
             , typename Arbiter=typename TheHandlerTraits::template IArbiter<LoopResultT> >
     friend helpers::ThinEvaluationProxy<Self, Arbiter> operator<<( Self & p, const Message & src) {
         helpers::ThinEvaluationProxy<Self, Arbiter> ep(p);
-        ep.push( &src );
+        ep.push( src );
+        return ep;
+    }
+
+    template< typename LoopResultT=int
+            , typename Arbiter=typename TheHandlerTraits::template IArbiter<LoopResultT> >
+    friend helpers::ThinEvaluationProxy<Self, Arbiter> operator<<( Self & p, Message && src) {
+        helpers::ThinEvaluationProxy<Self, Arbiter> ep(p);
+        ep.push( std::move(src) );
         return ep;
     }
 
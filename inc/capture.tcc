@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_CAPTURE_H
+# define H_PIPE_T_CAPTURE_H
+
+/**@file capture.tcc
+ * @brief Recording of message stream and its rate-controlled replay.
+ *
+ * Capture file starts with 16-byte header (magic and format version),
+ * followed by records, each prefixed with capture time (nanoseconds since
+ * the first message was captured) and record length, both as 64-bit
+ * integers of native byte order. Messages are (de-)serialized with
+ * `aux::RecordTraits'.
+ * */
+
+# include "pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <chrono>
+# include <fstream>
+# include <string>
+# include <thread>
+# include <vector>
+
+namespace pipet {
+namespace aux {
+struct CaptureFormat {
+    static constexpr uint64_t magic = 0x5041435445504950ULL;  // "PIPETCAP"
+    static constexpr uint64_t version = 1;
+};
+}  // namespace aux
+
+/**@brief Handler writing messages into capture file.
+ * @class StreamRecorder
+ *
+ * Put into the pipe at the point which message stream has to be captured
+ * at; messages are propagated further intact. The capture time of each
+ * message is taken relative to the first one.
+ * */
+template<typename MessageT>
+class StreamRecorder {
+public:
+    typedef MessageT Message;
+private:
+    std::ofstream _os;
+    std::vector<char> _buffer;
+    uint64_t _t0
+           , _nRecorded
+           ;
+public:
+    StreamRecorder( const std::string & path ) : _os( path, std::ios::binary | std::ios::trunc )
+                                               , _t0(0), _nRecorded(0) {
+        if( !_os ) {
+            pipet_error( SystemError, "Unable to open capture file \"%s\" for "
+                    "writing.", path.c_str() );
+        }
+        const uint64_t header[2] = { aux::CaptureFormat::magic
+                                   , aux::CaptureFormat::version };
+        _os.write( reinterpret_cast<const char *>(header), sizeof(header) );
+    }
+    StreamRecorder( const StreamRecorder & ) = delete;
+
+    bool operator()( Message & m ) {
+        const uint64_t t = stats::now();
+        if( !_nRecorded ) _t0 = t;
+        const uint64_t prefix[2] = { t - _t0, aux::RecordTraits<Message>::size( m ) };
+        _buffer.resize( prefix[1] );
+        aux::RecordTraits<Message>::pack( m, _buffer.data() );
+        _os.write( reinterpret_cast<const char *>(prefix), sizeof(prefix) );
+        _os.write( _buffer.data(), prefix[1] );
+        if( !_os ) {
+            pipet_error( SystemError, "Failed to write message #%zu into "
+                    "capture file.", (size_t) _nRecorded );
+        }
+        ++_nRecorded;
+        return true;
+    }
+
+    /// Flushes the buffered records to the file.
+    void flush() { _os.flush(); }
+    /// Number of messages recorded.
+    size_t n_recorded() const { return _nRecorded; }
+};  // class StreamRecorder
+
+/**@brief Source replaying the capture file.
+ * @class StreamReplay
+ *
+ * Emits messages recorded by `StreamRecorder' either as fast as possible, or
+ * keeping the recorded intervals (`OriginalTiming'), or the intervals
+ * shrinked by given factor (`Scaled'; the factor of 2 plays twice as fast).
+ * Timing is kept relatively to the replay start, so the pipeline that once
+ * was slower than the recorded stream does not accumulate drift: the lag is
+ * reported instead.
+ *
+ * Messages are de-serialized into the slots of own pool, so they may be kept
+ * by forks.
+ * */
+template<typename MessageT>
+class StreamReplay : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+    enum Mode { MaxSpeed, OriginalTiming, Scaled };
+    /// Replay statistics.
+    struct Report {
+        size_t nMessages;  ///< number of messages emitted
+        uint64_t elapsed  ///< replay wall time, ns
+               , recorded  ///< recorded time span of emitted messages, ns
+               , maxLag  ///< greatest delay of emission against schedule, ns
+               , sumLag  ///< total delay against schedule, ns
+               ;
+        /// Achieved emission rate, messages per second.
+        double achieved_rate() const {
+            return elapsed ? (nMessages - 1)*1e9/elapsed : 0.;
+        }
+        /// Mean delay of emission against schedule, ns.
+        double mean_lag() const { return nMessages ? double(sumLag)/nMessages : 0.; }
+    };
+private:
+    std::ifstream _is;
+    const Mode _mode;
+    const double _factor;
+    aux::MessagePool<Message> _pool;
+    std::vector<char> _buffer;
+    uint64_t _startTime;
+    Report _report;
+public:
+    StreamReplay( const std::string & path
+                , Mode mode=MaxSpeed
+                , double factor=1. ) : _is( path, std::ios::binary )
+                                     , _mode(mode)
+                                     , _factor(OriginalTiming == mode ? 1. : factor)
+                                     , _startTime(0)
+                                     , _report{0, 0, 0, 0, 0} {
+        uint64_t header[2] = {0, 0};
+        if( !_is.read( reinterpret_cast<char *>(header), sizeof(header) ) ) {
+            pipet_error( SystemError, "Unable to read capture file \"%s\".", path.c_str() );
+        }
+        if( aux::CaptureFormat::magic != header[0]
+         || aux::CaptureFormat::version != header[1] ) {
+            pipet_error( Malfunction, "File \"%s\" is not a capture file of "
+                    "version %d.", path.c_str(), (int) aux::CaptureFormat::version );
+        }
+        if( Scaled == mode && !(factor > 0) ) {
+            pipet_error( Malfunction, "Replay speed factor must be positive "
+                    "(%g given).", factor );
+        }
+    }
+    StreamReplay( const StreamReplay & ) = delete;
+
+    /// Returns next message, blocking till its scheduled time (if replay
+    /// is timed). Returns nullptr at the end of file.
+    virtual Message * get() override {
+        uint64_t prefix[2];
+        if( !_is.read( reinterpret_cast<char *>(prefix), sizeof(prefix) ) ) {
+            return nullptr;
+        }
+        _buffer.resize( prefix[1] );
+        if( !_is.read( _buffer.data(), prefix[1] ) ) {
+            pipet_error( Malfunction, "Capture file is truncated at message "
+                    "#%zu.", _report.nMessages );
+        }
+        Message * m = _pool.acquire();
+        aux::RecordTraits<Message>::unpack( _buffer.data(), prefix[1], *m );
+        uint64_t t = stats::now();
+        if( !_report.nMessages ) _startTime = t;
+        if( MaxSpeed != _mode ) {
+            const uint64_t scheduled = _startTime + uint64_t(prefix[0]/_factor);
+            if( t < scheduled ) {
+                std::this_thread::sleep_for( std::chrono::nanoseconds(scheduled - t) );
+                t = stats::now();
+            }
+            const uint64_t lag = t - scheduled;
+            _report.sumLag += lag;
+            if( lag > _report.maxLag ) _report.maxLag = lag;
+        }
+        ++_report.nMessages;
+        _report.recorded = prefix[0];
+        _report.elapsed = t - _startTime;
+        return m;
+    }
+    virtual void release( Message * m ) override { _pool.release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+
+    /// Statistics of messages emitted so far.
+    const Report & report() const { return _report; }
+    /// Rate requested by replay mode, messages per second (0 for maximal
+    /// speed).
+    double target_rate() const {
+        if( MaxSpeed == _mode || !_report.recorded ) return 0.;
+        return (_report.nMessages - 1)*1e9*_factor/_report.recorded;
+    }
+};  // class StreamReplay
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_CAPTURE_H
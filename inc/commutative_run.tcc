@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+# ifndef H_PIPE_T_COMMUTATIVE_RUN_H
+# define H_PIPE_T_COMMUTATIVE_RUN_H
+
+# include "basic_pipeline.tcc"
+
+# include <algorithm>
+# include <chrono>
+# include <cstdint>
+
+namespace pipet {
+
+/**@brief Run of independent discriminating handlers re-ordered at runtime.
+ * @class CommutativeRun
+ *
+ * Groups bool-returning discriminators whose order does not affect the
+ * result: the message passes the run only if all the filters have accepted
+ * it. The run samples per-filter rejection rate and (optionally) cost, and
+ * each `period' messages re-orders the filters by increasing
+ * cost/rejection-rate ratio, so cheap and highly selective filters are
+ * applied first. Statistics are halved on each re-ordering to follow the
+ * data distribution drift. Filters not timed yet are assumed to cost as
+ * much as the mean of the timed ones.
+ *
+ * The run itself is a callable returning bool, thus it may be pushed into
+ * the pipeline as any other discriminator.
+ *
+ * Filters must not modify the message and have to be statistically
+ * independent for the ordering to be optimal (results are identical anyway).
+ * */
+template<typename MessageT>
+class CommutativeRun {
+public:
+    typedef MessageT Message;
+    typedef iBasicHandler<Message, bool> Filter;
+private:
+    struct Entry {
+        Filter * filter;
+        uint64_t nCalls        ///< number of invocations
+               , nRejected     ///< number of rejected messages
+               , nTimed        ///< number of timed invocations
+               , ns            ///< overall time of timed invocations
+               ;
+        double cost  ///< last measured cost, negative if never timed
+             , rank
+             ;
+    };
+    std::vector<Entry> _entries;
+    /// Number of messages between re-orderings.
+    uint64_t _period;
+    /// Every N-th message is timed; 0 disables cost measurement.
+    uint64_t _sampleEvery;
+    uint64_t _nMsgs;
+    size_t _nReorders;
+protected:
+    /// Computes filters ranks and sorts them in ascending order. Filters
+    /// that were not timed within the period keep their last measured cost;
+    /// the ones that were never timed get the mean cost of others, so they
+    /// do not jump ahead just because no measurement is available.
+    virtual void _reorder() {
+        double sumCost = 0.;
+        size_t nCosts = 0;
+        for( auto & e : _entries ) {
+            if( e.nTimed ) e.cost = double(e.ns) / e.nTimed;
+            if( e.cost >= 0. ) {
+                sumCost += e.cost;
+                ++nCosts;
+            }
+        }
+        const double meanCost = nCosts ? sumCost / nCosts : 1.;
+        for( auto & e : _entries ) {
+            double rejRate = (e.nRejected + 1.) / (e.nCalls + 2.);
+            e.rank = (e.cost >= 0. ? e.cost : meanCost) / rejRate;
+            e.nCalls /= 2; e.nRejected /= 2;
+            e.nTimed /= 2; e.ns /= 2;
+        }
+        std::stable_sort( _entries.begin(), _entries.end()
+                , []( const Entry & a, const Entry & b ) { return a.rank < b.rank; } );
+        ++_nReorders;
+    }
+public:
+    CommutativeRun( uint64_t period=1024
+                  , uint64_t sampleEvery=16 ) : _period(period ? period : 1)
+                                              , _sampleEvery(sampleEvery)
+                                              , _nMsgs(0)
+                                              , _nReorders(0) {}
+    CommutativeRun( const CommutativeRun & ) = delete;
+    ~CommutativeRun() {
+        for( auto & e : _entries ) {
+            delete e.filter;
+        }
+    }
+
+    /// Adds discriminator to the run. As for pipeline, lvalue callables are
+    /// referenced, not copied, while rvalues are moved into the filter.
+    template<typename CallableArgT>
+    void push_back( CallableArgT && p ) {
+        typedef typename std::remove_reference<CallableArgT>::type CallableType;
+        _entries.push_back( Entry{
+                new PrimitiveHandler< Message, bool, CallableType, iBasicHandler
+                                    , !std::is_lvalue_reference<CallableArgT>::value >(
+                                    std::forward<CallableArgT>(p) )
+                , 0, 0, 0, 0, -1., 0. } );
+    }
+
+    /// Applies filters in current order. Returns false on first rejection.
+    bool operator()( Message & msg ) {
+        if( ++_nMsgs % _period == 0 ) {
+            _reorder();
+        }
+        const bool timed = _sampleEvery && !(_nMsgs % _sampleEvery);
+        for( auto & e : _entries ) {
+            ++e.nCalls;
+            bool passed;
+            if( timed ) {
+                auto t0 = std::chrono::steady_clock::now();
+                passed = e.filter->process( msg );
+                e.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - t0 ).count();
+                ++e.nTimed;
+            } else {
+                passed = e.filter->process( msg );
+            }
+            if( !passed ) {
+                ++e.nRejected;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Number of filters in the run.
+    size_t size() const { return _entries.size(); }
+    /// Returns filter at the given position in current order.
+    Filter & operator[]( size_t n ) { return *_entries[n].filter; }
+    /// Number of re-orderings performed so far.
+    size_t n_reorders() const { return _nReorders; }
+};  // class CommutativeRun
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_COMMUTATIVE_RUN_H
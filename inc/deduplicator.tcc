@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_DEDUPLICATOR_H
+# define H_PIPE_T_DEDUPLICATOR_H
+
+# include "basic_pipeline.tcc"
+# include "stats.tcc"
+
+# include <algorithm>
+# include <chrono>
+# include <cstdint>
+# include <functional>
+# include <vector>
+
+namespace pipet {
+namespace aux {
+
+/**@brief Set of recently inserted keys of bounded size.
+ * @class GenerationalSet
+ *
+ * Keys are inserted into the current generation; `rotate()' starts the new
+ * one, forgetting the keys of the oldest. Set keeps `nGenerations' of them,
+ * each being a flat open-addressing hash table (linear probing) allocated
+ * upon construction for `perGeneration' keys with load factor not above 1/2.
+ *
+ * Slots are stamped with the epoch (number of generation) they were filled
+ * in, and slots of past epochs are treated as vacant, so the rotation does
+ * not clear anything and has constant cost; no memory is allocated and no
+ * rehashing occurs after construction. As the generation only grows until
+ * rotation, the probe sequences of its live keys never contain vacant
+ * slots, so the first stale slot terminates the lookup.
+ * */
+template< typename KeyT
+        , typename HashT=std::hash<KeyT> >
+class GenerationalSet {
+public:
+    typedef KeyT Key;
+private:
+    struct Slot {
+        Key key;
+        uint64_t epoch;  ///< 0 for never used slots
+    };
+    const size_t _nGenerations
+               , _perGeneration
+               ;
+    HashT _hashF;
+    unsigned _shift;  ///< 64 - log2(number of slots in generation)
+    size_t _mask;
+    /// Tables of generations, one after another.
+    std::vector<Slot> _slots;
+    /// Current epoch; generation of epoch e is at e % nGenerations.
+    uint64_t _epoch;
+    size_t _nCurrent;
+
+    uint64_t _hash( const Key & k ) const {
+        // Fibonacci hashing; slot index is taken from the upper bits
+        return uint64_t(_hashF(k)) * 0x9E3779B97F4A7C15ull;
+    }
+    Slot * _table( uint64_t epoch ) {
+        return &_slots[ (epoch % _nGenerations)*(_mask + 1) ];
+    }
+    const Slot * _table( uint64_t epoch ) const {
+        return &_slots[ (epoch % _nGenerations)*(_mask + 1) ];
+    }
+    /// Looks up the key in generation of given epoch. Returns the matching
+    /// slot or the vacant one terminating the probe sequence.
+    template<typename SlotPtrT> SlotPtrT
+    _probe( SlotPtrT t, uint64_t epoch, const Key & k, uint64_t h ) const {
+        for( size_t i = h >> _shift; ; i = (i + 1) & _mask ) {
+            if( t[i].epoch != epoch || t[i].key == k ) return t + i;
+        }
+    }
+public:
+    GenerationalSet( size_t perGeneration, size_t nGenerations=4 )
+            : _nGenerations(nGenerations > 2 ? nGenerations : 2)
+            , _perGeneration(perGeneration ? perGeneration : 1)
+            , _epoch(1)
+            , _nCurrent(0) {
+        unsigned log2n = 1;
+        while( (size_t(1) << log2n) < 2*_perGeneration ) ++log2n;
+        _shift = 64 - log2n;
+        _mask = (size_t(1) << log2n) - 1;
+        _slots.assign( _nGenerations*(_mask + 1), Slot{ Key(), 0 } );
+    }
+
+    /// Returns true if key was inserted within the generations kept.
+    bool contains( const Key & k ) const {
+        const uint64_t h = _hash( k );
+        for( size_t g = 0; g < _nGenerations && g < _epoch; ++g ) {
+            const uint64_t e = _epoch - g;
+            const Slot * s = _probe( _table(e), e, k, h );
+            if( s->epoch == e ) return true;
+        }
+        return false;
+    }
+
+    /// Inserts the key into current generation, unless it is found in one
+    /// of the generations kept. Returns false if key was found. Current
+    /// generation must not be full.
+    bool insert( const Key & k ) {
+        const uint64_t h = _hash( k );
+        Slot * s = _probe( _table(_epoch), _epoch, k, h );
+        if( s->epoch == _epoch ) return false;
+        for( size_t g = 1; g < _nGenerations && g < _epoch; ++g ) {
+            const uint64_t e = _epoch - g;
+            if( _probe( _table(e), e, k, h )->epoch == e ) return false;
+        }
+        s->key = k;
+        s->epoch = _epoch;
+        ++_nCurrent;
+        return true;
+    }
+
+    /// Starts new generation, forgetting the oldest one.
+    void rotate() {
+        ++_epoch;
+        _nCurrent = 0;
+    }
+
+    /// Number of keys in current generation.
+    size_t n_current() const { return _nCurrent; }
+    bool current_full() const { return _nCurrent >= _perGeneration; }
+    size_t per_generation() const { return _perGeneration; }
+    size_t n_generations() const { return _nGenerations; }
+    /// Number of rotations made.
+    uint64_t n_rotations() const { return _epoch - 1; }
+    /// Memory occupied by the tables, in bytes.
+    size_t n_bytes() const { return sizeof(Slot)*_slots.size(); }
+};  // class GenerationalSet
+
+}  // namespace aux
+
+/**@brief Handler dropping the messages with keys seen recently.
+ * @class Deduplicator
+ *
+ * Discards the message if message with the same key (as obtained by the
+ * user-supplied projection) has passed within the horizon, which is either
+ * the number of recent messages passed, or the time window. The keys are
+ * kept in `aux::GenerationalSet' of `nGenerations' generations, so memory
+ * is bounded and each message costs at most `nGenerations' hash lookups,
+ * with no rehashing and no allocations.
+ *
+ * Horizon is guaranteed, but is not exact: the duplicate is dropped if it
+ * comes within `nRecent' messages (or `window' time) after the original,
+ * and may also be dropped up to one generation (1/(nGenerations-1) of
+ * horizon) later. For time window, the `maxPerWindow' limits the number of
+ * keys kept: if more messages pass within the window, generations are
+ * rotated early, shrinking the horizon (such rotations are counted).
+ * Horizon counts from the first occurrence: duplicates do not prolong it.
+ *
+ * Handler is not thread-safe.
+ * */
+template< typename MessageT
+        , typename KeyT
+        , typename HashT=std::hash<KeyT> >
+class Deduplicator {
+public:
+    typedef MessageT Message;
+    typedef aux::GenerationalSet<KeyT, HashT> Set;
+    typedef std::function<KeyT(const Message &)> KeyGetter;
+private:
+    const KeyGetter _getKey;
+    Set _set;
+    /// Duration of generation for time window (0 for count horizon).
+    const uint64_t _genDuration;
+    uint64_t _genStart;
+    size_t _nPassed
+         , _nDropped
+         , _nEarlyRotations
+         ;
+
+    static size_t _per_generation( size_t n, size_t nGenerations ) {
+        if( nGenerations < 2 ) nGenerations = 2;
+        return (n + nGenerations - 2)/(nGenerations - 1);
+    }
+
+    /// Rotates generations that are over for time window.
+    void _expire() {
+        const uint64_t t = stats::now();
+        if( t - _genStart < _genDuration ) return;
+        const uint64_t nGens = (t - _genStart)/_genDuration;
+        // No need to rotate more times than there are generations
+        for( uint64_t i = 0; i < nGens && i < _set.n_generations(); ++i ) {
+            _set.rotate();
+        }
+        _genStart += nGens*_genDuration;
+    }
+public:
+    /// Drops duplicates coming within `nRecent' messages passed.
+    Deduplicator( KeyGetter getKey
+                , size_t nRecent
+                , size_t nGenerations=4 )
+            : _getKey(getKey)
+            , _set( _per_generation( nRecent, nGenerations ), nGenerations )
+            , _genDuration(0), _genStart(0)
+            , _nPassed(0), _nDropped(0), _nEarlyRotations(0) {}
+
+    /// Drops duplicates coming within the time `window'; at most
+    /// `maxPerWindow' keys are kept for the window.
+    Deduplicator( KeyGetter getKey
+                , std::chrono::nanoseconds window
+                , size_t maxPerWindow
+                , size_t nGenerations=4 )
+            : _getKey(getKey)
+            , _set( _per_generation( maxPerWindow, nGenerations ), nGenerations )
+            , _genDuration( std::max<uint64_t>( 1
+                          , window.count()/(_set.n_generations() - 1) ) )
+            , _genStart( stats::now() )
+            , _nPassed(0), _nDropped(0), _nEarlyRotations(0) {}
+
+    /// Returns true if message has to be passed.
+    bool operator()( Message & m ) {
+        if( _genDuration ) _expire();
+        if( !_set.insert( _getKey(m) ) ) {
+            ++_nDropped;
+            return false;
+        }
+        ++_nPassed;
+        if( _set.current_full() ) {
+            if( _genDuration ) {
+                ++_nEarlyRotations;
+                _genStart = stats::now();
+            }
+            _set.rotate();
+        }
+        return true;
+    }
+
+    size_t n_passed() const { return _nPassed; }
+    size_t n_dropped() const { return _nDropped; }
+    /// Number of generations rotated before their time was over, due to
+    /// `maxPerWindow' limit.
+    size_t n_early_rotations() const { return _nEarlyRotations; }
+    const Set & key_set() const { return _set; }
+};  // class Deduplicator
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_DEDUPLICATOR_H
@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_ELASTIC_FORK_H
+# define H_PIPE_T_ELASTIC_FORK_H
+
+# include "pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <chrono>
+# include <condition_variable>
+# include <deque>
+# include <memory>
+# include <mutex>
+# include <thread>
+# include <vector>
+
+namespace pipet {
+namespace aux {
+
+// Moves the state accumulated by handler clone into the given instance, if
+// handler supports merging (i.e. has a merge(HandlerT &) method).
+template<typename HandlerT>
+auto merge_state( HandlerT & into, HandlerT & from, int )
+                            -> decltype( into.merge(from), void() ) {
+    into.merge( from );
+}
+
+template<typename HandlerT>
+void merge_state( HandlerT &, HandlerT &, long ) {}
+
+}  // namespace aux
+
+/**@brief Fork/junction handler evaluating messages on the elastic set of
+ *        worker threads.
+ * @class ElasticFork
+ *
+ * Messages are put into the shared queue and taken by the workers, each one
+ * running its own clone (copy) of the handler. Number of workers is adapted
+ * between `Policy::minWorkers' and `Policy::maxWorkers' once per
+ * `Policy::window': the worker is added when the queue depth exceeds
+ * `depthHigh' messages per worker (or the workers are busy for more than
+ * `utilHigh' of time with messages still waiting), and is retired when
+ * queue depth drops to `depthLow' while utilization is below `utilLow'.
+ * Either condition has to hold for `sustain' consecutive windows, and the
+ * counters are reset each time the count changes, so the count does not
+ * oscillate at the thresholds.
+ *
+ * Clones are copies of the handler instance given to the constructor. The
+ * retired clone finishes the current message, and then its state is merged
+ * into the `merged()' instance by `merge(HandlerT &)' method (if handler
+ * provides one, it has to move the state leaving argument in initial
+ * state). `collect()' retires all the workers, so `merged()' reflects all the
+ * messages processed.
+ *
+ * Like `KeyRouter', fork returns `Complete' each `batch' messages and emits
+ * processed messages as a junction, blocking until the dispatched messages
+ * are processed. As for router, only messages of the pool given to the fork
+ * are dispatched by pointer, others are copied into its slots. The order of
+ * messages is not kept. The adaptation is
+ * performed by the thread feeding the fork (also while it waits for the
+ * workers).
+ * */
+template< typename MessageT
+        , typename HandlerT >
+class ElasticFork : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+    typedef Pipe<Message> SubPipe;
+    typedef aux::MessagePool<Message> Pool;
+    /// Parameters of workers count adaptation.
+    struct Policy {
+        size_t minWorkers  ///< workers kept at idle
+             , maxWorkers  ///< workers at peak load
+             , depthHigh  ///< queued messages per worker to add one
+             , depthLow  ///< queued messages to consider retiring
+             ;
+        double utilHigh  ///< busy time fraction to add worker
+             , utilLow  ///< busy time fraction to consider retiring
+             ;
+        std::chrono::nanoseconds window;  ///< adaptation period
+        unsigned sustain;  ///< windows the condition has to hold
+
+        Policy( size_t minW=1
+              , size_t maxW=std::thread::hardware_concurrency() )
+                : minWorkers(minW ? minW : 1)
+                , maxWorkers(maxW > minWorkers ? maxW : minWorkers)
+                , depthHigh(4), depthLow(1)
+                , utilHigh(.85), utilLow(.3)
+                , window( std::chrono::milliseconds(10) )
+                , sustain(2) {}
+    };
+    /// Adaptation statistics.
+    struct Stats {
+        size_t nProcessed  ///< messages done by workers
+             , nSpawned  ///< workers started
+             , nRetired  ///< workers retired (and merged)
+             , peakWorkers  ///< maximum number of simultaneous workers
+             ;
+    };
+private:
+    /// Terminating handler of worker's sub-pipeline that puts passed
+    /// messages into fork's output queue.
+    class Outlet {
+    private:
+        ElasticFork & _f;
+    public:
+        Outlet( ElasticFork & f ) : _f(f) {}
+        PipeRC operator()( Message & m ) {
+            std::unique_lock<std::mutex> lock(_f._mtx);
+            _f._out.push_back( &m );
+            _f._drainCV.notify_one();
+            return PipeRC::MessageKept;
+        }
+    };
+
+    /// Worker taking messages from the shared queue, acting as the source
+    /// for its sub-pipeline.
+    class Worker : public interfaces::Source<Message> {
+    private:
+        ElasticFork & _f;
+        bool _busy;
+        uint64_t _started;
+    public:
+        HandlerT handler;
+        SubPipe pipe;
+        Outlet outlet;
+        std::thread thread;
+        /// Set (under fork's mutex) once worker loop is over.
+        bool finished;
+
+        Worker( ElasticFork & f ) : _f(f), _busy(false), _started(0)
+                                  , handler(f._blank), outlet(f)
+                                  , finished(false) {
+            pipe.push_back( handler );
+            pipe.push_back( outlet );
+        }
+
+        /// Blocks until message is queued; returns nullptr once worker is
+        /// retired or fork is being destroyed.
+        virtual Message * get() override {
+            std::unique_lock<std::mutex> lock(_f._mtx);
+            if( _busy ) {
+                // Previous message has been processed.
+                _busy = false;
+                _f._done_one( stats::now() - _started );
+            }
+            _f._workCV.wait( lock, [this](){
+                    return _f._stop || _f._nToRetire || !_f._in.empty(); } );
+            if( _f._nToRetire ) {
+                --_f._nToRetire;
+                return nullptr;
+            }
+            if( _f._in.empty() ) return nullptr;
+            Message * m = _f._in.front();
+            _f._in.pop_front();
+            _busy = true;
+            _started = stats::now();
+            return m;
+        }
+
+        virtual void release( Message * m ) override { _f._release(m); }
+        virtual bool messages_disposable() const override { return true; }
+    };
+
+    const Policy _policy;
+    /// Prototype of clones and the instance collecting their state.
+    const HandlerT _blank;
+    HandlerT _merged;
+    std::vector<std::unique_ptr<Worker> > _workers;
+    aux::PoolRef<Message> _pool;
+    /// Guards queues, counters and workers list.
+    std::mutex _mtx;
+    std::condition_variable _workCV
+                          , _drainCV
+                          ;
+    std::deque<Message *> _in
+                        , _out
+                        ;
+    /// Number of messages dispatched, but not yet processed by workers.
+    size_t _nPending;
+    size_t _batch
+         , _nSinceDrain
+         ;
+    /// Workers not asked to retire, and number of retirement requests not
+    /// yet taken by workers.
+    size_t _nActive
+         , _nToRetire
+         ;
+    bool _stop;
+    /// Current adaptation window: start, busy time and peak queue depth.
+    uint64_t _windowStart
+           , _busyTime
+           ;
+    size_t _peakDepth;
+    unsigned _nUp, _nDown;
+    Stats _stats;
+
+    /// Starts new worker. Must be called with mutex locked.
+    void _spawn() {
+        _workers.emplace_back( new Worker(*this) );
+        Worker * w = _workers.back().get();
+        w->thread = std::thread( [this, w]() {
+                GenericArbiter<int> a;
+                SubPipe::TheHandlerTraits::process( a, w->pipe.upcast()
+                            , static_cast<interfaces::Source<Message> &>(*w) );
+                std::unique_lock<std::mutex> lock(_mtx);
+                w->finished = true;
+            } );
+        ++_nActive;
+        ++_stats.nSpawned;
+        if( _workers.size() > _stats.peakWorkers ) {
+            _stats.peakWorkers = _workers.size();
+        }
+    }
+
+    /// Asks one of the workers to retire. Must be called with mutex locked.
+    void _retire_one() {
+        --_nActive;
+        ++_nToRetire;
+        _workCV.notify_all();
+    }
+
+    /// Joins finished workers and merges the state of their clones. Must be
+    /// called with mutex locked; unlocks it while joining.
+    void _reap( std::unique_lock<std::mutex> & lock ) {
+        std::vector<std::unique_ptr<Worker> > finished;
+        for( auto it = _workers.begin(); _workers.end() != it; ) {
+            if( (*it)->finished ) {
+                finished.push_back( std::move(*it) );
+                it = _workers.erase( it );
+            } else {
+                ++it;
+            }
+        }
+        if( finished.empty() ) return;
+        lock.unlock();
+        for( auto & w : finished ) {
+            w->thread.join();
+            aux::merge_state( _merged, w->handler, 0 );
+        }
+        lock.lock();
+        _stats.nRetired += finished.size();
+    }
+
+    /// Adapts number of workers if adaptation window is over. Must be
+    /// called with mutex locked.
+    void _adapt( std::unique_lock<std::mutex> & lock ) {
+        const uint64_t now = stats::now()
+                     , dt = now - _windowStart
+                     ;
+        if( dt < (uint64_t) _policy.window.count() ) return;
+        _reap( lock );
+        const double util = _nActive ? double(_busyTime)/(dt*_nActive) : 1.;
+        if( _peakDepth > _policy.depthHigh*_nActive
+         || ( util > _policy.utilHigh && _peakDepth > _nActive ) ) {
+            ++_nUp;
+            _nDown = 0;
+        } else if( _peakDepth <= _policy.depthLow && util < _policy.utilLow ) {
+            ++_nDown;
+            _nUp = 0;
+        } else {
+            _nUp = _nDown = 0;
+        }
+        if( _nUp >= _policy.sustain && _nActive < _policy.maxWorkers ) {
+            _spawn();
+            _nUp = 0;
+        } else if( _nDown >= _policy.sustain && _nActive > _policy.minWorkers ) {
+            _retire_one();
+            _nDown = 0;
+        }
+        _windowStart = now;
+        _busyTime = 0;
+        _peakDepth = _in.size();
+    }
+
+    /// Must be called with mutex locked.
+    void _done_one( uint64_t busyTime ) {
+        _busyTime += busyTime;
+        ++_stats.nProcessed;
+        if( !--_nPending ) _drainCV.notify_one();
+    }
+
+    void _release( Message * m ) { _pool.release( m ); }
+
+    /// Stops and joins all the workers.
+    void _stop_all( std::unique_lock<std::mutex> & lock ) {
+        _stop = true;
+        _workCV.notify_all();
+        lock.unlock();
+        for( auto & w : _workers ) {
+            if( w->thread.joinable() ) w->thread.join();
+        }
+        lock.lock();
+        _stop = false;
+        _nActive = _nToRetire = 0;
+    }
+public:
+    /// Creates fork with clones of given handler. The `batch' is the maximum
+    /// number of messages dispatched before the fork is drained.
+    ElasticFork( const HandlerT & handler
+               , const Policy & policy=Policy()
+               , size_t batch=1024
+               , Pool * pool=nullptr ) : _policy(policy)
+                                       , _blank(handler)
+                                       , _merged(handler)
+                                       , _pool(pool)
+                                       , _nPending(0)
+                                       , _batch(batch ? batch : 1)
+                                       , _nSinceDrain(0)
+                                       , _nActive(0)
+                                       , _nToRetire(0)
+                                       , _stop(false)
+                                       , _windowStart(0)
+                                       , _busyTime(0)
+                                       , _peakDepth(0)
+                                       , _nUp(0), _nDown(0)
+                                       , _stats{0, 0, 0, 0} {}
+    ElasticFork( const ElasticFork & ) = delete;
+    ~ElasticFork() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        for( Message * m : _in ) _release( m );
+        _in.clear();
+        _stop_all( lock );
+        for( Message * m : _out ) _release( m );
+    }
+
+    /// Dispatches message to the workers' queue.
+    PipeRC operator()( Message & msg ) {
+        bool taken;
+        Message * m = _pool.take( msg, taken );
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            if( !_nActive ) {
+                // (Re-)start minimal set of workers
+                while( _nActive < _policy.minWorkers ) _spawn();
+                _windowStart = stats::now();
+                _busyTime = 0;
+            }
+            ++_nPending;
+            _in.push_back( m );
+            if( _in.size() > _peakDepth ) _peakDepth = _in.size();
+            _workCV.notify_one();
+            _adapt( lock );
+        }
+        if( ++_nSinceDrain >= _batch ) {
+            _nSinceDrain = 0;
+            return taken ? PipeRC::Complete : PipeRC::Filled;
+        }
+        return taken ? PipeRC::MessageKept : PipeRC::Absorbed;
+    }
+
+    /// Emits processed messages, blocking until all the dispatched messages
+    /// are processed.
+    virtual Message * get() override {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while( _out.empty() && _nPending ) {
+            if( std::cv_status::timeout
+                    == _drainCV.wait_for( lock, _policy.window ) ) {
+                _adapt( lock );
+            }
+        }
+        if( _out.empty() ) {
+            _nSinceDrain = 0;
+            return nullptr;
+        }
+        Message * m = _out.front();
+        _out.pop_front();
+        return m;
+    }
+
+    virtual void release( Message * m ) override { _release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+
+    /// Waits for dispatched messages to be processed, retires all the
+    /// workers and merges their state. Returns the merged instance.
+    HandlerT & collect() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _drainCV.wait( lock, [this](){ return !_nPending; } );
+        _stop_all( lock );
+        for( auto & w : _workers ) {
+            aux::merge_state( _merged, w->handler, 0 );
+        }
+        _stats.nRetired += _workers.size();
+        _workers.clear();
+        return _merged;
+    }
+
+    /// Instance collecting the state of retired clones.
+    HandlerT & merged() { return _merged; }
+    /// Number of workers currently running (not asked to retire).
+    size_t n_workers() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _nActive;
+    }
+    /// Adaptation statistics.
+    Stats fork_stats() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _stats;
+    }
+    const Policy & policy() const { return _policy; }
+};  // class ElasticFork
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_ELASTIC_FORK_H
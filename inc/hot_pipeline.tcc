@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+# ifndef H_PIPE_T_HOT_PIPELINE_H
+# define H_PIPE_T_HOT_PIPELINE_H
+
+# include "pipeline.tcc"
+
+# include <algorithm>
+# include <atomic>
+# include <memory>
+# include <mutex>
+
+namespace pipet {
+namespace aux {
+
+/**@brief Epoch-based reclamation domain.
+ * @class EpochDomain
+ *
+ * Readers pin the current global epoch in their slot before accessing the
+ * shared data and unpin afterwards; neither operation takes a lock. Writers
+ * publish new data, then retire the old one with the `retire()' method that
+ * advances the global epoch. Retired objects are deleted by `collect()' once
+ * no reader remains pinned at epoch the object was retired in.
+ * */
+class EpochDomain {
+public:
+    /// Maximum number of simultaneously registered readers.
+    static constexpr size_t nSlots = 64;
+    /// Reader slot, padded to occupy single cache line.
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch;  ///< 0 for quiescent reader
+        std::atomic<bool> busy;  ///< true if slot is taken by reader
+    };
+
+    /// RAII reader registration.
+    class Reader {
+    private:
+        EpochDomain * _d;
+        Slot * _slot;
+    public:
+        Reader( EpochDomain & d ) : _d(&d), _slot(d._acquire_slot()) {}
+        Reader( const Reader & ) = delete;
+        ~Reader() {
+            _slot->epoch.store( 0 );
+            _slot->busy.store( false );
+        }
+        /// Pins current global epoch and returns it.
+        uint64_t pin() {
+            uint64_t e = _d->_epoch.load();
+            _slot->epoch.store( e );
+            return e;
+        }
+        /// Marks reader as quiescent.
+        void unpin() { _slot->epoch.store( 0 ); }
+        EpochDomain & domain() { return *_d; }
+    };
+private:
+    struct Retired {
+        uint64_t epoch;
+        void * ptr;
+        void (* del)(void *);
+    };
+
+    std::atomic<uint64_t> _epoch;
+    Slot _slots[nSlots];
+    std::vector<Retired> _retired;
+    std::mutex _retiredMtx;
+
+    Slot * _acquire_slot() {
+        for( size_t i = 0; i < nSlots; ++i ) {
+            bool vacant = false;
+            if( _slots[i].busy.compare_exchange_strong( vacant, true ) ) {
+                return _slots + i;
+            }
+        }
+        pipet_error( Malfunction, "Epoch domain %p: more than %zu readers "
+                "registered simultaneously.", this, nSlots );
+    }
+
+    template<typename T>
+    static void _delete( void * p ) { delete static_cast<T *>(p); }
+public:
+    EpochDomain() : _epoch(1) {
+        for( size_t i = 0; i < nSlots; ++i ) {
+            _slots[i].epoch.store( 0 );
+            _slots[i].busy.store( false );
+        }
+    }
+    EpochDomain( const EpochDomain & ) = delete;
+    /// Deletes all the retired objects. No readers may be active.
+    ~EpochDomain() {
+        for( auto & r : _retired ) {
+            r.del( r.ptr );
+        }
+    }
+
+    /// Returns current global epoch.
+    uint64_t epoch() const { return _epoch.load(); }
+
+    /// Schedules deletion of object that was unlinked from shared data.
+    /// Must be called after new data was published.
+    template<typename T>
+    void retire( T * ptr ) {
+        std::unique_lock<std::mutex> lock(_retiredMtx);
+        _retired.push_back( Retired{ _epoch.fetch_add(1), ptr, &_delete<T> } );
+    }
+
+    /// Deletes retired objects that may not be reached by readers anymore.
+    /// Returns number of objects deleted.
+    size_t collect() {
+        uint64_t minPinned = UINT64_MAX;
+        for( size_t i = 0; i < nSlots; ++i ) {
+            uint64_t e = _slots[i].epoch.load();
+            if( e && e < minPinned ) minPinned = e;
+        }
+        std::vector<Retired> toDelete;
+        {
+            std::unique_lock<std::mutex> lock(_retiredMtx);
+            auto it = std::partition( _retired.begin(), _retired.end()
+                    , [minPinned]( const Retired & r ) { return r.epoch >= minPinned; } );
+            toDelete.assign( it, _retired.end() );
+            _retired.erase( it, _retired.end() );
+        }
+        for( auto & r : toDelete ) {
+            r.del( r.ptr );
+        }
+        return toDelete.size();
+    }
+
+    /// Number of objects awaiting deletion.
+    size_t n_retired() {
+        std::unique_lock<std::mutex> lock(_retiredMtx);
+        return _retired.size();
+    }
+};  // class EpochDomain
+
+/**@brief Handlers chain view pinned by processing loop.
+ * @class PinnedChain
+ *
+ * Provides immutable version of the handlers chain published by
+ * `HotPipe'. Processing loop invokes `update()' (by means of `ChainTraits')
+ * between the messages to switch to the latest version; this costs single
+ * atomic load while no re-configuration happened.
+ *
+ * Range-constructed instances are static copies used by the processing loop
+ * for sub-chains; they rely on the pin held by encompassing view.
+ * */
+template<typename HandlerRefT>
+class PinnedChain {
+public:
+    typedef std::vector<HandlerRefT> Version;
+    typedef HandlerRefT value_type;
+    typedef typename Version::const_iterator iterator;
+    typedef typename Version::const_iterator const_iterator;
+    typedef typename Version::const_reverse_iterator reverse_iterator;
+    typedef typename Version::const_reverse_iterator const_reverse_iterator;
+private:
+    const std::atomic<const Version *> * _published;
+    std::unique_ptr<EpochDomain::Reader> _reader;
+    const Version * _v;
+    uint64_t _pinnedEpoch;
+    Version _own;
+
+    void _pin() {
+        _pinnedEpoch = _reader->pin();
+        _v = _published->load();
+    }
+public:
+    PinnedChain( EpochDomain & d
+               , const std::atomic<const Version *> & published )
+            : _published( &published )
+            , _reader( new EpochDomain::Reader(d) ) {
+        _pin();
+    }
+    PinnedChain( iterator b, iterator e ) : _published(nullptr)
+                                          , _pinnedEpoch(0)
+                                          , _own(b, e) {
+        _v = &_own;
+    }
+    PinnedChain( const PinnedChain & ) = delete;
+    PinnedChain( PinnedChain && o ) : _published(o._published)
+                                    , _reader(std::move(o._reader))
+                                    , _pinnedEpoch(o._pinnedEpoch)
+                                    , _own(std::move(o._own)) {
+        _v = _published ? o._v : &_own;
+    }
+
+    /// Switches to the latest version of chain. Returns true if version was
+    /// changed.
+    bool update() {
+        if( !_published
+         || _reader->domain().epoch() == _pinnedEpoch ) {
+            return false;
+        }
+        const Version * old = _v;
+        _pin();
+        return old != _v;
+    }
+
+    iterator begin() const { return _v->begin(); }
+    iterator end() const { return _v->end(); }
+    reverse_iterator rbegin() const { return _v->rbegin(); }
+    reverse_iterator rend() const { return _v->rend(); }
+    bool empty() const { return _v->empty(); }
+    size_t size() const { return _v->size(); }
+};  // class PinnedChain
+
+template<typename HandlerRefT>
+struct ChainTraits< PinnedChain<HandlerRefT> > {
+    static bool update( PinnedChain<HandlerRefT> & c ) { return c.update(); }
+};
+
+}  // namespace aux
+
+/**@brief Pipeline supporting re-configuration while being evaluated.
+ * @class HotPipe
+ *
+ * Handlers may be inserted, removed or replaced while the `operator<='
+ * streams the messages on other threads. Modifications are made on a copy
+ * of the handlers chain that is then published atomically (RCU-style); the
+ * processing loops switch to the new chain between the messages, with no
+ * locking. Replaced chains and removed handlers are deleted only after all
+ * the loops have switched away from them.
+ *
+ * Note, that messages kept by junction handler are lost when such handler
+ * is removed; the chain version switching only happens when no junction is
+ * being drained.
+ * */
+template<typename MessageT>
+class HotPipe {
+public:
+    typedef MessageT                                    Message;
+    typedef PipeRC                                      Result;
+    typedef HandlerTraits< Message
+                         , Result
+                         , iPipeHandler >               TheHandlerTraits;
+    typedef typename TheHandlerTraits::AbstractHandler  AbstractHandler;
+    typedef typename TheHandlerTraits::AbstractHandlerRef AbstractHandlerRef;
+    typedef aux::PinnedChain<AbstractHandlerRef>        Chain;
+    typedef typename Chain::Version                     Version;
+    typedef HotPipe<MessageT>                           Self;
+private:
+    aux::EpochDomain _domain;
+    std::atomic<const Version *> _current;
+    /// Serializes writers.
+    std::mutex _writeMtx;
+
+    /// Publishes new version of chain, retiring the previous one and the
+    /// handler removed (if any). Must be called with writers mutex locked.
+    void _publish( Version * nv, AbstractHandlerRef removed=nullptr ) {
+        const Version * old = _current.exchange( nv );
+        _domain.retire( const_cast<Version *>(old) );
+        if( removed ) {
+            _domain.retire( removed );
+        }
+        _domain.collect();
+    }
+
+    template<typename CallableArgT>
+    static AbstractHandlerRef _new_handler( CallableArgT && p ) {
+        typedef typename std::remove_reference<CallableArgT>::type CallableType;
+        return new typename TheHandlerTraits::template Handler< CallableType
+                                , !std::is_lvalue_reference<CallableArgT>::value >(
+                                        std::forward<CallableArgT>(p) );
+    }
+
+    void _check_position( size_t pos, size_t limit ) const {
+        if( pos > limit ) {
+            pipet_error( Malfunction, "Position %zu is out of chain range "
+                    "(%zu handlers).", pos, _current.load()->size() );
+        }
+    }
+public:
+    HotPipe() : _current( new Version() ) {}
+    HotPipe( const HotPipe & ) = delete;
+    /// Deletes handlers and chain. No processing loops may be active.
+    ~HotPipe() {
+        const Version * v = _current.load();
+        for( auto h : *v ) {
+            delete h;
+        }
+        delete v;
+    }
+
+    /// Appends handler to the end of chain.
+    template<typename CallableArgT>
+    void push_back( CallableArgT && p ) {
+        std::unique_lock<std::mutex> lock(_writeMtx);
+        Version * nv = new Version( *_current.load() );
+        nv->push_back( _new_handler( std::forward<CallableArgT>(p) ) );
+        _publish( nv );
+    }
+
+    /// Inserts handler before the given position.
+    template<typename CallableArgT>
+    void insert( size_t pos, CallableArgT && p ) {
+        std::unique_lock<std::mutex> lock(_writeMtx);
+        _check_position( pos, _current.load()->size() );
+        Version * nv = new Version( *_current.load() );
+        nv->insert( nv->begin() + pos, _new_handler( std::forward<CallableArgT>(p) ) );
+        _publish( nv );
+    }
+
+    /// Replaces handler at the given position.
+    template<typename CallableArgT>
+    void replace( size_t pos, CallableArgT && p ) {
+        std::unique_lock<std::mutex> lock(_writeMtx);
+        _check_position( pos + 1, _current.load()->size() );
+        Version * nv = new Version( *_current.load() );
+        AbstractHandlerRef removed = (*nv)[pos];
+        (*nv)[pos] = _new_handler( std::forward<CallableArgT>(p) );
+        _publish( nv, removed );
+    }
+
+    /// Removes handler at the given position.
+    void erase( size_t pos ) {
+        std::unique_lock<std::mutex> lock(_writeMtx);
+        _check_position( pos + 1, _current.load()->size() );
+        Version * nv = new Version( *_current.load() );
+        AbstractHandlerRef removed = (*nv)[pos];
+        nv->erase( nv->begin() + pos );
+        _publish( nv, removed );
+    }
+
+    /// Returns number of handlers in current chain version.
+    size_t size() const { return _current.load()->size(); }
+
+    /// Deletes the retired chains and handlers that aren't reachable by
+    /// processing loops anymore. Returns number of objects deleted.
+    size_t collect() { return _domain.collect(); }
+
+    /// Returns view on current chain version that follows the further
+    /// re-configurations (upon `update()').
+    Chain pin() { return Chain( _domain, _current ); }
+
+    template< typename SourceT
+            , typename LoopResultT=int
+            , typename Arbiter=typename TheHandlerTraits::template IArbiter<LoopResultT> >
+    friend LoopResultT operator<=( Self & p, SourceT & src ) {
+        Arbiter a;
+        Chain c = p.pin();
+        return TheHandlerTraits::process( a, c, src );
+    }
+};  // class HotPipe
+
+# ifndef PIPET_DISABLE_STATS
+/// Returns instrumentation snapshots of the handlers of current chain
+/// version.
+template<typename MessageT> std::vector<stats::Snapshot>
+stats_snapshot( HotPipe<MessageT> & p ) {
+    auto c = p.pin();
+    std::vector<stats::Snapshot> r;
+    for( auto it = c.begin(); c.end() != it; ++it ) {
+        r.push_back( (*it)->stats().snapshot() );
+    }
+    return r;
+}
+# endif
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_HOT_PIPELINE_H
@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_ID_FILTER_H
+# define H_PIPE_T_ID_FILTER_H
+
+# include "hot_pipeline.tcc"
+
+# include <algorithm>
+# include <atomic>
+# include <cstdint>
+# include <functional>
+# include <limits>
+# include <memory>
+# include <mutex>
+# include <thread>
+# include <vector>
+
+namespace pipet {
+namespace aux {
+
+/**@brief Immutable set of integral IDs optimized for membership queries.
+ * @class IDSet
+ *
+ * Representation is chosen upon construction: the dense bitmap is used when
+ * the range of IDs is small compared to their number, and the flat
+ * open-addressing hash table (linear probing, load factor below 1/2)
+ * otherwise. The hash table may be preceded with Bloom filter of one byte per
+ * ID, rejecting the most of absent IDs with no access to the (possibly not
+ * cached) table.
+ *
+ * Batched query performs each stage (hashing, Bloom test, probing) for a
+ * chunk of keys in separate loops having no data-dependent branches, so
+ * compiler is free to vectorize them, and table slots are prefetched before
+ * probing.
+ * */
+template<typename KeyT>
+class IDSet {
+    static_assert( std::is_integral<KeyT>::value
+                 , "IDSet requires integral keys." );
+public:
+    typedef KeyT Key;
+    enum Backend { Bitmap, FlatHash };
+    /// Bitmap is chosen if IDs range does not exceed this number of bits per
+    /// ID (plus `bitmapMinBits').
+    static constexpr uint64_t bitmapBitsPerID = 128
+                            , bitmapMinBits = 1 << 16
+                            ;
+    /// Number of keys processed by batched query stages at once.
+    static constexpr size_t chunkSize = 64;
+private:
+    Backend _backend;
+    size_t _size;
+    // Bitmap backend
+    uint64_t _min
+           , _range
+           ;
+    std::vector<uint64_t> _bits;
+    // Flat hash backend
+    std::vector<uint64_t> _slots;
+    uint64_t _empty;  ///< value marking vacant slot (not in set)
+    unsigned _shift;  ///< 64 - log2(number of slots)
+    std::vector<uint64_t> _bloom;  ///< Bloom filter bits (empty if disabled)
+    uint64_t _bloomMask;
+
+    /// Maps key to unsigned value, keeping the order.
+    static uint64_t _u( Key k ) {
+        return uint64_t(k) - uint64_t(std::numeric_limits<Key>::min());
+    }
+    /// Fibonacci hashing; slot index is taken from the upper bits.
+    static uint64_t _hash( uint64_t u ) {
+        return u * 0x9E3779B97F4A7C15ull;
+    }
+    /// Independent hash for Bloom filter bits.
+    static uint64_t _hash2( uint64_t u ) {
+        u ^= u >> 31;
+        u *= 0xBF58476D1CE4E5B9ull;
+        return u ^ (u >> 29);
+    }
+
+    bool _bitmap_test( uint64_t u ) const {
+        const uint64_t d = u - _min;
+        const bool inRange = d < _range;
+        const uint64_t i = inRange ? d : 0;
+        return inRange & bool((_bits[i >> 6] >> (i & 63)) & 1);
+    }
+    bool _bloom_test( uint64_t u ) const {
+        const uint64_t h = _hash2( u )
+                     , a = h & _bloomMask
+                     , b = (h >> 32) & _bloomMask
+                     ;
+        return ((_bloom[a >> 6] >> (a & 63)) & (_bloom[b >> 6] >> (b & 63))) & 1;
+    }
+    void _bloom_set( uint64_t u ) {
+        const uint64_t h = _hash2( u )
+                     , a = h & _bloomMask
+                     , b = (h >> 32) & _bloomMask
+                     ;
+        _bloom[a >> 6] |= uint64_t(1) << (a & 63);
+        _bloom[b >> 6] |= uint64_t(1) << (b & 63);
+    }
+    bool _probe( uint64_t u, uint64_t h ) const {
+        const uint64_t mask = _slots.size() - 1;
+        for( uint64_t i = h >> _shift; ; i = (i + 1) & mask ) {
+            if( _slots[i] == _empty ) return false;
+            if( _slots[i] == u ) return true;
+        }
+    }
+public:
+    /// Builds set from given IDs (duplicates allowed). Bloom pre-check is
+    /// used only with the hash table backend.
+    IDSet( const std::vector<Key> & ids=std::vector<Key>(), bool bloom=false )
+            : _min(0), _range(0), _empty(0), _shift(63), _bloomMask(0) {
+        std::vector<uint64_t> us;
+        us.reserve( ids.size() );
+        for( Key k : ids ) us.push_back( _u(k) );
+        std::sort( us.begin(), us.end() );
+        us.erase( std::unique( us.begin(), us.end() ), us.end() );
+        _size = us.size();
+        if( us.empty()
+         || us.back() - us.front() < bitmapMinBits + bitmapBitsPerID*us.size() ) {
+            _backend = Bitmap;
+            if( !us.empty() ) {
+                _min = us.front();
+                _range = us.back() - us.front() + 1;
+            }
+            _bits.assign( (_range + 63)/64 + 1, 0 );
+            for( uint64_t u : us ) {
+                const uint64_t d = u - _min;
+                _bits[d >> 6] |= uint64_t(1) << (d & 63);
+            }
+            return;
+        }
+        _backend = FlatHash;
+        // Vacant slot marker is the greatest value not in set
+        _empty = UINT64_MAX;
+        for( auto it = us.rbegin(); us.rend() != it && *it == _empty; ++it ) {
+            --_empty;
+        }
+        size_t nSlots = 2;
+        _shift = 63;
+        while( nSlots < 2*us.size() ) { nSlots *= 2; --_shift; }
+        _slots.assign( nSlots, _empty );
+        for( uint64_t u : us ) {
+            uint64_t i = _hash( u ) >> _shift;
+            while( _slots[i] != _empty ) i = (i + 1) & (nSlots - 1);
+            _slots[i] = u;
+        }
+        if( bloom ) {
+            size_t nBits = 64;
+            while( nBits < 8*us.size() ) nBits *= 2;
+            _bloom.assign( nBits/64, 0 );
+            _bloomMask = nBits - 1;
+            for( uint64_t u : us ) _bloom_set( u );
+        }
+    }
+
+    /// Returns true if ID is in set.
+    bool contains( Key k ) const {
+        const uint64_t u = _u(k);
+        if( Bitmap == _backend ) return _bitmap_test( u );
+        if( !_bloom.empty() && !_bloom_test( u ) ) return false;
+        return _probe( u, _hash( u ) );
+    }
+
+    /// Batched query: sets `out[i]' to whether `keys[i]' is in set.
+    void contains( const Key * keys, size_t n, bool * out ) const {
+        if( Bitmap == _backend ) {
+            for( size_t i = 0; i < n; ++i ) {
+                out[i] = _bitmap_test( _u(keys[i]) );
+            }
+            return;
+        }
+        uint64_t us[chunkSize]
+               , hs[chunkSize]
+               ;
+        for( size_t b = 0; b < n; b += chunkSize ) {
+            const size_t m = std::min( chunkSize, n - b );
+            for( size_t i = 0; i < m; ++i ) {
+                us[i] = _u(keys[b + i]);
+                hs[i] = _hash( us[i] );
+            }
+            if( !_bloom.empty() ) {
+                for( size_t i = 0; i < m; ++i ) {
+                    out[b + i] = _bloom_test( us[i] );
+                }
+            } else {
+                std::fill( out + b, out + b + m, true );
+            }
+            # ifdef __GNUC__
+            for( size_t i = 0; i < m; ++i ) {
+                if( out[b + i] ) __builtin_prefetch( &_slots[hs[i] >> _shift] );
+            }
+            # endif
+            for( size_t i = 0; i < m; ++i ) {
+                if( out[b + i] ) out[b + i] = _probe( us[i], hs[i] );
+            }
+        }
+    }
+
+    Backend backend() const { return _backend; }
+    bool has_bloom() const { return !_bloom.empty(); }
+    /// Number of (unique) IDs in set.
+    size_t size() const { return _size; }
+    /// Memory occupied by the lookup structures, in bytes.
+    size_t n_bytes() const {
+        return sizeof(uint64_t)*( _bits.size() + _slots.size() + _bloom.size() );
+    }
+};  // class IDSet
+
+}  // namespace aux
+
+/**@brief Handler discriminating messages by ID.
+ * @class IDFilter
+ *
+ * Drops (or, in `keepListed' mode, keeps only) the messages whose key, as
+ * obtained by the user-supplied projection, is in the given set of IDs. The
+ * set is kept as `aux::IDSet' (dense bitmap or flat hash with optional Bloom
+ * pre-check), and may be replaced with `assign()' while the filter is being
+ * evaluated by other threads: the lookups are lock-free, and the previous
+ * set is reclaimed via `aux::EpochDomain' once no reader refers to it.
+ *
+ * Each thread evaluating the filter takes one of the epoch domain's reader
+ * slots for the lifetime of the filter, so no more than
+ * `aux::EpochDomain::nSlots' threads may use single instance.
+ *
+ * Besides of per-message `operator()' the `select()' method is provided to
+ * process a batch of messages in a single pass.
+ * */
+template< typename MessageT
+        , typename KeyT >
+class IDFilter {
+public:
+    typedef MessageT Message;
+    typedef aux::IDSet<KeyT> Set;
+    typedef std::function<KeyT(const Message &)> KeyGetter;
+private:
+    const KeyGetter _getKey;
+    const bool _keepListed
+             , _bloom
+             ;
+    const uint64_t _instanceID;
+    std::atomic<const Set *> _current;
+    aux::EpochDomain _domain;
+    std::mutex _writeMtx;
+    /// Readers of the threads ever evaluated the filter.
+    std::vector< std::pair<std::thread::id
+                          , std::unique_ptr<aux::EpochDomain::Reader> > > _readers;
+    std::mutex _readersMtx;
+
+    static uint64_t _new_instance_id() {
+        static std::atomic<uint64_t> n(0);
+        return ++n;
+    }
+
+    /// Number of entries in per-thread cache of readers.
+    static constexpr size_t nCachedReaders = 16;
+
+    /// Returns reader registered for current thread. Readers are cached
+    /// thread-locally in the small table indexed by instance ID, so the
+    /// lookup is taken only once per thread unless more than
+    /// `nCachedReaders' instances collide in the table.
+    aux::EpochDomain::Reader & _reader() {
+        struct Cache { uint64_t owner; aux::EpochDomain::Reader * reader; };
+        static thread_local Cache cache[nCachedReaders] = {};
+        Cache & c = cache[_instanceID % nCachedReaders];
+        if( c.owner == _instanceID ) return *c.reader;
+        std::unique_lock<std::mutex> lock(_readersMtx);
+        const std::thread::id tid = std::this_thread::get_id();
+        aux::EpochDomain::Reader * r = nullptr;
+        for( auto & e : _readers ) {
+            if( e.first == tid ) { r = e.second.get(); break; }
+        }
+        if( !r ) {
+            r = new aux::EpochDomain::Reader(_domain);
+            _readers.emplace_back( tid, std::unique_ptr<aux::EpochDomain::Reader>(r) );
+        }
+        c.owner = _instanceID;
+        c.reader = r;
+        return *r;
+    }
+
+    /// Keeps current set from being reclaimed while in scope.
+    class Pin {
+    private:
+        aux::EpochDomain::Reader & _r;
+    public:
+        const Set & set;
+        Pin( IDFilter & f ) : _r(f._reader())
+                            , set( (_r.pin(), *f._current.load()) ) {}
+        ~Pin() { _r.unpin(); }
+    };
+public:
+    /// By default drops messages with listed IDs; if `keepListed' is set,
+    /// passes only them.
+    IDFilter( KeyGetter getKey
+            , const std::vector<KeyT> & ids
+            , bool keepListed=false
+            , bool bloom=false ) : _getKey(getKey)
+                                 , _keepListed(keepListed)
+                                 , _bloom(bloom)
+                                 , _instanceID(_new_instance_id())
+                                 , _current( new Set(ids, bloom) ) {}
+    IDFilter( const IDFilter & ) = delete;
+    /// No thread may evaluate the filter anymore.
+    ~IDFilter() {
+        _readers.clear();
+        delete _current.load();
+    }
+
+    /// Returns true if message has to be passed.
+    bool operator()( Message & m ) {
+        Pin p(*this);
+        return p.set.contains( _getKey(m) ) == _keepListed;
+    }
+
+    /// Evaluates the filter on batch of messages, setting `pass[i]' to
+    /// whether `msgs[i]' has to be passed. Returns number of messages to pass.
+    size_t select( Message * const * msgs, size_t n, bool * pass ) {
+        KeyT keys[Set::chunkSize];
+        size_t nPassed = 0;
+        Pin p(*this);
+        for( size_t b = 0; b < n; b += Set::chunkSize ) {
+            const size_t m = std::min( Set::chunkSize, n - b );
+            for( size_t i = 0; i < m; ++i ) {
+                keys[i] = _getKey( *msgs[b + i] );
+            }
+            p.set.contains( keys, m, pass + b );
+            for( size_t i = 0; i < m; ++i ) {
+                nPassed += (pass[b + i] = (pass[b + i] == _keepListed));
+            }
+        }
+        return nPassed;
+    }
+
+    /// Atomically replaces the set of IDs. Threads evaluating the filter
+    /// switch to the new set with next message (batch).
+    void assign( const std::vector<KeyT> & ids ) {
+        const Set * ns = new Set( ids, _bloom );
+        std::unique_lock<std::mutex> lock(_writeMtx);
+        const Set * old = _current.exchange( ns );
+        _domain.retire( const_cast<Set *>(old) );
+        _domain.collect();
+    }
+
+    /// Backend chosen for current set.
+    typename Set::Backend backend() {
+        Pin p(*this);
+        return p.set.backend();
+    }
+    /// Number of IDs in current set.
+    size_t size() {
+        Pin p(*this);
+        return p.set.size();
+    }
+    bool keeps_listed() const { return _keepListed; }
+};  // class IDFilter
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_ID_FILTER_H
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_KEY_ROUTER_H
+# define H_PIPE_T_KEY_ROUTER_H
+
+# include "pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <condition_variable>
+# include <deque>
+# include <functional>
+# include <memory>
+# include <mutex>
+# include <thread>
+
+namespace pipet {
+
+/**@brief Fork/junction handler distributing messages among sub-pipelines by
+ *        key.
+ * @class KeyRouter
+ *
+ * Hashes the user-supplied key of each message and dispatches the message to
+ * one of N sub-pipelines, each being evaluated on its own worker thread. All
+ * the messages with the same key are processed by the same sub-pipeline in
+ * order of their arrival, so stateful per-key handlers may be used within
+ * sub-pipelines with no synchronization.
+ *
+ * Messages passed the sub-pipelines are merged back as the junction output
+ * (available via `junction_ptr()'). The relative order is kept only for
+ * messages with the same key. Router returns `Complete' each `batch'
+ * messages dispatched (and the processing loop drains it at the end of
+ * source), making the main loop wait for all the dispatched messages to be
+ * processed; this bounds the number of messages in flight. Messages
+ * discarded by sub-pipelines are released to the pool immediately. Only
+ * messages of the pool given to router are routed by pointer; others are
+ * copied, and the originals are returned to their source at once.
+ *
+ * Worker threads are started upon first message routed; sub-pipelines must
+ * not be modified afterwards. Pulling (`pull_one()') through the router is
+ * possible, but effectively serializes the evaluation.
+ * */
+template< typename MessageT
+        , typename KeyT
+        , typename HashT=std::hash<KeyT> >
+class KeyRouter : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+    typedef Pipe<Message> SubPipe;
+    typedef aux::MessagePool<Message> Pool;
+    typedef std::function<KeyT(const Message &)> KeyGetter;
+private:
+    /// Terminating handler of sub-pipeline that puts passed messages into
+    /// router's output queue.
+    class Outlet {
+    private:
+        KeyRouter & _r;
+    public:
+        Outlet( KeyRouter & r ) : _r(r) {}
+        PipeRC operator()( Message & m ) {
+            std::unique_lock<std::mutex> lock(_r._mtx);
+            _r._out.push_back( &m );
+            _r._drainCV.notify_one();
+            return PipeRC::MessageKept;
+        }
+    };
+
+    /// Worker's input queue acting as the source for its sub-pipeline.
+    class Worker : public interfaces::Source<Message> {
+    private:
+        KeyRouter & _r;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        std::deque<Message *> _in;
+        bool _busy
+           , _stop
+           ;
+        size_t _nRouted;
+    public:
+        SubPipe pipe;
+        Outlet outlet;
+        std::thread thread;
+
+        Worker( KeyRouter & r ) : _r(r), _busy(false), _stop(false)
+                                , _nRouted(0), outlet(r) {}
+
+        void push( Message * m ) {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _in.push_back( m );
+            ++_nRouted;
+            _cv.notify_one();
+        }
+
+        void stop() {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stop = true;
+            _cv.notify_one();
+        }
+
+        /// Blocks until message is routed to the worker; returns nullptr
+        /// once router is being destroyed.
+        virtual Message * get() override {
+            if( _busy ) {
+                // Previous message has been processed.
+                _busy = false;
+                _r._done_one();
+            }
+            std::unique_lock<std::mutex> lock(_mtx);
+            _cv.wait( lock, [this](){ return _stop || !_in.empty(); } );
+            if( _in.empty() ) return nullptr;
+            Message * m = _in.front();
+            _in.pop_front();
+            _busy = true;
+            return m;
+        }
+
+        virtual void release( Message * m ) override { _r._release(m); }
+        virtual bool messages_disposable() const override { return true; }
+
+        /// Releases messages that were not processed.
+        void clear() {
+            for( Message * m : _in ) _r._release( m );
+            _in.clear();
+        }
+
+        size_t n_routed() const { return _nRouted; }
+    };
+
+    KeyGetter _key;
+    HashT _hash;
+    std::vector<std::unique_ptr<Worker> > _workers;
+    aux::PoolRef<Message> _pool;
+    /// Guards output queue and pending counter.
+    std::mutex _mtx;
+    std::condition_variable _drainCV;
+    std::deque<Message *> _out;
+    /// Number of messages dispatched, but not yet processed by workers.
+    size_t _nPending;
+    size_t _batch
+         , _nSinceDrain
+         ;
+    bool _started;
+
+    void _start() {
+        for( auto & w : _workers ) {
+            w->pipe.push_back( w->outlet );
+            Worker * wPtr = w.get();
+            w->thread = std::thread( [wPtr]() {
+                    GenericArbiter<int> a;
+                    SubPipe::TheHandlerTraits::process( a, wPtr->pipe.upcast()
+                                , static_cast<interfaces::Source<Message> &>(*wPtr) );
+                } );
+        }
+        _started = true;
+    }
+
+    void _done_one() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if( !--_nPending ) _drainCV.notify_one();
+    }
+
+    void _release( Message * m ) { _pool.release( m ); }
+public:
+    /// Creates router with given number of sub-pipelines. The `batch' is the
+    /// maximum number of messages dispatched before the router is drained.
+    KeyRouter( KeyGetter key
+             , size_t nWorkers
+             , size_t batch=1024
+             , Pool * pool=nullptr ) : _key(key)
+                                     , _pool(pool)
+                                     , _nPending(0)
+                                     , _batch(batch ? batch : 1)
+                                     , _nSinceDrain(0)
+                                     , _started(false) {
+        if( !nWorkers ) {
+            pipet_error( EmptyManifold, "Key router requires at least one "
+                    "sub-pipeline." );
+        }
+        for( size_t i = 0; i < nWorkers; ++i ) {
+            _workers.emplace_back( new Worker(*this) );
+        }
+    }
+    KeyRouter( const KeyRouter & ) = delete;
+    ~KeyRouter() {
+        for( auto & w : _workers ) {
+            w->stop();
+            if( w->thread.joinable() ) w->thread.join();
+            w->clear();
+        }
+        for( Message * m : _out ) _release( m );
+    }
+
+    /// Returns sub-pipeline to be filled with handlers before evaluation.
+    SubPipe & sub( size_t n ) { return _workers[n]->pipe; }
+    size_t n_workers() const { return _workers.size(); }
+    /// Returns number of messages routed to certain sub-pipeline.
+    size_t n_routed( size_t n ) const { return _workers[n]->n_routed(); }
+
+    /// Dispatches message to the sub-pipeline chosen by key.
+    PipeRC operator()( Message & msg ) {
+        if( !_started ) _start();
+        bool taken;
+        Message * m = _pool.take( msg, taken );
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            ++_nPending;
+        }
+        _workers[ _hash( _key(*m) ) % _workers.size() ]->push( m );
+        if( ++_nSinceDrain >= _batch ) {
+            _nSinceDrain = 0;
+            return taken ? PipeRC::Complete : PipeRC::Filled;
+        }
+        return taken ? PipeRC::MessageKept : PipeRC::Absorbed;
+    }
+
+    /// Emits processed messages, blocking until all the dispatched messages
+    /// are processed.
+    virtual Message * get() override {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _drainCV.wait( lock, [this](){ return !_out.empty() || !_nPending; } );
+        if( _out.empty() ) {
+            _nSinceDrain = 0;
+            return nullptr;
+        }
+        Message * m = _out.front();
+        _out.pop_front();
+        return m;
+    }
+
+    virtual void release( Message * m ) override { _release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+};  // class KeyRouter
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_KEY_ROUTER_H
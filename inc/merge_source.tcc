@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_MERGE_SOURCE_H
+# define H_PIPE_T_MERGE_SOURCE_H
+
+# include "basic_pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <chrono>
+# include <functional>
+# include <memory>
+# include <thread>
+# include <vector>
+
+namespace pipet {
+
+/**@brief Source merging several ordered inputs into single ordered stream.
+ * @class MergeSource
+ *
+ * Each of the inputs has to emit messages ordered by the key (e.g. time
+ * stamp) given by the key getter; merged stream is then ordered by the key
+ * as well (messages with equal keys are emitted in order of inputs).
+ *
+ * Selection is done by the loser tree: each message costs log2(N)
+ * comparisons of the keys cached in contiguous array, with no message
+ * dereferencing. Messages are prefetched from the inputs in batches of up
+ * to `batch' messages (while input is `ready()'), so the tree is replayed
+ * on the local buffers most of the time.
+ *
+ * Input that has no data at the moment (is not `ready()') blocks the merge,
+ * since it may later emit a message preceding the ones already buffered;
+ * the merge polls it every `idle_wait()'. If the idle timeout is set, input
+ * that has no data for longer than timeout is bypassed, so the others are
+ * not held back; messages it emits once it has data again are merged in,
+ * but the ones preceding already emitted messages are counted as late.
+ * Input returning nullptr is depleted; the merge returns nullptr once all
+ * the inputs are depleted.
+ *
+ * Messages of the pool given to the constructor (shared by inputs) are
+ * buffered by pointer. Others (reentrant instances of simple sources, slots
+ * of other pools) are copied into the merge's own slots upon prefetch, as
+ * input may overwrite them on the next `get()'; the originals are returned
+ * to the input at once. Released messages are given back to the input that
+ * has emitted them, if it is the last emitted one and was not copied, or
+ * to the pool otherwise.
+ * */
+template< typename MessageT
+        , typename KeyT
+        , typename CompareT=std::less<KeyT> >
+class MergeSource : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+    typedef aux::MessagePool<Message> Pool;
+    typedef std::function<KeyT(const Message &)> KeyGetter;
+private:
+    static constexpr size_t npos = size_t(-1);
+    /// Prefetched message; `copy' is set if it is the merge's own slot.
+    struct Buffered {
+        Message * msg;
+        bool copy;
+    };
+    /// Input state, along with its prefetched messages.
+    struct Input {
+        interfaces::Source<Message> * src;
+        std::vector<Buffered> buf;
+        size_t head;
+        bool depleted
+           , bypassed
+           ;
+        size_t nTaken;
+        Input( interfaces::Source<Message> & s ) : src(&s), head(0)
+                                                 , depleted(false)
+                                                 , bypassed(false)
+                                                 , nTaken(0) {}
+        bool empty() const { return head == buf.size(); }
+    };
+
+    KeyGetter _key;
+    CompareT _cmp;
+    const size_t _batch;
+    std::chrono::nanoseconds _idleWait
+                           , _idleTimeout
+                           ;
+    std::vector<std::unique_ptr<Input> > _inputs;
+    /// Keys of heads of the inputs and flags of inputs having no head
+    /// (depleted or bypassed).
+    std::vector<KeyT> _keys;
+    std::vector<char> _none;
+    /// Loser tree: [0] is the winner, [1..N-1] are losers of matches.
+    std::vector<size_t> _tree;
+    bool _built;
+    /// Input emitted last message, to be refilled and replayed.
+    size_t _consumed;
+    size_t _nBypassed;
+    Message * _last;
+    size_t _lastInput;
+    bool _lastCopy;
+    /// Pool shared by the inputs, or own one.
+    aux::PoolRef<Message> _pool;
+    /// Greatest key emitted so far.
+    KeyT _maxKey;
+    size_t _nEmitted
+         , _nLate
+         ;
+
+    /// Returns true if head of input a precedes the one of b.
+    bool _precedes( size_t a, size_t b ) const {
+        if( _none[a] ) return false;
+        if( _none[b] ) return true;
+        if( _cmp( _keys[a], _keys[b] ) ) return true;
+        if( _cmp( _keys[b], _keys[a] ) ) return false;
+        return a < b;
+    }
+
+    /// Sets cached key of the input head.
+    void _update_key( size_t n ) {
+        Input & in = *_inputs[n];
+        _none[n] = in.empty();
+        if( !_none[n] ) _keys[n] = _key( *in.buf[in.head].msg );
+    }
+
+    /// Takes messages from input while it is ready, up to batch size.
+    void _prefetch( Input & in ) {
+        in.buf.clear();
+        in.head = 0;
+        while( in.buf.size() < _batch ) {
+            if( !in.buf.empty() && !in.src->ready() ) break;
+            Message * m = in.src->get();
+            if( !m ) {
+                in.depleted = true;
+                break;
+            }
+            if( _pool.owns( m ) ) {
+                in.buf.push_back( Buffered{ m, false } );
+                continue;
+            }
+            in.buf.push_back( Buffered{ in.src->messages_disposable()
+                                      ? _pool.copy( std::move(*m) )
+                                      : _pool.copy( *m )
+                                      , true } );
+            in.src->release( m );
+        }
+    }
+
+    /// Gives buffered message back to the input or the pool.
+    void _release( Input & in, const Buffered & b ) {
+        if( b.copy ) _pool.release( b.msg );
+        else in.src->release( b.msg );
+    }
+
+    /// Refills input buffer, waiting for input to become ready. Returns
+    /// false if input was bypassed due to idle timeout.
+    bool _refill( Input & in ) {
+        if( in.depleted ) return true;
+        const auto waitStart = std::chrono::steady_clock::now();
+        while( !in.src->ready() ) {
+            if( _idleTimeout.count()
+             && std::chrono::steady_clock::now() - waitStart >= _idleTimeout ) {
+                in.bypassed = true;
+                ++_nBypassed;
+                return false;
+            }
+            if( _idleWait.count() ) std::this_thread::sleep_for( _idleWait );
+            else std::this_thread::yield();
+        }
+        _prefetch( in );
+        return true;
+    }
+
+    /// Builds the tree from scratch.
+    void _build() {
+        const size_t n = _inputs.size();
+        _tree.assign( n ? n : 1, npos );
+        for( size_t leaf = 0; leaf < n; ++leaf ) {
+            size_t w = leaf;
+            size_t node = (leaf + n)/2;
+            for( ; node > 0; node /= 2 ) {
+                if( npos == _tree[node] ) {
+                    _tree[node] = w;
+                    break;
+                }
+                if( _precedes( _tree[node], w ) ) std::swap( _tree[node], w );
+            }
+            if( !node ) _tree[0] = w;
+        }
+        _built = true;
+    }
+
+    /// Replays matches on the path of winner leaf, once its key changed.
+    void _replay( size_t leaf ) {
+        size_t w = leaf;
+        for( size_t node = (leaf + _inputs.size())/2; node > 0; node /= 2 ) {
+            if( _precedes( _tree[node], w ) ) std::swap( _tree[node], w );
+        }
+        _tree[0] = w;
+    }
+
+    /// Re-admits bypassed inputs that have data again. Returns true if any
+    /// was re-admitted.
+    bool _readmit() {
+        bool any = false;
+        for( size_t i = 0; i < _inputs.size(); ++i ) {
+            Input & in = *_inputs[i];
+            if( !in.bypassed || !in.src->ready() ) continue;
+            in.bypassed = false;
+            _prefetch( in );
+            _update_key( i );
+            any = true;
+        }
+        return any;
+    }
+public:
+    MergeSource( KeyGetter key
+               , size_t batch=64
+               , CompareT cmp=CompareT()
+               , Pool * pool=nullptr ) : _key(key)
+                                       , _cmp(cmp)
+                                       , _batch(batch ? batch : 1)
+                                       , _idleWait( std::chrono::microseconds(50) )
+                                       , _idleTimeout(0)
+                                       , _built(false)
+                                       , _consumed(npos)
+                                       , _nBypassed(0)
+                                       , _last(nullptr)
+                                       , _lastInput(npos)
+                                       , _lastCopy(false)
+                                       , _pool(pool)
+                                       , _maxKey()
+                                       , _nEmitted(0)
+                                       , _nLate(0) {}
+    MergeSource( const MergeSource & ) = delete;
+    /// Gives prefetched messages back to the inputs.
+    ~MergeSource() {
+        for( auto & in : _inputs ) {
+            for( size_t i = in->head; i < in->buf.size(); ++i ) {
+                _release( *in, in->buf[i] );
+            }
+        }
+    }
+
+    /// Adds ordered input; must be called prior to the first `get()'.
+    size_t add( interfaces::Source<Message> & src ) {
+        if( _built ) {
+            pipet_error( Malfunction, "Input added to merge source in use." );
+        }
+        _inputs.emplace_back( new Input(src) );
+        return _inputs.size() - 1;
+    }
+
+    /// Sets the time to sleep between polling the input having no data.
+    void set_idle_wait( std::chrono::nanoseconds w ) { _idleWait = w; }
+    std::chrono::nanoseconds idle_wait() const { return _idleWait; }
+    /// Sets the time input may have no data before it is bypassed (0, the
+    /// default, means to wait forever, keeping strict order).
+    void set_idle_timeout( std::chrono::nanoseconds t ) { _idleTimeout = t; }
+    std::chrono::nanoseconds idle_timeout() const { return _idleTimeout; }
+
+    size_t n_inputs() const { return _inputs.size(); }
+    /// Number of messages taken from certain input.
+    size_t n_taken( size_t n ) const { return _inputs[n]->nTaken; }
+    size_t n_emitted() const { return _nEmitted; }
+    /// Number of messages emitted after some message with greater key.
+    size_t n_late() const { return _nLate; }
+    /// Number of times the inputs were bypassed due to idle timeout.
+    size_t n_bypassed() const { return _nBypassed; }
+
+    virtual Message * get() override {
+        if( !_built ) {
+            _keys.resize( _inputs.size() );
+            _none.assign( _inputs.size(), 1 );
+            for( size_t i = 0; i < _inputs.size(); ++i ) {
+                _refill( *_inputs[i] );
+                _update_key( i );
+            }
+            _build();
+        } else if( npos != _consumed ) {
+            Input & in = *_inputs[_consumed];
+            if( in.empty() ) _refill( in );
+            _update_key( _consumed );
+            _replay( _consumed );
+            _consumed = npos;
+        }
+        if( _nBypassed && _readmit() ) _build();
+        while( _inputs.empty() || _none[_tree[0]] ) {
+            // Nothing to emit; wait for bypassed inputs, if any
+            bool anyBypassed = false;
+            for( auto & in : _inputs ) anyBypassed |= in->bypassed;
+            if( !anyBypassed ) return nullptr;
+            if( _idleWait.count() ) std::this_thread::sleep_for( _idleWait );
+            else std::this_thread::yield();
+            if( _readmit() ) _build();
+        }
+        const size_t w = _tree[0];
+        Input & in = *_inputs[w];
+        const Buffered & b = in.buf[in.head++];
+        Message * m = b.msg;
+        _lastCopy = b.copy;
+        if( !_nEmitted || _cmp( _maxKey, _keys[w] ) ) {
+            _maxKey = _keys[w];
+        } else if( _cmp( _keys[w], _maxKey ) ) {
+            ++_nLate;
+        }
+        ++_nEmitted;
+        ++in.nTaken;
+        _consumed = w;
+        if( !in.empty() ) {
+            // Next key is known, replay now to keep the buffer hot
+            _update_key( w );
+            _replay( w );
+            _consumed = npos;
+        }
+        _last = m;
+        _lastInput = w;
+        return m;
+    }
+
+    virtual void release( Message * m ) override {
+        if( m == _last && !_lastCopy ) {
+            _last = nullptr;
+            _inputs[_lastInput]->src->release( m );
+            return;
+        }
+        if( m == _last ) _last = nullptr;
+        _pool.release( m );
+    }
+
+    /// Messages are disposable if they are for each of the inputs.
+    virtual bool messages_disposable() const override {
+        for( const auto & in : _inputs ) {
+            if( !in->src->messages_disposable() ) return false;
+        }
+        return true;
+    }
+};  // class MergeSource
+
+template< typename MessageT
+        , typename KeyT
+        , typename CompareT
+        > constexpr size_t MergeSource<MessageT, KeyT, CompareT>::npos;
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_MERGE_SOURCE_H
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_MESSAGE_POOL_H
+# define H_PIPE_T_MESSAGE_POOL_H
+
+# include "basic_pipeline.tcc"
+
+# include <algorithm>
+# include <atomic>
+# include <cstring>
+# include <deque>
+# include <memory>
+# include <mutex>
+# include <type_traits>
+
+namespace pipet {
+namespace aux {
+
+/**@brief Free-list storage of reusable message slots.
+ * @class MessagePool
+ *
+ * Sources acquire slots from the pool instead of re-using single reentrant
+ * message instance, so the message address stays valid while message is
+ * held by fork/junction handlers. The ownership is passed along the pipeline
+ * by pointer: the source (or junction) that has emitted the message gets it
+ * back with `interfaces::Source::release()` once the propagation is over,
+ * and returns the slot to the free list.
+ *
+ * Slots are allocated in chunks of growing size and are never moved, so the
+ * pointers remain valid for the pool lifetime. Released slots are not
+ * re-initialized: it is up to the source to (re-)set the message fields
+ * upon `acquire()`. Pools are not aware of each other: handlers keeping
+ * messages recognize the pooled ones by the pool they were constructed
+ * with (see `PoolRef').
+ * */
+template<typename MessageT>
+class MessagePool {
+public:
+    typedef MessageT Message;
+    /// Chunks sizes double, so this number of chunks is never exceeded.
+    static constexpr size_t nMaxChunks = 48;
+private:
+    /// Slot chunks and their [begin, end) ranges. Ranges are published by
+    /// the chunks counter, so `owns()' does not lock the mutex.
+    std::unique_ptr<Message[]> _chunks[nMaxChunks];
+    const Message * _chunkBgn[nMaxChunks]
+                , * _chunkEnd[nMaxChunks]
+                ;
+    std::atomic<size_t> _nChunks;
+    /// Free slots list.
+    std::vector<Message *> _free;
+    /// Size of next chunk to be allocated.
+    size_t _nextChunkSize;
+    /// Overall number of slots allocated.
+    size_t _nSlots;
+    /// Guards the free list as release may occur from junction threads.
+    mutable std::mutex _mtx;
+protected:
+    /// Allocates new chunk of slots and appends them to the free list.
+    void _grow() {
+        const size_t n = _nChunks.load( std::memory_order_relaxed );
+        if( nMaxChunks == n ) {
+            pipet_error( Malfunction, "Message pool %p exhausted.", this );
+        }
+        _chunks[n].reset( new Message [_nextChunkSize] );
+        Message * b = _chunks[n].get();
+        _chunkBgn[n] = b;
+        _chunkEnd[n] = b + _nextChunkSize;
+        _nChunks.store( n + 1, std::memory_order_release );
+        _free.reserve( _free.size() + _nextChunkSize );
+        for( size_t i = _nextChunkSize; i > 0; --i ) {
+            _free.push_back( b + i - 1 );
+        }
+        _nSlots += _nextChunkSize;
+        _nextChunkSize *= 2;
+    }
+public:
+    MessagePool( size_t nInitial=16 ) : _nChunks(0)
+                                      , _nextChunkSize(nInitial ? nInitial : 1)
+                                      , _nSlots(0) {}
+    MessagePool( const MessagePool & ) = delete;
+
+    /// Returns vacant slot, allocating new chunk if free list is depleted.
+    Message * acquire() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if( _free.empty() ) {
+            _grow();
+        }
+        Message * m = _free.back();
+        _free.pop_back();
+        return m;
+    }
+
+    /// Puts the slot back to the free list.
+    void release( Message * m ) {
+        # ifndef NDEBUG
+        if( !owns(m) ) {
+            pipet_error( Malfunction, "Message %p does not belong to "
+                    "pool %p.", m, this );
+        }
+        # endif
+        std::unique_lock<std::mutex> lock(_mtx);
+        _free.push_back( m );
+    }
+
+    /// Returns true if given message instance is one of the pool's slots.
+    /// Lock-free, costs a range check per chunk (few of them).
+    bool owns( const Message * m ) const {
+        const size_t n = _nChunks.load( std::memory_order_acquire );
+        for( size_t i = 0; i < n; ++i ) {
+            if( !std::less<const Message *>()( m, _chunkBgn[i] )
+              && std::less<const Message *>()( m, _chunkEnd[i] ) ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Overall number of slots allocated by pool.
+    size_t n_slots() const {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _nSlots;
+    }
+    /// Number of slots currently vacant.
+    size_t n_free() const {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _free.size();
+    }
+};  // class MessagePool
+
+template<typename MessageT> constexpr size_t MessagePool<MessageT>::nMaxChunks;
+
+/**@brief Pool shared with the upstream source.
+ * @class PoolRef
+ *
+ * Handlers keeping messages by pointer (forks, routers) recognize pooled
+ * messages by the pool they were constructed with. The messages of this
+ * pool are taken with no copying; foreign ones (the reentrant instances of
+ * simple sources, slots of other pools) are copied into its slot, so the
+ * handler must not report them as held and the processing loop returns the
+ * originals to their sources. If no pool is given, the own one is allocated
+ * for the copies.
+ * */
+template<typename MessageT>
+class PoolRef {
+public:
+    typedef MessageT Message;
+    typedef MessagePool<Message> Pool;
+private:
+    Pool * _poolPtr;
+    std::unique_ptr<Pool> _ownPool;
+public:
+    PoolRef( Pool * poolPtr=nullptr ) : _poolPtr(poolPtr) {
+        if( !_poolPtr ) {
+            _ownPool.reset( new Pool() );
+            _poolPtr = _ownPool.get();
+        }
+    }
+    PoolRef( const PoolRef & ) = delete;
+    PoolRef( PoolRef && o ) : _poolPtr(o._poolPtr)
+                            , _ownPool(std::move(o._ownPool)) {}
+
+    /// Returns given message if it is pool's slot, or the slot with its
+    /// copy otherwise. The `taken' flag is set if message is taken by
+    /// pointer.
+    Message * take( Message & m, bool & taken ) {
+        taken = _poolPtr->owns( &m );
+        return taken ? &m : copy( m );
+    }
+    /// Returns the slot with copy of the message.
+    Message * copy( const Message & m ) {
+        Message * slot = _poolPtr->acquire();
+        *slot = m;
+        return slot;
+    }
+    /// Returns the slot with message content moved in.
+    Message * copy( Message && m ) {
+        Message * slot = _poolPtr->acquire();
+        *slot = std::move(m);
+        return slot;
+    }
+
+    bool owns( const Message * m ) const { return _poolPtr->owns( m ); }
+    void release( Message * m ) { _poolPtr->release( m ); }
+    Pool & pool() { return *_poolPtr; }
+};  // class PoolRef
+
+/**@brief FIFO of the messages held by fork/junction handler.
+ * @class PooledQueue
+ *
+ * Helper for accumulating handlers that keep messages (returning
+ * `MessageKept'/`Complete') and further emit them as a source. Messages
+ * belonging to the queue's pool are kept by pointer with no copying, and
+ * are returned to the pool upon `release()'. Foreign ones are copied (or
+ * moved, for rvalues) into the slot acquired from the pool; `hold()' then
+ * returns false, and the handler has to return `Absorbed'/`Filled'
+ * instead, so the original is released to its source by the processing
+ * loop.
+ * */
+template<typename MessageT>
+class PooledQueue {
+public:
+    typedef MessageT Message;
+    typedef MessagePool<Message> Pool;
+private:
+    PoolRef<Message> _pool;
+    std::deque<Message *> _held;
+public:
+    /// If no pool is given, queue will allocate its own one for foreign
+    /// messages.
+    PooledQueue( Pool * poolPtr=nullptr ) : _pool(poolPtr) {}
+    PooledQueue( const PooledQueue & ) = delete;
+    PooledQueue( PooledQueue && o ) : _pool(std::move(o._pool))
+                                    , _held(std::move(o._held)) {
+        o._held.clear();
+    }
+    ~PooledQueue() { clear(); }
+
+    /// Takes ownership over the message if it is pool's slot (returns true),
+    /// or keeps its copy (returns false).
+    bool hold( Message & m ) {
+        bool taken;
+        _held.push_back( _pool.take( m, taken ) );
+        return taken;
+    }
+
+    /// Keeps a copy of the message.
+    void hold( const Message & m ) {
+        _held.push_back( _pool.copy( m ) );
+    }
+
+    /// Moves the message content into the queue.
+    void hold( Message && m ) {
+        _held.push_back( _pool.copy( std::move(m) ) );
+    }
+
+    /// Hands out the oldest message held, or nullptr if queue is empty.
+    Message * pop() {
+        if( _held.empty() ) return nullptr;
+        Message * m = _held.front();
+        _held.pop_front();
+        return m;
+    }
+
+    /// Returns the message slot to the pool.
+    void release( Message * m ) {
+        _pool.release( m );
+    }
+
+    /// Releases all the held messages.
+    void clear() {
+        for( Message * m : _held ) {
+            release( m );
+        }
+        _held.clear();
+    }
+
+    size_t size() const { return _held.size(); }
+    bool empty() const { return _held.empty(); }
+    Pool & pool() { return _pool.pool(); }
+};  // class PooledQueue
+
+/**@brief Defines how message is (de-)serialized into byte record.
+ *
+ * Used by the transports and storage that can not keep message instances
+ * (shared memory ring, capture files). Default implementation copies
+ * trivially copyable messages as is. Other messages types have to
+ * specialize the traits.
+ * */
+template<typename MessageT>
+struct RecordTraits {
+    static_assert( std::is_trivially_copyable<MessageT>::value
+                 , "Record traits have to be specialized for message type." );
+    /// Returns size of the record.
+    static size_t size( const MessageT & ) { return sizeof(MessageT); }
+    /// Writes message into the record of size(m) bytes.
+    static void pack( const MessageT & m, void * dest ) {
+        memcpy( dest, &m, sizeof(MessageT) );
+    }
+    /// Restores message from the record.
+    static void unpack( const void * src, size_t, MessageT & m ) {
+        memcpy( &m, src, sizeof(MessageT) );
+    }
+};
+
+}  // namespace aux
+}  // namespace pipet
+
+# endif  // H_PIPE_T_MESSAGE_POOL_H
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_MICRO_BATCHER_H
+# define H_PIPE_T_MICRO_BATCHER_H
+
+# include "pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <chrono>
+# include <condition_variable>
+# include <deque>
+# include <mutex>
+# include <thread>
+# include <vector>
+
+namespace pipet {
+
+/**@brief Handler accumulating messages into batches evaluated by worker
+ *        thread.
+ * @class MicroBatcher
+ *
+ * Takes over the messages (returning `MessageKept') and collects them into
+ * batch that is handed to the worker thread once it contains `maxSize'
+ * messages, or once its oldest message has waited for `deadline', whichever
+ * comes first. So under load the batches are full, while at low rate no
+ * message is delayed for more than the deadline. Worker evaluates the
+ * sub-pipeline (see `sub()') on the messages of each batch; messages are
+ * released to the pool as sub-pipeline is done with them. Messages that do
+ * not belong to the pool given to batcher (if any) are copied, and the
+ * originals are returned to their source at once.
+ *
+ * The batcher is terminal for the encompassing pipeline: handlers following
+ * it never get messages. Producer is blocked while `maxPending' batches are
+ * waiting for the worker. Call `drain()' once the source is depleted to
+ * flush the incomplete batch and wait for its evaluation.
+ *
+ * Statistics include the latency of each message (from its arrival till
+ * the sub-pipeline is done with it) and the batches fill.
+ * */
+template<typename MessageT>
+class MicroBatcher {
+public:
+    typedef MessageT Message;
+    typedef Pipe<Message> SubPipe;
+    typedef aux::MessagePool<Message> Pool;
+    /// Batches statistics.
+    struct Stats {
+        size_t nBatches  ///< number of batches evaluated
+             , nMessages  ///< number of messages in evaluated batches
+             , nBySize  ///< batches flushed being full
+             , nByDeadline  ///< batches flushed due to deadline
+             , nByDrain  ///< batches flushed by `drain()'
+             ;
+        /// Average ratio of batch size to maximum.
+        double mean_fill( size_t maxSize ) const {
+            return nBatches ? double(nMessages)/(nBatches*maxSize) : 0.;
+        }
+    };
+private:
+    enum FlushReason { BySize, ByDeadline, ByDrain };
+    struct Batch {
+        std::vector<Message *> msgs;
+        std::vector<uint64_t> arrivals;
+        void clear() { msgs.clear(); arrivals.clear(); }
+    };
+
+    /// Source emitting messages of the batch being evaluated.
+    class BatchSource : public interfaces::Source<Message> {
+    private:
+        MicroBatcher & _b;
+        Batch * _batch;
+        size_t _next;
+    public:
+        BatchSource( MicroBatcher & b ) : _b(b), _batch(nullptr), _next(0) {}
+        void reset( Batch * batch ) { _batch = batch; _next = 0; }
+        virtual Message * get() override {
+            if( _next ) {
+                // Previous message is done with
+                _b._latency.record( stats::now() - _batch->arrivals[_next - 1] );
+            }
+            if( _next == _batch->msgs.size() ) return nullptr;
+            return _batch->msgs[_next++];
+        }
+        virtual void release( Message * m ) override { _b._own.release( m ); }
+        virtual bool messages_disposable() const override { return true; }
+    };
+
+    const size_t _maxSize
+               , _maxPending
+               ;
+    const uint64_t _deadline;
+    SubPipe _sub;
+    /// Converts foreign messages to pooled ones and releases them.
+    aux::PoolRef<Message> _own;
+    std::mutex _mtx;
+    std::condition_variable _workerCV
+                          , _producerCV
+                          ;
+    Batch _open;
+    std::deque<Batch> _sealed;
+    bool _busy
+       , _stop
+       ;
+    Stats _stats;
+    stats::LatencyHistogram _latency;
+    std::thread _worker;
+
+    /// Moves open batch to the worker's queue. Must be called with mutex
+    /// locked.
+    void _seal( FlushReason r ) {
+        switch( r ) {
+            case BySize: ++_stats.nBySize; break;
+            case ByDeadline: ++_stats.nByDeadline; break;
+            case ByDrain: ++_stats.nByDrain; break;
+        }
+        _sealed.push_back( std::move(_open) );
+        _open.clear();
+        _workerCV.notify_one();
+    }
+
+    void _run() {
+        BatchSource src(*this);
+        std::unique_lock<std::mutex> lock(_mtx);
+        for(;;) {
+            if( !_sealed.empty() ) {
+                Batch batch( std::move(_sealed.front()) );
+                _sealed.pop_front();
+                _busy = true;
+                _producerCV.notify_all();
+                lock.unlock();
+                src.reset( &batch );
+                GenericArbiter<int> a;
+                SubPipe::TheHandlerTraits::process( a, _sub.upcast()
+                            , static_cast<interfaces::Source<Message> &>(src) );
+                lock.lock();
+                _busy = false;
+                ++_stats.nBatches;
+                _stats.nMessages += batch.msgs.size();
+                _producerCV.notify_all();
+                continue;
+            }
+            if( _stop ) return;
+            if( _open.msgs.empty() ) {
+                _workerCV.wait( lock );
+                continue;
+            }
+            const uint64_t deadline = _open.arrivals.front() + _deadline;
+            if( stats::now() >= deadline ) {
+                _seal( ByDeadline );
+                continue;
+            }
+            _workerCV.wait_until( lock, std::chrono::steady_clock::time_point(
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::nanoseconds(deadline) ) ) );
+        }
+    }
+public:
+    MicroBatcher( size_t maxSize
+                , std::chrono::nanoseconds deadline
+                , size_t maxPending=4
+                , Pool * pool=nullptr ) : _maxSize(maxSize ? maxSize : 1)
+                                        , _maxPending(maxPending ? maxPending : 1)
+                                        , _deadline(deadline.count())
+                                        , _own(pool)
+                                        , _busy(false)
+                                        , _stop(false)
+                                        , _stats{0, 0, 0, 0, 0} {}
+    MicroBatcher( const MicroBatcher & ) = delete;
+    /// Evaluates the batches collected and stops the worker.
+    ~MicroBatcher() {
+        drain();
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stop = true;
+            _workerCV.notify_one();
+        }
+        if( _worker.joinable() ) _worker.join();
+    }
+
+    /// Returns sub-pipeline evaluated on batches. Must not be modified once
+    /// the first message was given to the batcher.
+    SubPipe & sub() { return _sub; }
+
+    PipeRC operator()( Message & m ) {
+        const uint64_t t = stats::now();
+        bool taken;
+        Message * mPtr = _own.take( m, taken );
+        std::unique_lock<std::mutex> lock(_mtx);
+        if( !_worker.joinable() ) {
+            _worker = std::thread( &MicroBatcher::_run, this );
+        }
+        _producerCV.wait( lock, [this](){ return _sealed.size() < _maxPending; } );
+        _open.msgs.push_back( mPtr );
+        _open.arrivals.push_back( t );
+        if( _open.msgs.size() >= _maxSize ) {
+            _seal( BySize );
+        } else if( 1 == _open.msgs.size() ) {
+            // Worker has to arm the deadline timer
+            _workerCV.notify_one();
+        }
+        return taken ? PipeRC::MessageKept : PipeRC::Absorbed;
+    }
+
+    /// Flushes incomplete batch and blocks until all the batches are
+    /// evaluated.
+    void drain() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if( !_open.msgs.empty() ) _seal( ByDrain );
+        _producerCV.wait( lock, [this](){ return _sealed.empty() && !_busy; } );
+    }
+
+    size_t max_size() const { return _maxSize; }
+    std::chrono::nanoseconds deadline() const { return std::chrono::nanoseconds(_deadline); }
+    /// Returns copy of batches statistics.
+    Stats batch_stats() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _stats;
+    }
+    /// Histogram of messages latency.
+    const stats::LatencyHistogram & latency() const { return _latency; }
+};  // class MicroBatcher
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_MICRO_BATCHER_H
@@ -66,6 +66,13 @@ public:
 };  // class Malfunction
 
 
+/// Operating system call (shared memory mapping, etc.) has failed.
+class SystemError : public std::runtime_error {
+public:
+    SystemError( const std::string & s ) : std::runtime_error(s) {}
+};  // class SystemError
+
+
 /// Development stub. Indicates code that is not being currently implemented but
 /// is provisioned by general architecture.
 class NotImplemented : public std::runtime_error {
@@ -25,7 +25,9 @@
 # define H_PIPE_T_PIPELINE_H
 
 # include "basic_pipeline.tcc"
+# include "stats.tcc"
 
+# include <iterator>
 # include <stack>
 # include <utility>
 # include <type_traits>
@@ -47,9 +49,16 @@ enum struct PipeRC : int8_t {
     f_NextMessage = 0x1,
     f_NextHandler = 0x2,
     f_MessageHold = 0x4,
+    f_ContentTaken = 0x8,
     Continue    = f_NextMessage | f_NextHandler,
     MessageKept = f_NextMessage | f_MessageHold,
-    Complete    = f_NextHandler | f_MessageHold
+    Complete    = f_NextHandler | f_MessageHold,
+    /// Handler has taken the message content (e.g. copy of the foreign
+    /// message), while the instance returns to its source.
+    Absorbed    = f_NextMessage | f_ContentTaken,
+    /// Junction is filled, but the message instance was not kept by handler
+    /// (only its content was taken), so it returns to its source.
+    Filled      = f_NextHandler | f_ContentTaken
 };
 
 inline bool operator & (PipeRC lhs, PipeRC rhs) {
@@ -67,6 +76,9 @@ public:
     typedef typename Parent::Message Message;
 private:
     ISource * _castCache;
+    # ifndef PIPET_DISABLE_STATS
+    stats::HandlerStats _stats;
+    # endif
 protected:
     template< typename T>
     typename std::enable_if<std::is_polymorphic<T>::value, ISource *>::type _junction_ptr( T & srcRef ) {
@@ -87,6 +99,12 @@ public:
     virtual ISource * junction_ptr() {
         return _castCache;
     }
+
+    # ifndef PIPET_DISABLE_STATS
+    /// Instrumentation counters (see stats.tcc).
+    stats::HandlerStats & stats() { return _stats; }
+    const stats::HandlerStats & stats() const { return _stats; }
+    # endif
 };  // class iPipeHandler
 
 template<typename ResT>
@@ -97,20 +115,38 @@ private:
     bool _doAbort
        , _doSkip
        , _forkFilled
+       , _forkFilling
+       , _msgHeld
+       , _greedy
        ;
+    stats::LatencyHistogram * _latency;
 protected:
     virtual void _reset_flags() {
-        _doAbort = _doSkip = _forkFilled = false;
+        _doAbort = _doSkip = _forkFilled = _forkFilling = _msgHeld = false;
     }
 public:
-    GenericArbiter() {
+    GenericArbiter( bool greedy=false ) : _greedy(greedy), _latency(nullptr) {
         _reset_flags();
     }
+    /// Chooses the "greedy" fork-filling strategy: once an accumulating
+    /// handler has kept the message, pull_one() keeps taking messages from
+    /// the same source until the fork is complete (or source is depleted),
+    /// instead of restarting the chain iteration from its tail.
+    void set_greedy( bool v ) { _greedy = v; }
+    bool is_greedy() const { return _greedy; }
+    /// Sets histogram to record the latency (time passed since message was
+    /// stamped by source) of messages passed the whole chain or pulled.
+    void set_latency_histogram( stats::LatencyHistogram * h ) { _latency = h; }
+    stats::LatencyHistogram * latency_histogram() const { return _latency; }
     /// Causes transitions
     virtual bool consider_handler_result( PipeRC fs ) override {
         _doAbort = !((PipeRC::f_NextMessage & fs) | (PipeRC::f_NextHandler & fs));
         _doSkip = !(PipeRC::f_NextMessage & fs);
-        _forkFilled = (PipeRC::f_MessageHold & fs) && (PipeRC::f_NextHandler & fs);
+        _msgHeld = PipeRC::f_MessageHold & fs;
+        _forkFilled = (_msgHeld || (PipeRC::f_ContentTaken & fs))
+                   && (PipeRC::f_NextHandler & fs);
+        _forkFilling = (_msgHeld || (PipeRC::f_ContentTaken & fs))
+                    && !(PipeRC::f_NextHandler & fs);
         return PipeRC::f_NextHandler & fs;
     }
     virtual bool next_message() override {
@@ -119,6 +155,16 @@ public:
     virtual bool previous_is_full() const {
         return _forkFilled;
     }
+    /// Returns true if latest handler has kept the message (or its content)
+    /// being not yet filled (`MessageKept', `Absorbed').
+    virtual bool fork_filling() const {
+        return _forkFilling;
+    }
+    /// Returns true if latest handler has taken over the message ownership,
+    /// so it must not be released to its source.
+    virtual bool message_held() const {
+        return _msgHeld;
+    }
     /// This is the single method that has to be overriden by particular
     /// descendant.
     virtual ResT pop_result() override {
@@ -142,19 +188,40 @@ struct HandlerTraits< MessageT
     typedef iPipeHandler<Message, HandlerResult>        AbstractHandler;
     typedef AbstractHandler *                           AbstractHandlerRef;
 
-    template<typename CallableT>
+    template< typename CallableT
+            , bool ownsCallable=false >
     class Handler : public PrimitiveHandler<Message
                                            , HandlerResult
                                            , CallableT
-                                           , iPipeHandler> {
+                                           , iPipeHandler
+                                           , ownsCallable> {
     public:
         typedef PrimitiveHandler<Message
                                 , HandlerResult
                                 , CallableT
-                                , iPipeHandler> Parent;
+                                , iPipeHandler
+                                , ownsCallable> Parent;
         typedef typename Parent::CallableRef CallableRef;
     public:
         Handler( CallableRef pRef ) : Parent( pRef ) {}
+        Handler( CallableT && p ) : Parent( std::move(p) ) {}
+
+        virtual HandlerResult process( Message & m ) override {
+            # ifndef PIPET_DISABLE_STATS
+            if( stats::enabled() ) {
+                stats::Timer t;
+                HandlerResult rc = Parent::process( m );
+                this->stats().account( PipeRC::f_NextHandler & rc
+                        , !( (PipeRC::f_NextHandler & rc)
+                          || (PipeRC::f_MessageHold & rc)
+                          || (PipeRC::f_ContentTaken & rc) )
+                        , false
+                        , t.elapsed() );
+                return rc;
+            }
+            # endif
+            return Parent::process( m );
+        }
     };
 
     template< template <typename...> class ChainT
@@ -175,6 +242,19 @@ struct HandlerTraits< MessageT
                                , ChainT<AbstractHandlerRef, ChainTArgs...> & chain
                                , SourceT && src
                                , MessageT & targetMessage );
+
+    /// Same as pull_one(), but instead of delivering message content into
+    /// target, provides the lease on the message instance owned by source
+    /// (or junction handler).
+    template< template <typename...> class ChainT
+            , typename LoopResultT
+            , typename SourceT
+            , typename ... ChainTArgs
+            >
+    static LoopResultT lease_one( GenericArbiter<LoopResultT> &a
+                                , ChainT<AbstractHandlerRef, ChainTArgs...> & chain
+                                , SourceT && src
+                                , aux::MessageLease<MessageT> & lease );
     template<typename LoopResultT> using IArbiter = GenericArbiter<LoopResultT>;
 };
 
@@ -236,14 +316,24 @@ HandlerTraits< MessageT
         // Begin of loop iterating messages source.
         Message * msg;  // while(!!(msg = cSrc.next()))
         while( !! (msg = cSrc.get()) ) {
+            if( 1 == sourcesStack.size()
+             && aux::ChainTraits<Chain>::update( chain ) ) {
+                // Chain was re-configured while the lowest source is being
+                // iterated (no iterators are kept in stack).
+                procStart = sourcesStack.top().second = chain.begin();
+            }
             typename Chain::iterator handlerIt;
+            // Whether the message was kept by one of the handlers.
+            bool held = false;
             // Begin of loop iterating the handlers chain.
             for( handlerIt = procStart
                ; handlerIt != chain.end()
                ; ++handlerIt ) {
                 AbstractHandler & h = **handlerIt;
                 // Process message with current handler and consider result.
-                if( a.consider_handler_result( h.process( *msg ) ) ) {
+                bool goesOn = a.consider_handler_result( h.process( *msg ) );
+                held = a.message_held();
+                if( goesOn ) {
                     // consider_handler_result() returned true, what means we
                     // can propagate further along the handlers chain.
                     if( a.previous_is_full() ){
@@ -272,8 +362,20 @@ HandlerTraits< MessageT
                 // _V_consider_handler_result() returned false, that means we have
                 // to interrupt the propagation, but if we have filled the
                 // f/j handler, it must be put on top of sources stack.
+                // Note, that the loop is always "greedy": the fork that has
+                // kept the message (a.fork_filling()) gets the next one from
+                // the current source, with no regard to a.is_greedy().
                 break;
             }  // handler iteration loop
+            if( chain.end() == handlerIt && a.latency_histogram() ) {
+                // Message has passed the entire chain.
+                stats::record_latency( *msg, *a.latency_histogram() );
+            }
+            if( !held ) {
+                // Propagation is over and message ownership returns back
+                // to its source.
+                cSrc.release( msg );
+            }
             if( !a.next_message() ) {
                 // We have to take next (newly-created) source from internal
                 // queue and proceed with it.
@@ -308,18 +410,23 @@ template< template <typename...> class ChainT
         > LoopResultT
 HandlerTraits< MessageT
              , PipeRC
-             , iPipeHandler>::pull_one( GenericArbiter< LoopResultT > & a
-                                      , ChainT< AbstractHandlerRef, ChainTArgs... > & chain
-                                      , SourceT && src
-                                      , MessageT & targetMessage ) {
+             , iPipeHandler>::lease_one( GenericArbiter< LoopResultT > & a
+                                       , ChainT< AbstractHandlerRef, ChainTArgs... > & chain
+                                       , SourceT && src
+                                       , aux::MessageLease<MessageT> & lease ) {
     // Deduced chain (pipeline's iterable container) type
     typedef ChainT< AbstractHandlerRef, ChainTArgs... > Chain;
+    // Set when fork got filled, so junction has to emit its messages.
+    bool forkFilled;
     do {
+        forkFilled = false;
         std::stack<typename Chain::reverse_iterator> tStack;
         Message * msg = nullptr;
+        // Junction that has emitted the message (if any).
+        interfaces::Source<Message> * srcPtr = nullptr;
         // Iterate back from chain end
-        for( auto it = chain.rbegin(); it != chain.rend(); ++it ) {
-            interfaces::Source<Message> * srcPtr;
+        typename Chain::reverse_iterator it = chain.rbegin();
+        for( ; it != chain.rend(); ++it ) {
             // If handler may act like source
             if( !! (srcPtr = (*it)->junction_ptr()) ) {
                 // If handler is able to emit a message
@@ -331,6 +438,7 @@ HandlerTraits< MessageT
             tStack.push( it );
         }
         if( !msg ) {
+            srcPtr = nullptr;
             if( ! (msg = src.get()) ) {
                 // Even given source is unable to return the event --- abort.
                 // return a.pop_result();
@@ -339,41 +447,118 @@ HandlerTraits< MessageT
                 throw pipet::errors::UnableToPull( &src );
             }
         }
+        // Handlers stack ends at the message emitter (junction or chain
+        // beginning); handlers popped by propagation are pushed back from
+        // here to apply them to the messages from the same source (greedy
+        // strategy only).
+        const typename Chain::reverse_iterator emitterIt = it;
+        bool held = false;
         while( !tStack.empty() ) {
-            if( a.consider_handler_result( (*tStack.top())->process( *msg ) ) ) {
+            bool goesOn = a.consider_handler_result( (*tStack.top())->process( *msg ) );
+            held = a.message_held();
+            if( goesOn ) {
+                if( a.previous_is_full() ) {
+                    // Fork is filled and keeps the message: restart chain
+                    // iteration for junction to emit.
+                    forkFilled = true;
+                    break;
+                }
                 tStack.pop();
                 // ok, invoke next handler
                 continue;
             }
-            // (Dev note) this commented code block should give a gist of
-            // "greed" strategy aspect for future development.
-            //if( a.fork_filling() && a.is_greedy() ) {
-            //    // Abort caused by accumulating handler and greedy strategy
-            //    // is chosen. Current loop shall request next message.
-            //    it = tStack.rbegin();
-            //} else {
-            //    break;  // restart chain iteration
-            //}
+            if( a.fork_filling() && a.is_greedy() && a.next_message() ) {
+                // Abort caused by accumulating handler and greedy strategy
+                // is chosen. Current loop requests next message from the same
+                // source, with no reverse scan of the chain.
+                Message * next = srcPtr ? srcPtr->get() : src.get();
+                if( next ) {
+                    if( !held ) {
+                        // Handler has taken message content only
+                        // (`Absorbed').
+                        if( srcPtr ) {
+                            srcPtr->release( msg );
+                        } else {
+                            aux::release_message( src, msg, 0 );
+                        }
+                    }
+                    msg = next;
+                    held = false;
+                    for( it = std::next( tStack.top() ); emitterIt != it; ++it ) {
+                        tStack.push( it );
+                    }
+                    continue;
+                }
+            }
             // Current message propagation has to be aborted
             break;
         }
         if( tStack.empty() ) {
             // Means, the message has passed all the chain and may be
-            // considered as a result.
-            targetMessage = *msg;
+            // considered as a result. Ownership goes to the lease.
+            if( a.latency_histogram() ) {
+                stats::record_latency( *msg, *a.latency_histogram() );
+            }
+            if( srcPtr ) {
+                lease.assign( msg, *srcPtr );
+            } else {
+                lease.assign( msg, src );
+            }
             break;
         }
-    } while( a.next_message() );
+        if( !held ) {
+            if( srcPtr ) {
+                srcPtr->release( msg );
+            } else {
+                aux::release_message( src, msg, 0 );
+            }
+        }
+    } while( forkFilled || a.next_message() );
     return a.pop_result();
 }
 
 
 
+template< typename MessageT>
+template< template <typename...> class ChainT
+        , typename LoopResultT
+        , typename SourceT
+        , typename ... ChainTArgs
+        > LoopResultT
+HandlerTraits< MessageT
+             , PipeRC
+             , iPipeHandler>::pull_one( GenericArbiter< LoopResultT > & a
+                                      , ChainT< AbstractHandlerRef, ChainTArgs... > & chain
+                                      , SourceT && src
+                                      , MessageT & targetMessage ) {
+    aux::MessageLease<MessageT> lease;
+    LoopResultT rc = lease_one( a, chain, src, lease );
+    if( lease ) {
+        // output assignment (moves the content of disposable messages)
+        lease.extract( targetMessage );
+    }
+    return rc;
+}
+
 template<typename MessageT> using Pipe = Pipeline< iPipeHandler
                                                  , MessageT
                                                  , PipeRC >
                                                  ;
 
+# ifndef PIPET_DISABLE_STATS
+/// Returns instrumentation snapshots of the pipeline handlers, in the chain
+/// order.
+template< typename MessageT
+        , template<typename T> class TChainT > std::vector<stats::Snapshot>
+stats_snapshot( const Pipeline<iPipeHandler, MessageT, PipeRC, TChainT> & p ) {
+    std::vector<stats::Snapshot> r;
+    for( const auto & hRef : p ) {
+        r.push_back( hRef->stats().snapshot() );
+    }
+    return r;
+}
+# endif
+
 }  // namespace pipet
 
 # if 0
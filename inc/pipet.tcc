@@ -25,6 +25,21 @@
 # define H_PIPE_T_H
 
 # include "pipeline.tcc"
+# include "message_pool.tcc"
+# include "hot_pipeline.tcc"
+# include "commutative_run.tcc"
+# include "key_router.tcc"
+# include "window_aggregator.tcc"
+# include "id_filter.tcc"
+# include "capture.tcc"
+# include "micro_batcher.tcc"
+# include "elastic_fork.tcc"
+# include "priority_source.tcc"
+# include "merge_source.tcc"
+# include "deduplicator.tcc"
+# ifdef __linux__
+# include "shm_ring.tcc"
+# endif
 
 # include <queue>
 
@@ -58,39 +73,37 @@ public:
 };  // class EvaluationProxy
 
 /// Proxying class representing temporary object collecting single events given
-/// to pipeline with left bitwise shift operator.
+/// to pipeline with left bitwise shift operator. Messages are kept in pooled
+/// slots: lvalues are copied, rvalues are moved in. Since the proxy owns the
+/// messages, extraction moves them out instead of copying.
 template< typename PipelineT
         , typename ArbiterT=GenericArbiter<int> >
-class ThinEvaluationProxy : public std::queue<const typename PipelineT::Message *>
-                          , public interfaces::Source<typename PipelineT::Message> {
+class ThinEvaluationProxy : public interfaces::Source<typename PipelineT::Message> {
 public:
     typedef PipelineT Pipeline;
     typedef ArbiterT Arbiter;
     typedef ThinEvaluationProxy<Pipeline, Arbiter> Self;
     typedef typename Pipeline::Message Message;
-    typedef std::queue<const typename PipelineT::Message *> Parent;
 private:
     Pipeline & _p;
-    Message * _reentrantMessagePtr;
+    aux::PooledQueue<Message> _queue;
     Arbiter _arbiter;
 public:
-    ThinEvaluationProxy( Pipeline & ppl ) : _p(ppl), _reentrantMessagePtr(nullptr) {}
+    ThinEvaluationProxy( Pipeline & ppl ) : _p(ppl) {}
+    ThinEvaluationProxy( ThinEvaluationProxy && ) = default;
+
+    /// Enqueues copy of the message.
+    void push( const Message & msg ) { _queue.hold( msg ); }
+    /// Moves message into the queue.
+    void push( Message && msg ) { _queue.hold( std::move(msg) ); }
+
     virtual Message * get() override {
-        if( Parent::empty() ) {
-            return nullptr;
-        }
-        if( !_reentrantMessagePtr ) {
-            aux::MessageTraits<Message>::delete_copy( _reentrantMessagePtr );
-        }
-        _reentrantMessagePtr = aux::MessageTraits<Message>::copy( *Parent::front() );
-        Parent::pop();
-        return _reentrantMessagePtr;
+        return _queue.pop();
     }
-    ~ThinEvaluationProxy() {
-        if( !_reentrantMessagePtr ) {
-            aux::MessageTraits<Message>::delete_copy( _reentrantMessagePtr );
-        }
+    virtual void release( Message * msg ) override {
+        _queue.release( msg );
     }
+    virtual bool messages_disposable() const override { return true; }
 
     Arbiter & arbiter() { return _arbiter; }
     Pipeline & pipeline() { return _p; }
@@ -102,8 +115,17 @@ template< typename PipelineT
 helpers::ThinEvaluationProxy<PipelineT, ArbiterT>
 operator<<( helpers::ThinEvaluationProxy<PipelineT, ArbiterT> && ep
           , const typename PipelineT::Message & msg) {
-    ep.push( &msg );
-    return ep;
+    ep.push( msg );
+    return std::move(ep);
+}
+
+template< typename PipelineT
+        , typename ArbiterT >
+helpers::ThinEvaluationProxy<PipelineT, ArbiterT>
+operator<<( helpers::ThinEvaluationProxy<PipelineT, ArbiterT> && ep
+          , typename PipelineT::Message && msg) {
+    ep.push( std::move(msg) );
+    return std::move(ep);
 }
 
 template< typename PipelineT
@@ -116,6 +138,20 @@ operator>>( helpers::ThinEvaluationProxy<PipelineT, ArbiterT> && ep
                                                , ep
                                                , msgRef );
     // TODO: check that pull was good
+    return std::move(ep);
+}
+
+/// View mode of extraction: provides lease on the message owned by proxy
+/// instead of copying it. Note, that the lease must not outlive the proxy.
+template< typename PipelineT
+        , typename ArbiterT >
+helpers::ThinEvaluationProxy<PipelineT, ArbiterT> &
+operator>>( helpers::ThinEvaluationProxy<PipelineT, ArbiterT> & ep
+          , aux::MessageLease<typename PipelineT::Message> & lease ) {
+    PipelineT::TheHandlerTraits::lease_one( ep.arbiter()
+                                          , ep.pipeline().upcast()
+                                          , ep
+                                          , lease );
     return ep;
 }
 
@@ -144,7 +180,23 @@ operator>>( helpers::EvaluationProxy< PipelineT
                                              , ep.pipeline().upcast()
                                              , ep.source()
                                              , msgRef );
-    return ep;
+    return std::move(ep);
+}
+
+/// View mode of extraction from the source: provides lease on the message
+/// instance owned by source (or junction).
+template< typename PipelineT
+        , typename SourceT >
+helpers::EvaluationProxy< PipelineT
+               , SourceT >
+operator>>( helpers::EvaluationProxy< PipelineT
+                           , SourceT > && ep
+          , aux::MessageLease<typename PipelineT::Message> & lease ) {
+    PipelineT::TheHandlerTraits::lease_one( ep.arbiter()
+                                          , ep.pipeline().upcast()
+                                          , ep.source()
+                                          , lease );
+    return std::move(ep);
 }
 
 }  // namespace pipet
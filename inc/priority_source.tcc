@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_PRIORITY_SOURCE_H
+# define H_PIPE_T_PRIORITY_SOURCE_H
+
+# include "basic_pipeline.tcc"
+# include "message_pool.tcc"
+# include "stats.tcc"
+
+# include <chrono>
+# include <memory>
+# include <thread>
+# include <unordered_map>
+# include <vector>
+
+namespace pipet {
+
+/**@brief Composite source scheduling messages of several inputs.
+ * @class PrioritySource
+ *
+ * Lets single pipeline instance (and its handlers state) to serve several
+ * streams of different importance. Inputs are added with `add()' with a
+ * weight, which is interpreted according to the scheduling discipline:
+ *  - `WeightedRoundRobin': each input gets the share of messages
+ *    proportional to its weight, interleaved smoothly (an input of weight 3
+ *    next to one of weight 1 gets 3 of each 4 messages, but never 3 in a row
+ *    at the very beginning of the round);
+ *  - `StrictPriority': the message is taken from the input of highest
+ *    weight having the data. To protect lower priority inputs from
+ *    starvation, the input that had the data but was passed over
+ *    `starvationLimit' times in a row gets the next message (0 disables
+ *    the protection).
+ *
+ * Inputs that are not `ready()' (would block on `get()') are skipped; if
+ * none of the inputs is ready, the source sleeps for `idle_wait()' and
+ * polls them again. The input returning nullptr is considered depleted, and
+ * the composite source returns nullptr once all of them are.
+ *
+ * Released messages are given back to the input that has emitted them. The
+ * last emitted message is usually released by the processing loop right
+ * after propagation; if it is not (e.g. leased by handler), its input is
+ * remembered till the message is released. Messages of unknown origin are
+ * given back to the pool shared by inputs, if given to the constructor and
+ * owning the message, and are ignored otherwise.
+ *
+ * Per-input accounting includes the number of messages taken, number of
+ * times the input was scheduled due to starvation, and the histogram of the
+ * time passed from the moment message was stamped till it was scheduled
+ * (for `stats::Stamped' messages).
+ * */
+template<typename MessageT>
+class PrioritySource : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+    typedef aux::MessagePool<Message> Pool;
+    /// Scheduling discipline.
+    enum Scheduling { WeightedRoundRobin, StrictPriority };
+    /// Accounting of single input.
+    struct InputStats {
+        size_t nEmitted  ///< messages taken from input
+             , nForced  ///< of them, taken due to starvation protection
+             , nNotReady  ///< times the input was skipped having no data
+             ;
+        bool depleted;  ///< whether input has returned nullptr
+    };
+private:
+    struct Input {
+        interfaces::Source<Message> * src;
+        unsigned weight;
+        /// Smooth WRR current weight.
+        long current;
+        /// Times passed over while being ready (strict priority).
+        size_t nPassed;
+        InputStats stats;
+        stats::LatencyHistogram latency;
+        Input( interfaces::Source<Message> & s, unsigned w )
+                : src(&s), weight(w), current(0), nPassed(0)
+                , stats{0, 0, 0, false} {}
+    };
+    static constexpr size_t npos = size_t(-1);
+
+    const Scheduling _scheduling;
+    const size_t _starvationLimit;
+    std::chrono::nanoseconds _idleWait;
+    std::vector<std::unique_ptr<Input> > _inputs;
+    /// The last emitted message and its input.
+    Message * _last;
+    size_t _lastInput;
+    /// Inputs of emitted messages not released before the next one.
+    std::unordered_map<Message *, size_t> _outstanding;
+    /// Pool shared by the inputs (may be null).
+    Pool * _pool;
+
+    /// Smooth weighted round robin among ready inputs.
+    size_t _pick_wrr( const std::vector<size_t> & ready ) {
+        long total = 0;
+        size_t best = npos;
+        for( size_t i : ready ) {
+            Input & in = *_inputs[i];
+            in.current += in.weight;
+            total += in.weight;
+            if( npos == best || in.current > _inputs[best]->current ) best = i;
+        }
+        _inputs[best]->current -= total;
+        return best;
+    }
+
+    /// Highest weight ready input, unless some other one is starving.
+    size_t _pick_strict( const std::vector<size_t> & ready, bool & forced ) {
+        size_t best = npos
+             , starving = npos
+             ;
+        for( size_t i : ready ) {
+            Input & in = *_inputs[i];
+            if( npos == best || in.weight > _inputs[best]->weight ) best = i;
+            if( _starvationLimit && in.nPassed >= _starvationLimit
+             && ( npos == starving || in.nPassed > _inputs[starving]->nPassed ) ) {
+                starving = i;
+            }
+        }
+        forced = npos != starving && starving != best;
+        if( forced ) best = starving;
+        for( size_t i : ready ) {
+            if( i == best ) _inputs[i]->nPassed = 0;
+            else ++_inputs[i]->nPassed;
+        }
+        return best;
+    }
+public:
+    PrioritySource( Scheduling s=WeightedRoundRobin
+                  , size_t starvationLimit=0
+                  , Pool * pool=nullptr )
+            : _scheduling(s)
+            , _starvationLimit(starvationLimit)
+            , _idleWait( std::chrono::microseconds(50) )
+            , _last(nullptr)
+            , _lastInput(npos)
+            , _pool(pool) {}
+    PrioritySource( const PrioritySource & ) = delete;
+
+    /// Adds input with given weight (share for round-robin, or priority
+    /// for strict scheduling). Returns the index of input.
+    size_t add( interfaces::Source<Message> & src, unsigned weight=1 ) {
+        if( !weight && WeightedRoundRobin == _scheduling ) {
+            pipet_error( Malfunction, "Zero weight of round-robin input." );
+        }
+        _inputs.emplace_back( new Input( src, weight ) );
+        return _inputs.size() - 1;
+    }
+
+    /// Sets the time to sleep when none of inputs has data.
+    void set_idle_wait( std::chrono::nanoseconds w ) { _idleWait = w; }
+    std::chrono::nanoseconds idle_wait() const { return _idleWait; }
+
+    size_t n_inputs() const { return _inputs.size(); }
+    const InputStats & input_stats( size_t n ) const { return _inputs[n]->stats; }
+    /// Histogram of time passed since message was stamped till it was
+    /// taken from the input.
+    stats::LatencyHistogram & latency( size_t n ) { return _inputs[n]->latency; }
+    Scheduling scheduling() const { return _scheduling; }
+
+    virtual Message * get() override {
+        std::vector<size_t> ready;
+        ready.reserve( _inputs.size() );
+        for(;;) {
+            ready.clear();
+            bool anyAlive = false;
+            for( size_t i = 0; i < _inputs.size(); ++i ) {
+                Input & in = *_inputs[i];
+                if( in.stats.depleted ) continue;
+                anyAlive = true;
+                if( in.src->ready() ) {
+                    ready.push_back( i );
+                } else {
+                    ++in.stats.nNotReady;
+                }
+            }
+            if( !anyAlive ) return nullptr;
+            if( ready.empty() ) {
+                if( _idleWait.count() ) std::this_thread::sleep_for( _idleWait );
+                else std::this_thread::yield();
+                continue;
+            }
+            bool forced = false;
+            size_t n = StrictPriority == _scheduling
+                     ? _pick_strict( ready, forced )
+                     : _pick_wrr( ready )
+                     ;
+            Input & in = *_inputs[n];
+            Message * m = in.src->get();
+            if( !m ) {
+                in.stats.depleted = true;
+                continue;
+            }
+            ++in.stats.nEmitted;
+            if( forced ) ++in.stats.nForced;
+            stats::record_latency( *m, in.latency );
+            if( _last && _last != m ) _outstanding[_last] = _lastInput;
+            if( !_outstanding.empty() ) _outstanding.erase( m );
+            _last = m;
+            _lastInput = n;
+            return m;
+        }
+    }
+
+    virtual void release( Message * m ) override {
+        if( m == _last ) {
+            _last = nullptr;
+            _inputs[_lastInput]->src->release( m );
+            return;
+        }
+        auto it = _outstanding.find( m );
+        if( _outstanding.end() != it ) {
+            const size_t n = it->second;
+            _outstanding.erase( it );
+            _inputs[n]->src->release( m );
+            return;
+        }
+        if( _pool && _pool->owns( m ) ) _pool->release( m );
+    }
+
+    /// Messages are disposable if they are for each of the inputs.
+    virtual bool messages_disposable() const override {
+        for( const auto & in : _inputs ) {
+            if( !in->src->messages_disposable() ) return false;
+        }
+        return true;
+    }
+
+    /// Ready if any of inputs has data, or all of them are depleted.
+    virtual bool ready() const override {
+        bool anyAlive = false;
+        for( const auto & in : _inputs ) {
+            if( in->stats.depleted ) continue;
+            if( in->src->ready() ) return true;
+            anyAlive = true;
+        }
+        return !anyAlive;
+    }
+};  // class PrioritySource
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_PRIORITY_SOURCE_H
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_SHM_RING_H
+# define H_PIPE_T_SHM_RING_H
+
+/**@file shm_ring.tcc
+ * @brief Shared memory transport between processes (Linux only).
+ *
+ * Provides the message source and the sink handler exchanging the messages
+ * through lock-free single-producer/single-consumer ring of variable-length
+ * records placed in POSIX shared memory (named one or anonymous `memfd').
+ * Blocked reader and writer sleep on process-shared futexes.
+ * */
+
+# include "pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <atomic>
+# include <cerrno>
+# include <cstring>
+# include <new>
+# include <type_traits>
+
+# include <fcntl.h>
+# include <linux/futex.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+
+namespace pipet {
+namespace aux {
+
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2
+             , "Shared memory ring requires address-free atomics." );
+
+/**@brief Lock-free SPSC ring buffer of variable-length records in shared
+ *        memory.
+ * @class ShmRing
+ *
+ * Each record is prefixed with 8-byte header and aligned to 8 bytes; record
+ * that does not fit into the rest of buffer is preceded by the padding
+ * record. Single writer and single reader (possibly in different processes)
+ * are supported.
+ * */
+class ShmRing {
+public:
+    static constexpr uint64_t magic = 0x70697065544d5352ULL;
+private:
+    struct Header {
+        uint64_t magic
+               , capacity
+               ;
+        alignas(64) std::atomic<uint64_t> head;  ///< written by producer
+        alignas(64) std::atomic<uint64_t> tail;  ///< written by consumer
+        alignas(64) std::atomic<uint32_t> dataSeq  ///< futex: data available
+                                        , nReadersWaiting
+                                        , closed
+                                        ;
+        alignas(64) std::atomic<uint32_t> spaceSeq  ///< futex: space available
+                                        , nWritersWaiting
+                                        ;
+    };
+    struct RecordHeader {
+        uint32_t length;
+        uint32_t isPadding;
+    };
+
+    int _fd;
+    Header * _h;
+    char * _data;
+    uint64_t _mask;
+    /// Pending (reserved or peeked) record size.
+    uint64_t _pending;
+
+    static void _futex_wait( std::atomic<uint32_t> & w, uint32_t v ) {
+        syscall( SYS_futex, reinterpret_cast<uint32_t *>(&w), FUTEX_WAIT, v
+               , nullptr, nullptr, 0 );
+    }
+    static void _futex_wake( std::atomic<uint32_t> & w ) {
+        syscall( SYS_futex, reinterpret_cast<uint32_t *>(&w), FUTEX_WAKE, 1
+               , nullptr, nullptr, 0 );
+    }
+    static size_t _mapping_size( uint64_t capacity ) {
+        return sizeof(Header) + capacity;
+    }
+    static uint64_t _record_size( size_t len ) {
+        return sizeof(RecordHeader) + ((len + 7) & ~uint64_t(7));
+    }
+
+    /// Closes the descriptor on construction failure, preserving errno
+    /// for the error message.
+    void _close_fd() {
+        const int e = errno;
+        ::close( _fd );
+        _fd = -1;
+        errno = e;
+    }
+
+    void _map( bool init, uint64_t capacity ) {
+        if( !init ) {
+            struct stat st;
+            if( fstat( _fd, &st ) ) {
+                _close_fd();
+                pipet_error( SystemError, "Unable to stat shared memory "
+                        "object: %s.", strerror(errno) );
+            }
+            if( size_t(st.st_size) < sizeof(Header) ) {
+                _close_fd();
+                pipet_error( Malfunction, "Shared memory object is too "
+                        "small to be a ring buffer." );
+            }
+            capacity = st.st_size - sizeof(Header);
+        } else if( ftruncate( _fd, _mapping_size(capacity) ) ) {
+            _close_fd();
+            pipet_error( SystemError, "Unable to allocate %zu bytes of "
+                    "shared memory: %s.", _mapping_size(capacity)
+                    , strerror(errno) );
+        }
+        void * p = mmap( nullptr, _mapping_size(capacity)
+                       , PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0 );
+        if( MAP_FAILED == p ) {
+            _close_fd();
+            pipet_error( SystemError, "Unable to map shared memory: %s."
+                       , strerror(errno) );
+        }
+        _h = static_cast<Header *>(p);
+        if( init ) {
+            new (_h) Header();
+            _h->capacity = capacity;
+            _h->head.store( 0 );
+            _h->tail.store( 0 );
+            _h->dataSeq.store( 0 );
+            _h->nReadersWaiting.store( 0 );
+            _h->closed.store( 0 );
+            _h->spaceSeq.store( 0 );
+            _h->nWritersWaiting.store( 0 );
+            _h->magic = magic;
+        } else if( magic != _h->magic || capacity != _h->capacity ) {
+            munmap( p, _mapping_size(capacity) );
+            _h = nullptr;
+            _close_fd();
+            pipet_error( Malfunction, "Shared memory object is not a ring "
+                    "buffer or is not initialized." );
+        }
+        _data = reinterpret_cast<char *>(_h) + sizeof(Header);
+        _mask = capacity - 1;
+    }
+
+    ShmRing( int fd, bool init, uint64_t capacity ) : _fd(fd), _h(nullptr)
+                                                    , _data(nullptr), _mask(0)
+                                                    , _pending(0) {
+        if( init && (capacity < 64 || (capacity & (capacity - 1))) ) {
+            _close_fd();
+            pipet_error( Malfunction, "Ring capacity %zu is not a power of "
+                    "two (or is too small).", (size_t) capacity );
+        }
+        _map( init, capacity );
+    }
+public:
+    /// Creates (or re-initializes) named shared memory ring.
+    static ShmRing create( const char * name, uint64_t capacity ) {
+        int fd = shm_open( name, O_CREAT | O_RDWR, 0600 );
+        if( fd < 0 ) {
+            pipet_error( SystemError, "Unable to create shared memory "
+                    "object \"%s\": %s.", name, strerror(errno) );
+        }
+        return ShmRing( fd, true, capacity );
+    }
+    /// Maps existing named ring.
+    static ShmRing open( const char * name ) {
+        int fd = shm_open( name, O_RDWR, 0600 );
+        if( fd < 0 ) {
+            pipet_error( SystemError, "Unable to open shared memory "
+                    "object \"%s\": %s.", name, strerror(errno) );
+        }
+        return ShmRing( fd, false, 0 );
+    }
+    /// Creates anonymous ring. It is inherited upon fork(), or may be passed
+    /// to another process by file descriptor (see `fd()').
+    static ShmRing anonymous( uint64_t capacity ) {
+        int fd = memfd_create( "pipet-ring", 0 );
+        if( fd < 0 ) {
+            pipet_error( SystemError, "Unable to create memfd: %s."
+                       , strerror(errno) );
+        }
+        return ShmRing( fd, true, capacity );
+    }
+    /// Maps the ring given by file descriptor (takes the ownership).
+    static ShmRing from_fd( int fd ) { return ShmRing( fd, false, 0 ); }
+    /// Removes the name of shared memory object.
+    static void unlink( const char * name ) { shm_unlink( name ); }
+
+    ShmRing( const ShmRing & ) = delete;
+    ShmRing( ShmRing && o ) : _fd(o._fd), _h(o._h), _data(o._data)
+                            , _mask(o._mask), _pending(o._pending) {
+        o._fd = -1;
+        o._h = nullptr;
+    }
+    ~ShmRing() {
+        if( _h ) munmap( _h, _mapping_size(_mask + 1) );
+        if( _fd >= 0 ) ::close( _fd );
+    }
+
+    int fd() const { return _fd; }
+    uint64_t capacity() const { return _mask + 1; }
+    /// Maximum length of single record.
+    size_t max_record_length() const {
+        return capacity()/2 - sizeof(RecordHeader);
+    }
+
+    /// Returns pointer to the buffer of given length to be written, blocking
+    /// until there is enough space. Record becomes available to reader upon
+    /// `commit()'.
+    void * reserve( size_t len ) {
+        if( len > max_record_length() ) {
+            pipet_error( Malfunction, "Record of %zu bytes exceeds maximum "
+                    "length %zu of ring.", len, max_record_length() );
+        }
+        const uint64_t head = _h->head.load( std::memory_order_relaxed )
+                     , idx = head & _mask
+                     , contiguous = capacity() - idx
+                     , recSize = _record_size(len)
+                     ;
+        // Record that does not fit into the rest of the buffer is preceded
+        // by padding.
+        _pending = contiguous < recSize ? contiguous + recSize : recSize;
+        while( capacity() - (head - _h->tail.load( std::memory_order_seq_cst )) < _pending ) {
+            uint32_t seq = _h->spaceSeq.load( std::memory_order_seq_cst );
+            _h->nWritersWaiting.fetch_add( 1, std::memory_order_seq_cst );
+            if( capacity() - (head - _h->tail.load( std::memory_order_seq_cst )) < _pending ) {
+                _futex_wait( _h->spaceSeq, seq );
+            }
+            _h->nWritersWaiting.fetch_sub( 1, std::memory_order_seq_cst );
+        }
+        char * rec = _data + idx;
+        if( contiguous < recSize ) {
+            reinterpret_cast<RecordHeader *>(rec)->isPadding = 1;
+            rec = _data;
+        }
+        RecordHeader * rh = reinterpret_cast<RecordHeader *>(rec);
+        rh->length = len;
+        rh->isPadding = 0;
+        return rec + sizeof(RecordHeader);
+    }
+
+    /// Publishes the reserved record.
+    void commit() {
+        _h->head.store( _h->head.load( std::memory_order_relaxed ) + _pending
+                      , std::memory_order_seq_cst );
+        _pending = 0;
+        _h->dataSeq.fetch_add( 1, std::memory_order_seq_cst );
+        if( _h->nReadersWaiting.load( std::memory_order_seq_cst ) ) {
+            _futex_wake( _h->dataSeq );
+        }
+    }
+
+    /// Copies the record into ring.
+    void write( const void * src, size_t len ) {
+        memcpy( reserve( len ), src, len );
+        commit();
+    }
+
+    /// Marks the end of stream: reader will get nullptr once the ring is
+    /// depleted.
+    void close_stream() {
+        _h->closed.store( 1, std::memory_order_seq_cst );
+        _h->dataSeq.fetch_add( 1, std::memory_order_seq_cst );
+        _futex_wake( _h->dataSeq );
+    }
+
+    /// Returns pointer to the next record, blocking until it is available.
+    /// Returns nullptr if the stream is closed and depleted.
+    const void * peek( size_t & len ) {
+        uint64_t tail = _h->tail.load( std::memory_order_relaxed );
+        while( _h->head.load( std::memory_order_seq_cst ) == tail ) {
+            if( _h->closed.load( std::memory_order_seq_cst ) ) {
+                if( _h->head.load( std::memory_order_seq_cst ) == tail ) return nullptr;
+                break;
+            }
+            uint32_t seq = _h->dataSeq.load( std::memory_order_seq_cst );
+            _h->nReadersWaiting.fetch_add( 1, std::memory_order_seq_cst );
+            if( _h->head.load( std::memory_order_seq_cst ) == tail
+             && !_h->closed.load( std::memory_order_seq_cst ) ) {
+                _futex_wait( _h->dataSeq, seq );
+            }
+            _h->nReadersWaiting.fetch_sub( 1, std::memory_order_seq_cst );
+        }
+        uint64_t idx = tail & _mask;
+        const RecordHeader * rh = reinterpret_cast<const RecordHeader *>(_data + idx);
+        _pending = 0;
+        if( rh->isPadding ) {
+            _pending = capacity() - idx;
+            rh = reinterpret_cast<const RecordHeader *>(_data);
+        }
+        len = rh->length;
+        _pending += _record_size( len );
+        return rh + 1;
+    }
+
+    /// Returns true if `peek()' will not block.
+    bool readable() const {
+        return _h->head.load( std::memory_order_seq_cst )
+                    != _h->tail.load( std::memory_order_relaxed )
+            || _h->closed.load( std::memory_order_seq_cst );
+    }
+
+    /// Frees the record obtained with `peek()'.
+    void consume() {
+        _h->tail.store( _h->tail.load( std::memory_order_relaxed ) + _pending
+                      , std::memory_order_seq_cst );
+        _pending = 0;
+        _h->spaceSeq.fetch_add( 1, std::memory_order_seq_cst );
+        if( _h->nWritersWaiting.load( std::memory_order_seq_cst ) ) {
+            _futex_wake( _h->spaceSeq );
+        }
+    }
+};  // class ShmRing
+
+}  // namespace aux
+
+/**@brief Source reading messages from shared memory ring.
+ * @class ShmSource
+ *
+ * Messages are de-serialized by `aux::RecordTraits' into the slots of own
+ * pool, so they may be kept by forks.
+ * */
+template<typename MessageT>
+class ShmSource : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+private:
+    aux::ShmRing & _ring;
+    aux::MessagePool<Message> _pool;
+public:
+    ShmSource( aux::ShmRing & ring ) : _ring(ring) {}
+
+    /// Blocks until message is available; returns nullptr once the writer
+    /// has closed the stream.
+    virtual Message * get() override {
+        size_t len;
+        const void * rec = _ring.peek( len );
+        if( !rec ) return nullptr;
+        Message * m = _pool.acquire();
+        aux::RecordTraits<Message>::unpack( rec, len, *m );
+        _ring.consume();
+        return m;
+    }
+    virtual void release( Message * m ) override { _pool.release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+    virtual bool ready() const override { return _ring.readable(); }
+};  // class ShmSource
+
+/**@brief Handler writing messages into shared memory ring.
+ * @class ShmSink
+ *
+ * Messages are serialized by `aux::RecordTraits' and propagated further.
+ * Blocks while the ring is full.
+ * */
+template<typename MessageT>
+class ShmSink {
+public:
+    typedef MessageT Message;
+private:
+    aux::ShmRing & _ring;
+public:
+    ShmSink( aux::ShmRing & ring ) : _ring(ring) {}
+    bool operator()( Message & m ) {
+        size_t len = aux::RecordTraits<Message>::size( m );
+        aux::RecordTraits<Message>::pack( m, _ring.reserve( len ) );
+        _ring.commit();
+        return true;
+    }
+    /// Marks the end of stream for reader.
+    void close() { _ring.close_stream(); }
+};  // class ShmSink
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_SHM_RING_H
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_STATS_H
+# define H_PIPE_T_STATS_H
+
+/**@file stats.tcc
+ * @brief Lightweight per-handler instrumentation.
+ *
+ * Counters and latency histograms are accumulated in per-thread, cache-line
+ * aligned blocks, so instrumented handlers invoked from different threads do
+ * not contend. Snapshot merges the blocks with relaxed loads, with no need
+ * to stop the evaluation.
+ *
+ * Instrumentation is disabled at runtime by default (see `enable()') and may
+ * be entirely excluded at compile time by defining `PIPET_DISABLE_STATS'. In
+ * the latter case handlers do not carry the counters at all, and their
+ * `stats()' accessors and `stats_snapshot()' functions are not defined.
+ *
+ * This header does not depend on the rest of the library and is shared with
+ * the `ppt' pipelines.
+ * */
+
+# include <atomic>
+# include <chrono>
+# include <cstdint>
+# include <cstddef>
+# include <type_traits>
+
+namespace pipet {
+namespace stats {
+
+/// Number of log2 latency buckets. Bucket #n counts durations within
+/// [2^(n-1), 2^n) nanoseconds, the last one accumulates the overflow.
+constexpr size_t nLatencyBuckets = 48;
+/// Number of per-thread blocks. Threads are assigned to blocks in
+/// round-robin manner, so more threads may share the block.
+constexpr size_t nThreadSlots = 64;
+
+/// Returns the per-thread block index of calling thread. Threads are
+/// assigned to blocks in round-robin manner.
+inline size_t thread_slot() {
+    static std::atomic<size_t> nThreads(0);
+    static thread_local size_t slot = nThreads.fetch_add(1) % nThreadSlots;
+    return slot;
+}
+
+inline std::atomic<bool> & _enabled_flag() {
+    static std::atomic<bool> f(false);
+    return f;
+}
+
+/// Returns true if runtime instrumentation is enabled.
+inline bool enabled() {
+    return _enabled_flag().load( std::memory_order_relaxed );
+}
+
+/// Switches runtime instrumentation on/off.
+inline void enable( bool v=true ) {
+    _enabled_flag().store( v, std::memory_order_relaxed );
+}
+
+/// Returns log2 bucket number for duration given in nanoseconds.
+inline size_t latency_bucket( uint64_t ns ) {
+    size_t n = 0;
+    while( ns && n < nLatencyBuckets - 1 ) {
+        ns >>= 1;
+        ++n;
+    }
+    return n;
+}
+
+/// Measures time elapsed since construction.
+class Timer {
+private:
+    std::chrono::steady_clock::time_point _start;
+public:
+    Timer() : _start( std::chrono::steady_clock::now() ) {}
+    uint64_t elapsed() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start ).count();
+    }
+};
+
+/// Merged statistics of single handler.
+struct Snapshot {
+    uint64_t nCalls     ///< number of invocations
+           , nPassed    ///< messages propagated further
+           , nRejected  ///< messages discarded
+           , nModified  ///< messages modified
+           ;
+    uint64_t latency[nLatencyBuckets];
+
+    Snapshot() : nCalls(0), nPassed(0), nRejected(0), nModified(0) {
+        for( size_t i = 0; i < nLatencyBuckets; ++i ) latency[i] = 0;
+    }
+
+    Snapshot & operator+=( const Snapshot & o ) {
+        nCalls += o.nCalls;
+        nPassed += o.nPassed;
+        nRejected += o.nRejected;
+        nModified += o.nModified;
+        for( size_t i = 0; i < nLatencyBuckets; ++i ) latency[i] += o.latency[i];
+        return *this;
+    }
+
+    /// Returns upper bound of the bucket containing q-quantile of latency
+    /// (nanoseconds), for q in [0, 1].
+    uint64_t latency_percentile( double q ) const {
+        uint64_t n = 0;
+        for( size_t i = 0; i < nLatencyBuckets; ++i ) n += latency[i];
+        if( !n ) return 0;
+        uint64_t target = q*n, acc = 0;
+        for( size_t i = 0; i < nLatencyBuckets; ++i ) {
+            acc += latency[i];
+            if( acc > target ) return uint64_t(1) << i;
+        }
+        return uint64_t(1) << (nLatencyBuckets - 1);
+    }
+};
+
+/**@brief Instrumentation counters of single handler.
+ * @class HandlerStats
+ *
+ * Per-thread blocks are allocated on first use by the thread.
+ * */
+class HandlerStats {
+private:
+    /// Padded to avoid sharing cache lines with adjacent allocations (over-
+    /// aligned new is not available prior to C++17).
+    struct Block {
+        char _padBefore[64];
+        std::atomic<uint64_t> nCalls
+                            , nPassed
+                            , nRejected
+                            , nModified
+                            ;
+        std::atomic<uint64_t> latency[nLatencyBuckets];
+        char _padAfter[64];
+        Block() : nCalls(0), nPassed(0), nRejected(0), nModified(0) {
+            for( size_t i = 0; i < nLatencyBuckets; ++i ) latency[i].store(0);
+        }
+    };
+    std::atomic<Block *> _blocks[nThreadSlots];
+
+    Block & _block() {
+        std::atomic<Block *> & ref = _blocks[thread_slot()];
+        Block * b = ref.load( std::memory_order_acquire );
+        if( !b ) {
+            Block * nb = new Block();
+            if( ref.compare_exchange_strong( b, nb, std::memory_order_acq_rel ) ) {
+                b = nb;
+            } else {
+                delete nb;
+            }
+        }
+        return *b;
+    }
+    static void _inc( std::atomic<uint64_t> & c ) {
+        c.fetch_add( 1, std::memory_order_relaxed );
+    }
+public:
+    HandlerStats() {
+        for( size_t i = 0; i < nThreadSlots; ++i ) _blocks[i].store( nullptr );
+    }
+    /// Statistics are not copied.
+    HandlerStats( const HandlerStats & ) : HandlerStats() {}
+    HandlerStats & operator=( const HandlerStats & ) = delete;
+    ~HandlerStats() {
+        for( size_t i = 0; i < nThreadSlots; ++i ) delete _blocks[i].load();
+    }
+
+    /// Accounts single invocation.
+    void account( bool passed, bool rejected, bool modified, uint64_t ns ) {
+        Block & b = _block();
+        _inc( b.nCalls );
+        if( passed ) _inc( b.nPassed );
+        if( rejected ) _inc( b.nRejected );
+        if( modified ) _inc( b.nModified );
+        _inc( b.latency[latency_bucket(ns)] );
+    }
+
+    /// Merges per-thread blocks.
+    Snapshot snapshot() const {
+        Snapshot s;
+        for( size_t i = 0; i < nThreadSlots; ++i ) {
+            const Block * b = _blocks[i].load( std::memory_order_acquire );
+            if( !b ) continue;
+            s.nCalls += b->nCalls.load( std::memory_order_relaxed );
+            s.nPassed += b->nPassed.load( std::memory_order_relaxed );
+            s.nRejected += b->nRejected.load( std::memory_order_relaxed );
+            s.nModified += b->nModified.load( std::memory_order_relaxed );
+            for( size_t j = 0; j < nLatencyBuckets; ++j ) {
+                s.latency[j] += b->latency[j].load( std::memory_order_relaxed );
+            }
+        }
+        return s;
+    }
+
+    /// Adds the counters of other instance (e.g. of the clone evaluated by
+    /// concurrent thread) to the ones of current thread, zeroing them in
+    /// other. Other instance must not be updated concurrently.
+    void merge( HandlerStats & o ) {
+        const Snapshot s = o.snapshot();
+        o.reset();
+        Block & b = _block();
+        b.nCalls.fetch_add( s.nCalls, std::memory_order_relaxed );
+        b.nPassed.fetch_add( s.nPassed, std::memory_order_relaxed );
+        b.nRejected.fetch_add( s.nRejected, std::memory_order_relaxed );
+        b.nModified.fetch_add( s.nModified, std::memory_order_relaxed );
+        for( size_t i = 0; i < nLatencyBuckets; ++i ) {
+            b.latency[i].fetch_add( s.latency[i], std::memory_order_relaxed );
+        }
+    }
+
+    /// Zeroes the counters (concurrent updates may be partially lost).
+    void reset() {
+        for( size_t i = 0; i < nThreadSlots; ++i ) {
+            Block * b = _blocks[i].load( std::memory_order_acquire );
+            if( !b ) continue;
+            b->nCalls.store(0);
+            b->nPassed.store(0);
+            b->nRejected.store(0);
+            b->nModified.store(0);
+            for( size_t j = 0; j < nLatencyBuckets; ++j ) b->latency[j].store(0);
+        }
+    }
+};  // class HandlerStats
+
+/// Returns steady clock time in nanoseconds.
+inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/**@brief Source-assigned message stamp.
+ * @class Stamped
+ *
+ * Messages types deriving from this base carry the sequence number and the
+ * ingest timestamp assigned by source, that remain valid when message is
+ * copied, re-used or moved across threads.
+ * */
+struct Stamped {
+    uint64_t seqID;       ///< sequence number, 0 if message was not stamped
+    uint64_t ingestTime;  ///< steady clock nanoseconds at ingest
+    Stamped() : seqID(0), ingestTime(0) {}
+};
+
+/// Issues monotonically increasing sequence numbers.
+class Sequencer {
+private:
+    std::atomic<uint64_t> _last;
+public:
+    Sequencer() : _last(0) {}
+    uint64_t next() { return _last.fetch_add( 1, std::memory_order_relaxed ) + 1; }
+    void stamp( Stamped & s ) {
+        s.seqID = next();
+        s.ingestTime = now();
+    }
+};
+
+/// Returns sequencer used by default.
+inline Sequencer & default_sequencer() {
+    static Sequencer s;
+    return s;
+}
+
+/// Stamps message with sequence number and current time. Does nothing for
+/// messages not derived from `Stamped'.
+template<typename MessageT> typename std::enable_if<
+    std::is_base_of<Stamped, MessageT>::value>::type
+stamp( MessageT & m, Sequencer & s=default_sequencer() ) {
+    s.stamp( m );
+}
+template<typename MessageT> typename std::enable_if<
+    !std::is_base_of<Stamped, MessageT>::value>::type
+stamp( MessageT &, Sequencer & =default_sequencer() ) {}
+
+/**@brief Concurrent log-linear histogram of latencies.
+ * @class LatencyHistogram
+ *
+ * Each power of two range is divided into 16 sub-buckets, providing
+ * percentiles estimation with relative error below 1/32 over the whole
+ * 64-bit nanoseconds range.
+ * */
+class LatencyHistogram {
+public:
+    static constexpr size_t nSubBits = 4
+                          , nSub = 1 << nSubBits
+                          , nBuckets = nSub*(64 - nSubBits + 1)
+                          ;
+private:
+    std::atomic<uint64_t> _counts[nBuckets];
+public:
+    static size_t bucket( uint64_t v ) {
+        if( v < nSub ) return v;
+        size_t e = 63;
+        while( !(v >> e) ) --e;
+        return nSub*(e - nSubBits + 1) + ((v >> (e - nSubBits)) & (nSub - 1));
+    }
+    /// Returns lower bound of the bucket.
+    static uint64_t bucket_low( size_t n ) {
+        if( n < nSub ) return n;
+        size_t e = n/nSub + nSubBits - 1;
+        return (uint64_t(1) << e) | (uint64_t(n % nSub) << (e - nSubBits));
+    }
+    /// Returns the bucket width.
+    static uint64_t bucket_width( size_t n ) {
+        return n < nSub ? 1 : uint64_t(1) << (n/nSub - 1);
+    }
+
+    LatencyHistogram() { reset(); }
+    LatencyHistogram( const LatencyHistogram & ) = delete;
+
+    void record( uint64_t ns ) {
+        _counts[bucket(ns)].fetch_add( 1, std::memory_order_relaxed );
+    }
+    uint64_t count() const {
+        uint64_t n = 0;
+        for( size_t i = 0; i < nBuckets; ++i ) {
+            n += _counts[i].load( std::memory_order_relaxed );
+        }
+        return n;
+    }
+    /// Returns estimation of q-quantile (q in [0, 1]) in nanoseconds.
+    uint64_t percentile( double q ) const {
+        uint64_t n = count();
+        if( !n ) return 0;
+        uint64_t target = q*(n - 1), acc = 0;
+        for( size_t i = 0; i < nBuckets; ++i ) {
+            acc += _counts[i].load( std::memory_order_relaxed );
+            if( acc > target ) return bucket_low(i) + bucket_width(i)/2;
+        }
+        return bucket_low(nBuckets - 1);
+    }
+    void reset() {
+        for( size_t i = 0; i < nBuckets; ++i ) _counts[i].store( 0 );
+    }
+};
+
+/// Records the time passed since the message was stamped. Returns false if
+/// message was not stamped.
+template<typename MessageT> typename std::enable_if<
+    std::is_base_of<Stamped, MessageT>::value, bool>::type
+record_latency( const MessageT & m, LatencyHistogram & h ) {
+    if( !m.seqID ) return false;
+    h.record( now() - m.ingestTime );
+    return true;
+}
+template<typename MessageT> typename std::enable_if<
+    !std::is_base_of<Stamped, MessageT>::value, bool>::type
+record_latency( const MessageT &, LatencyHistogram & ) { return false; }
+
+}  // namespace stats
+}  // namespace pipet
+
+# endif  // H_PIPE_T_STATS_H
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# ifndef H_PIPE_T_WINDOW_AGGREGATOR_H
+# define H_PIPE_T_WINDOW_AGGREGATOR_H
+
+# include "pipeline.tcc"
+# include "message_pool.tcc"
+
+# include <algorithm>
+# include <cstdint>
+# include <functional>
+
+namespace pipet {
+
+/**@brief Fork/junction handler aggregating messages within windows.
+ * @class WindowAggregator
+ *
+ * Collects messages into tumbling or sliding windows, either by count or by
+ * the timestamp taken from message, and emits an aggregate message for each
+ * closed window. Aggregate is maintained incrementally using the two-stacks
+ * technique, so sliding window costs amortized O(1) per message for any
+ * associative (not necessarily invertible or commutative) operation.
+ *
+ * The `AggregatorT' must define the `Value' type and the methods:
+ *  - `Value identity() const' --- neutral element;
+ *  - `Value lift( const Message & ) const' --- value of single message;
+ *  - `Value combine( const Value & older, const Value & newer ) const';
+ *  - `void lower( const Value &, Message & ) const' --- fills the emitted
+ *    message.
+ *
+ * Messages are absorbed by the handler (propagation stops). Once window is
+ * closed, the handler returns `Filled' and emits the aggregate as a
+ * junction. Messages are never kept, so each one returns to its source once
+ * considered. Timestamps have to be non-decreasing; the last incomplete
+ * window is not emitted.
+ * */
+template< typename MessageT
+        , typename AggregatorT >
+class WindowAggregator : public interfaces::Source<MessageT> {
+public:
+    typedef MessageT Message;
+    typedef AggregatorT Aggregator;
+    typedef typename Aggregator::Value Value;
+    typedef uint64_t Timestamp;
+    typedef std::function<Timestamp(const Message &)> TimestampGetter;
+    typedef aux::MessagePool<Message> Pool;
+private:
+    struct Entry {
+        Value v;
+        Timestamp t;
+        Value agg;  ///< aggregate of this and newer entries (front stack)
+    };
+    Aggregator _agg;
+    TimestampGetter _ts;
+    /// Window width and slide (in messages or timestamp units).
+    Timestamp _width
+            , _slide
+            ;
+    /// Front stack (oldest entry on top) and back stack.
+    std::vector<Entry> _front
+                     , _back
+                     ;
+    Value _backAgg;
+    uint64_t _nMsgs
+           , _nWindows
+           ;
+    bool _started;
+    Timestamp _windowEnd;
+    /// Aggregates to be emitted.
+    aux::PooledQueue<Message> _emitted;
+
+    void _push( const Value & v, Timestamp t ) {
+        _back.push_back( Entry{ v, t, v } );
+        _backAgg = _agg.combine( _backAgg, v );
+    }
+    /// Moves back stack content to the front one computing suffix
+    /// aggregates.
+    void _flip() {
+        for( auto it = _back.rbegin(); _back.rend() != it; ++it ) {
+            it->agg = _front.empty() ? it->v
+                                     : _agg.combine( it->v, _front.back().agg );
+            _front.push_back( *it );
+        }
+        _back.clear();
+        _backAgg = _agg.identity();
+    }
+    void _pop() {
+        if( _front.empty() ) _flip();
+        _front.pop_back();
+    }
+    size_t _size() const { return _front.size() + _back.size(); }
+    Timestamp _oldest() {
+        if( _front.empty() ) _flip();
+        return _front.back().t;
+    }
+    void _emit() {
+        Message * m = _emitted.pool().acquire();
+        _agg.lower( aggregate(), *m );
+        _emitted.hold( *m );
+        ++_nWindows;
+    }
+    bool _consider_count( const Message & msg ) {
+        _push( _agg.lift(msg), _nMsgs );
+        if( _size() > _width ) _pop();
+        if( ++_nMsgs >= _width && !((_nMsgs - _width) % _slide) ) {
+            _emit();
+            // Drop entries that will not get into the next window.
+            while( _size() + std::min(_slide, _width) > _width ) _pop();
+            return true;
+        }
+        return false;
+    }
+    bool _consider_time( const Message & msg ) {
+        const Timestamp t = _ts( msg );
+        bool emitted = false;
+        if( !_started ) {
+            _windowEnd = (t/_slide + 1)*_slide;
+            _started = true;
+        }
+        while( t >= _windowEnd ) {
+            while( _size() && _oldest() + _width < _windowEnd ) _pop();
+            if( !_size() ) {
+                // Skip the empty windows.
+                _windowEnd = (t/_slide + 1)*_slide;
+                break;
+            }
+            _emit();
+            emitted = true;
+            _windowEnd += _slide;
+        }
+        _push( _agg.lift(msg), t );
+        ++_nMsgs;
+        return emitted;
+    }
+public:
+    /// Creates aggregator for windows by messages count. Tumbling windows
+    /// correspond to `slide' equal to `width' (default).
+    WindowAggregator( size_t width
+                    , size_t slide=0
+                    , const Aggregator & agg=Aggregator() )
+            : _agg(agg), _width(width), _slide(slide ? slide : width)
+            , _backAgg(_agg.identity()), _nMsgs(0), _nWindows(0)
+            , _started(false), _windowEnd(0) {}
+    /// Creates aggregator for windows by message timestamp.
+    WindowAggregator( TimestampGetter ts
+                    , Timestamp width
+                    , Timestamp slide=0
+                    , const Aggregator & agg=Aggregator() )
+            : _agg(agg), _ts(ts), _width(width), _slide(slide ? slide : width)
+            , _backAgg(_agg.identity()), _nMsgs(0), _nWindows(0)
+            , _started(false), _windowEnd(0) {}
+
+    PipeRC operator()( Message & msg ) {
+        if( !( _ts ? _consider_time(msg) : _consider_count(msg) ) ) {
+            // Message is absorbed.
+            return PipeRC::f_NextMessage;
+        }
+        return PipeRC::Filled;
+    }
+
+    /// Returns aggregate of the messages currently in window.
+    Value aggregate() const {
+        return _front.empty() ? _backAgg
+                              : _agg.combine( _front.back().agg, _backAgg );
+    }
+
+    virtual Message * get() override {
+        return _emitted.pop();
+    }
+    virtual void release( Message * m ) override { _emitted.release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+
+    /// Drops window content.
+    void reset() {
+        _front.clear();
+        _back.clear();
+        _backAgg = _agg.identity();
+        _nMsgs = 0;
+        _started = false;
+    }
+
+    /// Number of messages in current window.
+    size_t size() const { return _size(); }
+    /// Number of windows emitted.
+    uint64_t n_windows() const { return _nWindows; }
+};  // class WindowAggregator
+
+}  // namespace pipet
+
+# endif  // H_PIPE_T_WINDOW_AGGREGATOR_H
@@ -1,10 +1,23 @@
 # include <vector>
 # include <list>
+# include <map>
 # include <cassert>
 # include <thread>
 # include <condition_variable>
 # include <iomanip>
 # include <string>
+# include <atomic>
+# include <memory>
+# include <cstring>
+# include <functional>
+# include <fstream>
+# include <stdexcept>
+# include <cerrno>
+
+# include <fcntl.h>
+# include <unistd.h>
+
+# include "inc/stats.tcc"
 
 # ifndef PPT_DISABLE_JOUNRALING
 #   include "rapidxml-1.13/rapidxml.hpp"
@@ -15,6 +28,9 @@
 
 namespace ppt {
 
+// Instrumentation primitives are shared with pipet library
+namespace stats = ::pipet::stats;
+
 // fwd
 # ifndef PPT_DISABLE_JOUNRALING
 namespace journaling { template<typename T> class Journal; }
@@ -71,7 +87,12 @@ struct Traits {
     typedef T && RRef;
 
     typedef unsigned long MessageID;
-    static MessageID message_id( CRef m ) { return (MessageID) (&m); }
+    /// Messages stamped by source are identified by the sequence number,
+    /// others --- by address.
+    static MessageID message_id( CRef m ) {
+        return _message_id( m, std::is_base_of<stats::Stamped, T>() ); }
+    static MessageID _message_id( CRef m, std::true_type ) { return m.seqID; }
+    static MessageID _message_id( CRef m, std::false_type ) { return (MessageID) (&m); }
 };
 
 // const T and non-const T traits are equivalent
@@ -144,13 +165,24 @@ enum EntryType {
 /// Journaling entry type parameterised by message ID.
 template<typename MsgIDT>
 struct Entry {
-    std::clock_t time;
+    /// Monotonic (steady clock) time stamp, in nanoseconds.
+    uint64_t time;
     void * issuer;
     EntryType type;
     MsgIDT msgID;
+    /// Hash of the ID of thread that has made the record.
+    unsigned long thread;
     // ...
 };
 
+/// Returns (cached) hash of current thread ID used to tag the entries.
+inline unsigned long
+current_thread_tag() {
+    static thread_local unsigned long tag
+            = std::hash<std::thread::id>()( std::this_thread::get_id() );
+    return tag;
+}
+
 /// A container for pipeline journal.
 template<typename T>
 class Journal : public std::vector< Entry<typename ppt::Traits<T>::MessageID> > {
@@ -160,16 +192,54 @@ private:
     /// Journal blocking mutex -- prevents from simulaneous access to entries
     /// container.
     std::mutex _mtx;
+    /// Sampling parameters: each n-th message or predicate.
+    size_t _sampleEvery;
+    std::atomic<size_t> _nMessages;
+    std::function<bool(typename ppt::Traits<T>::CRef)> _samplePredicate;
 public:
+    Journal() : _sampleEvery(1), _nMessages(0) {}
+
+    /// Makes journal to record only each n-th message entering the top-level
+    /// pipe (1 --- each message, 0 --- none). Drops the predicate set by
+    /// `sample_if()', if any.
+    void sample_every( size_t n ) {
+        _sampleEvery = n;
+        _nMessages = 0;
+        _samplePredicate = nullptr;
+    }
+    /// Makes journal to record only messages satisfying the predicate. Drops
+    /// the period set by `sample_every()'; null predicate restores recording
+    /// of each message.
+    void sample_if( std::function<bool(typename ppt::Traits<T>::CRef)> p ) {
+        _sampleEvery = 1;
+        _nMessages = 0;
+        _samplePredicate = p;
+    }
+    /// Returns true if evaluation on given message has to be recorded.
+    bool sample( typename ppt::Traits<T>::CRef m ) {
+        if( _samplePredicate ) return _samplePredicate(m);
+        if( _sampleEvery < 2 ) return _sampleEvery;
+        return !(_nMessages.fetch_add( 1, std::memory_order_relaxed ) % _sampleEvery);
+    }
+
+    /// Moves entries of other journal to the end of this one. Other journal
+    /// must not be written concurrently.
+    void append( Journal & o ) {
+        std::unique_lock<std::mutex> lock(_mtx);
+        this->insert( this->end(), o.begin(), o.end() );
+        o.clear();
+    }
+
     /// Creates new journal entry with 0 message ID.
     void new_entry( EntryType et, void * p ) {
-        std::unique_lock<std::mutex> lock(_mtx);
-        std::vector<ThisEntry>::push_back( ThisEntry{ std::clock(), p, et, 0 } );
+        new_entry( et, p, 0 );
     }
     /// Creates new journal entry tagged with given message ID.
     void new_entry( EntryType et, void * p, typename ppt::Traits<T>::MessageID mid ) {
+        const uint64_t t = stats::now();
+        const unsigned long th = current_thread_tag();
         std::unique_lock<std::mutex> lock(_mtx);
-        std::vector<ThisEntry>::push_back( ThisEntry{ std::clock(), p, et, mid } );
+        std::vector<ThisEntry>::push_back( ThisEntry{ t, p, et, mid, th } );
     }
 
     /// Writes the events journal.
@@ -178,7 +248,7 @@ public:
         for( auto & e : *this ) {
             auto lnr = journaling::Traits<T>::new_list_node( nr.second, nr, "event" );
             snprintf( bf, sizeof(bf), "%#lx", (long unsigned int) e.time );
-            journaling::Traits<T>::template add_field<clock_t>( lnr, "time",   bf );
+            journaling::Traits<T>::template add_field<uint64_t>( lnr, "time", bf );
             snprintf( bf, sizeof(bf), "%p", e.issuer );
             journaling::Traits<T>::template add_field<void *>(  lnr, "issuer", bf );
             snprintf( bf, sizeof(bf), "%x", e.type );
@@ -187,6 +257,8 @@ public:
                 snprintf( bf, sizeof(bf), "%#lx", (long unsigned int) e.msgID );
                 journaling::Traits<T>::template add_field<int>( lnr, "msgID", bf );
             }
+            snprintf( bf, sizeof(bf), "%#lx", e.thread );
+            journaling::Traits<T>::template add_field<unsigned long>( lnr, "thread", bf );
         }
     }
 
@@ -207,16 +279,40 @@ public:
                << ":" << std::hex << std::setw(16) << e.issuer << std::dec
                << " " << e.type
                << " " << e.msgID
+               << " " << std::hex << e.thread << std::dec
                << std::endl
                ;
         }
     }
 };
 
+/// Per-thread journaling sampling state. The decision is made once the
+/// message enters the top-level pipe and is inherited by nested evaluations.
+struct Sampling {
+    static bool & sampled() { static thread_local bool v = true; return v; }
+    static unsigned & depth() { static thread_local unsigned d = 0; return d; }
+};
+
+/// Scope of pipe evaluation making the sampling decision at top level.
+template<typename T>
+class SamplingScope {
+public:
+    SamplingScope( Journal<T> * j, typename ppt::Traits<T>::CRef m ) {
+        if( !Sampling::depth()++ ) {
+            Sampling::sampled() = !j || j->sample(m);
+        }
+    }
+    ~SamplingScope() {
+        if( !--Sampling::depth() ) {
+            Sampling::sampled() = true;
+        }
+    }
+};
+
 }  // namespace journaling
-# define JOURNAL_ENTRY( tp, procPtr ) if(this->has_journal()) this->journal().new_entry(::ppt::journaling::tp, procPtr);
+# define JOURNAL_ENTRY( tp, procPtr, m ) if(::ppt::journaling::Sampling::sampled() && this->has_journal()) this->journal().new_entry(::ppt::journaling::tp, procPtr, Traits<T>::message_id(m));
 # else
-# define JOURNAL_ENTRY( tp, procPtr ) /* journaling disabled */
+# define JOURNAL_ENTRY( tp, procPtr, m ) /* journaling disabled */
 # endif
 
 template<typename T, typename SourceT> struct ExtractionTraits;
@@ -228,8 +324,317 @@ template<typename T, typename SourceT> struct ExtractionTraits;
     // Might be defined to pack back the modified messages.
     //pack()  ... TODO
 };
+// Alternatively, the chunked (lazy) protocol may be defined. Span then
+// decodes the inner items chunk by chunk, stops decoding once the inner pipe
+// returns the stop-iteration code and re-packs only the modified chunks:
+{
+    // Appends items of the chunk #n to the buffer; returns false if there
+    // is no such chunk.
+    static bool decode_chunk( Traits<SourceT>::CRef src, size_t n, std::vector<T> & items );
+    // Packs the (modified) items of chunk #n back. Not needed for observers.
+    static void encode_chunk( Traits<SourceT>::Ref src, size_t n, const std::vector<T> & items );
+    // Converts the inner result code into outer one.
+    static typename Traits<SourceT>::Routing::ResultCode translate_results( typename Traits<T>::Routing::ResultCode );
+};
 # endif
 
+namespace aux {
+/// Detects whether extraction traits implement the chunked protocol.
+template<typename ExtractionTraitsT, typename=void>
+struct IsChunked : public std::false_type {};
+template<typename ExtractionTraitsT>
+struct IsChunked< ExtractionTraitsT
+                , decltype((void) &ExtractionTraitsT::decode_chunk) > : public std::true_type {};
+}  // namespace aux
+
+//
+// Checkpointing
+///////////////
+
+namespace checkpointing {
+
+/// Binary blob of serialized state.
+typedef std::string Blob;
+
+/// Appends trivially copyable value to the blob.
+template<typename VT> void
+put( Blob & b, const VT & v ) {
+    static_assert( std::is_trivially_copyable<VT>::value
+                 , "Only trivially copyable values may be put as is." );
+    b.append( reinterpret_cast<const char *>(&v), sizeof(VT) );
+}
+
+/// Reads trivially copyable value from the blob at given offset, advancing
+/// it. Returns false if blob is too short.
+template<typename VT> bool
+get( const Blob & b, size_t & offset, VT & v ) {
+    static_assert( std::is_trivially_copyable<VT>::value
+                 , "Only trivially copyable values may be get as is." );
+    if( offset + sizeof(VT) > b.size() ) return false;
+    memcpy( &v, b.data() + offset, sizeof(VT) );
+    offset += sizeof(VT);
+    return true;
+}
+
+/**@brief Opt-in interface of objects having the state to be checkpointed.
+ *
+ * Processors keeping the state between messages shall override
+ * `save_state()'/`load_state()'. To make checkpoints incremental, processor
+ * may also override `state_version()' returning value that changes each time
+ * the state is modified; unchanged state is then not serialized again.
+ * */
+class Stateful {
+public:
+    /// State version value forcing state to be saved on each checkpoint.
+    static constexpr uint64_t untracked = ~uint64_t(0);
+
+    virtual ~Stateful() {}
+    /// Serializes the state into blob.
+    virtual void save_state( Blob & ) const {}
+    /// Restores the state from blob.
+    virtual void load_state( const Blob & ) {}
+    /// Returns state modification counter.
+    virtual uint64_t state_version() const { return untracked; }
+    /// Invokes callback for this and nested objects, in deterministic
+    /// order.
+    virtual void walk_state( const std::function<void(Stateful &)> & f ) { f(*this); }
+};
+
+/**@brief Writes consistent snapshots of processors tree state.
+ *
+ * Has to be notified after each message evaluated by top-level pipe with
+ * the source cursor (position to resume from). Each `period' messages the
+ * state of modified processors is serialized (in the processing thread,
+ * at message boundary) and the snapshot is written to file by background
+ * thread, replacing the previous one atomically. File and its directory are
+ * synced before and after the replacement, so the snapshot survives the
+ * system crash.
+ *
+ * Failure of background write keeps the previous snapshot and is reported
+ * by the next `checkpoint()' or `wait()' call with `std::runtime_error'.
+ * */
+class Checkpointer {
+private:
+    typedef std::vector< std::shared_ptr<const Blob> > Snapshot;
+
+    Stateful & _root;
+    const std::string _path;
+    size_t _period
+         , _nMessages
+         ;
+    /// Versions and blobs of previous snapshot.
+    std::vector<uint64_t> _versions;
+    Snapshot _blobs;
+    size_t _nSerialized;
+    // Background writer state
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _pending
+       , _stop
+       ;
+    uint64_t _pendingCursor;
+    Snapshot _pendingBlobs;
+    /// Description of the last failed write, empty if none.
+    std::string _error;
+    std::thread _writer;
+
+    /// Writes whole buffer to file descriptor, retrying on interrupts.
+    static bool _write_all( int fd, const char * data, size_t size ) {
+        while( size ) {
+            const ssize_t n = ::write( fd, data, size );
+            if( n < 0 ) {
+                if( EINTR == errno ) continue;
+                return false;
+            }
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    /// Syncs the directory entries of given file.
+    static bool _sync_dir( const std::string & path ) {
+        const size_t n = path.rfind( '/' );
+        const std::string dir = std::string::npos == n ? "."
+                              : ( n ? path.substr( 0, n ) : "/" );
+        const int fd = ::open( dir.c_str(), O_RDONLY | O_DIRECTORY );
+        if( fd < 0 ) return false;
+        const bool ok = !::fsync( fd );
+        ::close( fd );
+        return ok;
+    }
+
+    /// Writes snapshot to temporary file and replaces the previous one.
+    /// Returns empty string on success, or the failure description (the
+    /// previous snapshot stays valid then).
+    std::string _write( uint64_t cursor, const Snapshot & blobs ) {
+        const std::string tmpPath = _path + ".tmp";
+        Blob header( "PPTCKPT1" );
+        put( header, cursor );
+        put( header, uint64_t(blobs.size()) );
+        const int fd = ::open( tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+        if( fd < 0 ) {
+            return "unable to open \"" + tmpPath + "\": " + strerror(errno);
+        }
+        bool ok = _write_all( fd, header.data(), header.size() );
+        for( auto it = blobs.begin(); ok && blobs.end() != it; ++it ) {
+            Blob sz;
+            put( sz, uint64_t((*it)->size()) );
+            ok = _write_all( fd, sz.data(), sz.size() )
+              && _write_all( fd, (*it)->data(), (*it)->size() );
+        }
+        if( ok ) ok = !::fsync( fd );
+        int writeErrno = errno;
+        if( ::close( fd ) && ok ) {
+            ok = false;
+            writeErrno = errno;
+        }
+        if( !ok ) {
+            std::remove( tmpPath.c_str() );
+            return "unable to write \"" + tmpPath + "\": " + strerror(writeErrno);
+        }
+        if( std::rename( tmpPath.c_str(), _path.c_str() ) ) {
+            const int renameErrno = errno;
+            std::remove( tmpPath.c_str() );
+            return "unable to rename \"" + tmpPath + "\" to \"" + _path
+                 + "\": " + strerror(renameErrno);
+        }
+        if( !_sync_dir( _path ) ) {
+            return "unable to sync directory of \"" + _path + "\": " + strerror(errno);
+        }
+        return std::string();
+    }
+
+    /// Throws and resets the recorded write failure, if any. Must be called
+    /// with the lock held.
+    void _throw_if_failed() {
+        if( _error.empty() ) return;
+        std::string e;
+        e.swap( _error );
+        throw std::runtime_error( "Checkpoint failed: " + e + "." );
+    }
+
+    void _run() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        for(;;) {
+            _cv.wait( lock, [this](){ return _pending || _stop; } );
+            if( !_pending ) return;
+            Snapshot blobs;
+            blobs.swap( _pendingBlobs );
+            uint64_t cursor = _pendingCursor;
+            lock.unlock();
+            std::string error = _write( cursor, blobs );
+            lock.lock();
+            if( !error.empty() ) _error.swap( error );
+            _pending = false;
+            _cv.notify_all();
+        }
+    }
+public:
+    Checkpointer( Stateful & root
+                , const std::string & path
+                , size_t period=10000 ) : _root(root), _path(path)
+                                        , _period(period), _nMessages(0)
+                                        , _nSerialized(0)
+                                        , _pending(false), _stop(false)
+                                        , _pendingCursor(0)
+                                        , _writer( &Checkpointer::_run, this ) {}
+    ~Checkpointer() {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stop = true;
+            _cv.notify_all();
+        }
+        _writer.join();
+    }
+
+    /// To be called after each top-level message; `cursor' is the source
+    /// position following this message.
+    void message_done( uint64_t cursor ) {
+        if( _period && !(++_nMessages % _period) ) {
+            checkpoint( cursor );
+        }
+    }
+
+    /// Takes the snapshot immediately. Waits for previous snapshot to be
+    /// written, if it is still in progress; throws if it has failed (the
+    /// current snapshot is not written then).
+    void checkpoint( uint64_t cursor ) {
+        Snapshot blobs;
+        std::vector<uint64_t> versions;
+        _root.walk_state( [&]( Stateful & s ) {
+            const size_t n = blobs.size();
+            const uint64_t v = s.state_version();
+            if( Stateful::untracked != v && n < _versions.size() && _versions[n] == v ) {
+                blobs.push_back( _blobs[n] );
+            } else {
+                std::shared_ptr<Blob> b( new Blob() );
+                s.save_state( *b );
+                blobs.push_back( b );
+                ++_nSerialized;
+            }
+            versions.push_back( v );
+        } );
+        _versions.swap( versions );
+        _blobs = blobs;
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait( lock, [this](){ return !_pending; } );
+        _throw_if_failed();
+        _pendingBlobs.swap( blobs );
+        _pendingCursor = cursor;
+        _pending = true;
+        _cv.notify_all();
+    }
+
+    /// Blocks until the snapshot being written is done. Throws if it (or
+    /// the previous one) has failed.
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait( lock, [this](){ return !_pending; } );
+        _throw_if_failed();
+    }
+
+    /// Restores the state of processors tree from the snapshot file and
+    /// writes the source cursor to resume from. Returns false if there is no
+    /// valid snapshot (neither state nor cursor are changed then).
+    bool restore( uint64_t & cursor ) {
+        std::ifstream is( _path, std::ios::binary );
+        if( !is ) return false;
+        Blob content( (std::istreambuf_iterator<char>(is))
+                    , std::istreambuf_iterator<char>() );
+        if( content.compare( 0, 8, "PPTCKPT1" ) ) return false;
+        size_t offset = 8;
+        uint64_t savedCursor, nBlobs;
+        if( !get( content, offset, savedCursor ) || !get( content, offset, nBlobs ) ) {
+            return false;
+        }
+        std::vector<Blob> blobs;
+        for( uint64_t i = 0; i < nBlobs; ++i ) {
+            uint64_t sz;
+            if( !get( content, offset, sz ) || offset + sz > content.size() ) {
+                return false;
+            }
+            blobs.push_back( content.substr( offset, sz ) );
+            offset += sz;
+        }
+        if( offset != content.size() ) return false;
+        size_t n = 0;
+        _root.walk_state( [&]( Stateful & ) { ++n; } );
+        if( n != blobs.size() ) return false;  // topology has changed
+        n = 0;
+        _root.walk_state( [&]( Stateful & s ) { s.load_state( blobs[n++] ); } );
+        _versions.clear();
+        _blobs.clear();
+        cursor = savedCursor;
+        return true;
+    }
+
+    /// Number of state blobs serialized so far (not re-used).
+    size_t n_serialized() const { return _nSerialized; }
+};  // class Checkpointer
+
+}  // namespace checkpointing
+
 //
 // Processors
 ////////////
@@ -243,7 +648,7 @@ template<typename T, typename SourceT> struct ExtractionTraits;
 
 // Provides basic introspection for downcasting the type: observer/mutator
 template< typename T >
-class AbstractProcessor {
+class AbstractProcessor : public checkpointing::Stateful {
 private:
     const bool _isObserver;
     bool _isVacant;  ///< Used in addition with CV to prevent SWU
@@ -251,16 +656,23 @@ private:
     std::condition_variable _busyCV;
     # ifndef PPT_DISABLE_JOUNRALING
     typename journaling::Traits<T>::Journal * _jPtr;
+    /// Processor the journal entries are attributed to.
+    void * _jIssuer;
+    # endif
+    # ifndef PIPET_DISABLE_STATS
+    stats::HandlerStats _stats;
     # endif
 protected:
     void _set_vacant(bool v) { _isVacant = v; }
     AbstractProcessor( bool isObserver ) : _isObserver(isObserver)
                                          , _isVacant(true)
-                                         , _jPtr(nullptr) {}
+                                         , _jPtr(nullptr)
+                                         , _jIssuer(this) {}
     AbstractProcessor( const AbstractProcessor<T> & o ) : _isObserver(o._isObserver)
                                                         , _isVacant(true)
                                                         , _busyCV()
-                                                        , _jPtr(nullptr) {}
+                                                        , _jPtr(nullptr)
+                                                        , _jIssuer(this) {}
 public:
     virtual ~AbstractProcessor(){}
     /// Use it to downcast processor instance to common type
@@ -274,6 +686,11 @@ public:
     std::condition_variable & busy_CV() { return _busyCV; }
     /// Returns mutex guarding "busy" condition variable
     std::mutex & busy_mutex() { return _busyMtx; }
+    # ifndef PIPET_DISABLE_STATS
+    /// Returns instrumentation counters of processor instance.
+    stats::HandlerStats & stats() { return _stats; }
+    const stats::HandlerStats & stats() const { return _stats; }
+    # endif
 
     # ifndef PPT_DISABLE_JOUNRALING
     /// Returns true if there is a journal associated with processor instance
@@ -283,6 +700,11 @@ public:
     typename journaling::Traits<T>::Journal & journal() { return *_jPtr; }
     /// Sets journal instance.
     virtual void assign_journal( typename journaling::Traits<T>::Journal & j ) { _jPtr = &j; }
+    /// Returns the processor journal entries are attributed to: this
+    /// instance, unless it is a clone evaluating on behalf of another one.
+    void * journal_issuer() const { return _jIssuer; }
+    /// Attributes journal entries of this instance to given processor.
+    void set_journal_issuer( void * p ) { _jIssuer = p; }
     /// Appends given document with fields specific for this processor
     /// instance.
     virtual void info( typename journaling::Traits<T>::NodeRef d ) const {
@@ -310,9 +732,22 @@ public:
         assert( this->is_vacant() );
         std::unique_lock<std::mutex> lock( this->busy_mutex() );
         this->_set_vacant(false);
-        JOURNAL_ENTRY( procBgn, this )
+        JOURNAL_ENTRY( procBgn, this->journal_issuer(), m )
+        # ifndef PIPET_DISABLE_STATS
+        if( stats::enabled() ) {
+            stats::Timer t;
+            auto rc = _V_eval( m );
+            this->stats().account( !Traits<T>::Routing::do_stop_propagation( rc )
+                                 , Traits<T>::Routing::do_stop_propagation( rc )
+                                 , Traits<T>::Routing::was_modified( rc )
+                                 , t.elapsed() );
+            JOURNAL_ENTRY( procEnd, this->journal_issuer(), m )
+            this->_set_vacant(true);
+            return rc;
+        }
+        # endif
         auto rc = _V_eval( m );
-        JOURNAL_ENTRY( procEnd, this )
+        JOURNAL_ENTRY( procEnd, this->journal_issuer(), m )
         this->_set_vacant(true);
         return rc;
     }
@@ -329,13 +764,33 @@ protected:
     virtual typename Traits<T>::Routing::ResultCode _V_eval( RefType ) = 0;
 public:
     iProcessor() : AbstractProcessor<typename std::remove_const<T>::type>( true ) {}
+    /// Shall return new instance of observer with same configuration and
+    /// empty state, to be used on concurrent thread. Observers returning
+    /// nullptr (default) can not be evaluated in parallel.
+    virtual iProcessor<const T> * clone() const { return nullptr; }
+    /// Shall move the state accumulated by the clone into this instance,
+    /// leaving clone in initial state. Merging has to be commutative.
+    virtual void merge( iProcessor<const T> & ) {}
     virtual typename Traits<T>::Routing::ResultCode eval( RefType m ) {
         assert( this->is_vacant() );
         std::unique_lock<std::mutex> lock( this->busy_mutex() );
         this->_set_vacant(false);
-        JOURNAL_ENTRY( procBgn, this )
+        JOURNAL_ENTRY( procBgn, this->journal_issuer(), m )
+        # ifndef PIPET_DISABLE_STATS
+        if( stats::enabled() ) {
+            stats::Timer t;
+            auto rc = _V_eval( m );
+            this->stats().account( !Traits<T>::Routing::do_stop_propagation( rc )
+                                 , Traits<T>::Routing::do_stop_propagation( rc )
+                                 , Traits<T>::Routing::was_modified( rc )
+                                 , t.elapsed() );
+            JOURNAL_ENTRY( procEnd, this->journal_issuer(), m )
+            this->_set_vacant(true);
+            return rc;
+        }
+        # endif
         auto rc = _V_eval( m );
-        JOURNAL_ENTRY( procEnd, this )
+        JOURNAL_ENTRY( procEnd, this->journal_issuer(), m )
         this->_set_vacant(true);
         return rc;
     }
@@ -474,6 +929,394 @@ public:
     # endif
 };  // StatelessMutator
 
+//
+// Memoization of pure processors
+////////////////////////////////
+
+/// Entries replacement policy of memoization cache.
+enum class EvictionPolicy {
+    CLOCK,  ///< second-chance: evicts first entry not accessed since last scan
+    LRU,    ///< evicts least recently accessed entry of the bucket
+};
+
+/**@brief Bounded concurrent cache for memoized processors.
+ *
+ * Set-associative table of fixed capacity, shared between any number of
+ * memoizing processors (possibly running on different threads). Lookup is
+ * lock-free: every entry is guarded by a sequence counter (seqlock), so
+ * reader just retries (or reports a miss) if entry is being re-written.
+ * Insertion is best-effort: it is omitted if the victim entry is being
+ * written by another thread. Hits and misses are counted per thread slot
+ * (see `stats::thread_slot()'), and the LRU clock advances on insertions
+ * only, so hits do not write to shared cache lines.
+ *
+ * Both the key and the value types must be trivially copyable.
+ * */
+template< typename KeyT
+        , typename ValueT
+        , EvictionPolicy policyT=EvictionPolicy::CLOCK
+        , typename HashT=std::hash<KeyT> >
+class MemoCache {
+    static_assert( std::is_trivially_copyable<KeyT>::value
+                 , "Memoization key type must be trivially copyable." );
+    static_assert( std::is_trivially_copyable<ValueT>::value
+                 , "Memoization value type must be trivially copyable." );
+public:
+    /// Number of entries in single bucket.
+    static constexpr size_t nWays = 4;
+private:
+    struct Entry {
+        std::atomic<uint32_t> seq;  ///< odd while written, 0 if empty
+        std::atomic<uint64_t> stamp;  ///< reference bit (CLOCK) or tick (LRU)
+        KeyT key;
+        ValueT value;
+    };
+    /// Counters of single thread slot, padded to avoid false sharing.
+    struct Counters {
+        char _padBefore[64];
+        std::atomic<uint64_t> nHits
+                            , nMisses
+                            ;
+        char _padAfter[64];
+    };
+    std::unique_ptr<Entry[]> _entries;
+    size_t _nBucketsMask;
+    /// Coarse LRU clock, advanced by insertions.
+    std::atomic<uint64_t> _tick;
+    std::unique_ptr<Counters[]> _counters;
+    HashT _hash;
+
+    Entry * _bucket( const KeyT & k ) {
+        return _entries.get() + nWays*(_hash(k) & _nBucketsMask);
+    }
+    /// Marks entry as accessed at given LRU tick (ignored for CLOCK).
+    void _touch( Entry & e, uint64_t tick ) {
+        const uint64_t s = EvictionPolicy::LRU == policyT ? tick : 1;
+        if( e.stamp.load(std::memory_order_relaxed) != s ) {
+            e.stamp.store( s, std::memory_order_relaxed );
+        }
+    }
+    static void _inc( std::atomic<uint64_t> & c ) {
+        c.fetch_add( 1, std::memory_order_relaxed );
+    }
+    Entry & _victim( Entry * b ) {
+        // Empty entries are always preferred.
+        for( size_t i = 0; i < nWays; ++i ) {
+            if( !b[i].seq.load(std::memory_order_relaxed) ) return b[i];
+        }
+        if( EvictionPolicy::LRU == policyT ) {
+            Entry * v = b;
+            for( size_t i = 1; i < nWays; ++i ) {
+                if( b[i].stamp.load(std::memory_order_relaxed)
+                  < v->stamp.load(std::memory_order_relaxed) ) v = b + i;
+            }
+            return *v;
+        }
+        // CLOCK: give second chance to referenced entries.
+        for( size_t n = 0; n < 2*nWays; ++n ) {
+            Entry & e = b[n % nWays];
+            if( !e.stamp.exchange(0, std::memory_order_relaxed) ) return e;
+        }
+        return *b;
+    }
+public:
+    /// Capacity is rounded up to the power of two.
+    MemoCache( size_t capacity=4096 ) : _tick(1)
+                                      , _counters( new Counters [stats::nThreadSlots] ) {
+        size_t nBuckets = 1;
+        while( nBuckets*nWays < capacity ) nBuckets <<= 1;
+        _nBucketsMask = nBuckets - 1;
+        _entries.reset( new Entry [nBuckets*nWays] );
+        for( size_t i = 0; i < nBuckets*nWays; ++i ) {
+            _entries[i].seq.store( 0 );
+            _entries[i].stamp.store( 0 );
+        }
+        reset_counters();
+    }
+    MemoCache( const MemoCache & ) = delete;
+
+    /// Writes cached value for the key and returns true on hit.
+    bool lookup( const KeyT & k, ValueT & v ) {
+        Entry * b = _bucket(k);
+        for( size_t i = 0; i < nWays; ++i ) {
+            Entry & e = b[i];
+            uint32_t s1 = e.seq.load( std::memory_order_acquire );
+            if( !s1 || (s1 & 0x1) ) continue;
+            KeyT ck;
+            memcpy( &ck, &e.key, sizeof(KeyT) );
+            if( !(ck == k) ) continue;
+            ValueT cv;
+            memcpy( &cv, &e.value, sizeof(ValueT) );
+            std::atomic_thread_fence( std::memory_order_acquire );
+            if( e.seq.load( std::memory_order_relaxed ) != s1 ) continue;
+            v = cv;
+            _touch( e, EvictionPolicy::LRU == policyT
+                       ? _tick.load( std::memory_order_relaxed ) : 0 );
+            _inc( _counters[stats::thread_slot()].nHits );
+            return true;
+        }
+        _inc( _counters[stats::thread_slot()].nMisses );
+        return false;
+    }
+
+    /// Stores the value for the key, evicting one of the bucket entries.
+    void insert( const KeyT & k, const ValueT & v ) {
+        Entry & e = _victim( _bucket(k) );
+        uint32_t s = e.seq.load( std::memory_order_relaxed );
+        if( (s & 0x1)
+         || !e.seq.compare_exchange_strong( s, s + 1, std::memory_order_acquire ) ) {
+            return;  // being written by concurrent thread
+        }
+        std::atomic_thread_fence( std::memory_order_release );
+        memcpy( &e.key, &k, sizeof(KeyT) );
+        memcpy( &e.value, &v, sizeof(ValueT) );
+        e.seq.store( s + 2, std::memory_order_release );
+        _touch( e, EvictionPolicy::LRU == policyT
+                   ? _tick.fetch_add( 1, std::memory_order_relaxed ) + 1 : 0 );
+    }
+
+    uint64_t n_hits() const {
+        uint64_t n = 0;
+        for( size_t i = 0; i < stats::nThreadSlots; ++i ) {
+            n += _counters[i].nHits.load( std::memory_order_relaxed );
+        }
+        return n;
+    }
+    uint64_t n_misses() const {
+        uint64_t n = 0;
+        for( size_t i = 0; i < stats::nThreadSlots; ++i ) {
+            n += _counters[i].nMisses.load( std::memory_order_relaxed );
+        }
+        return n;
+    }
+    double hit_rate() const {
+        uint64_t h = n_hits(), m = n_misses();
+        return h + m ? double(h)/(h + m) : 0.;
+    }
+    void reset_counters() {
+        for( size_t i = 0; i < stats::nThreadSlots; ++i ) {
+            _counters[i].nHits.store( 0 );
+            _counters[i].nMisses.store( 0 );
+        }
+    }
+};  // class MemoCache
+
+/**@brief Memoizing wrapper for pure mutator.
+ *
+ * Keys the cache on user-supplied projection (or hash) of the message. On
+ * hit the wrapped processor is not invoked: stored result code is returned
+ * and, if it indicates modification, the recorded mutation is applied to the
+ * message. By default the whole (trivially copyable) message is recorded;
+ * otherwise user has to provide the record/replay functions for part of the
+ * message affected by the mutator.
+ * */
+template< typename T
+        , typename KeyT
+        , typename PayloadT=T
+        , EvictionPolicy policyT=EvictionPolicy::CLOCK >
+class MemoizedMutator : public iMutator<T> {
+public:
+    typedef typename Traits<T>::Routing::ResultCode ResultCode;
+    struct Value {
+        ResultCode rc;
+        PayloadT payload;
+    };
+    typedef MemoCache<KeyT, Value, policyT> Cache;
+private:
+    iProcessor<T> * _wrapped;
+    KeyT (* _key)( typename Traits<T>::CRef );
+    PayloadT (* _record)( typename Traits<T>::CRef );
+    void (* _replay)( typename Traits<T>::Ref, const PayloadT & );
+    std::unique_ptr<Cache> _ownCache;
+    Cache * _cache;
+
+    static PayloadT _record_whole( typename Traits<T>::CRef m ) { return m; }
+    static void _replay_whole( typename Traits<T>::Ref m, const PayloadT & p ) { m = p; }
+protected:
+    virtual ResultCode _V_eval( typename Traits<T>::Ref m ) override {
+        const KeyT k = _key(m);
+        Value v;
+        if( _cache->lookup( k, v ) ) {
+            if( Traits<T>::Routing::was_modified( v.rc ) ) {
+                _replay( m, v.payload );
+            }
+            return v.rc;
+        }
+        v.rc = _wrapped->eval( m );
+        if( Traits<T>::Routing::was_modified( v.rc ) ) {
+            v.payload = _record( m );
+        }
+        _cache->insert( k, v );
+        return v.rc;
+    }
+public:
+    /// Memoizes mutator recording the entire message; uses own cache.
+    MemoizedMutator( iProcessor<T> * wrapped
+                   , KeyT (*key)( typename Traits<T>::CRef )
+                   , size_t capacity=4096 )
+            : _wrapped(wrapped), _key(key)
+            , _record(_record_whole), _replay(_replay_whole)
+            , _ownCache( new Cache(capacity) ) { _cache = _ownCache.get(); }
+    /// Memoizes mutator with custom mutation record/replay functions, using
+    /// given (possibly shared) cache.
+    MemoizedMutator( iProcessor<T> * wrapped
+                   , KeyT (*key)( typename Traits<T>::CRef )
+                   , PayloadT (*record)( typename Traits<T>::CRef )
+                   , void (*replay)( typename Traits<T>::Ref, const PayloadT & )
+                   , Cache & cache )
+            : _wrapped(wrapped), _key(key)
+            , _record(record), _replay(replay)
+            , _cache(&cache) {}
+
+    Cache & cache() { return *_cache; }
+
+    # ifndef PPT_DISABLE_JOUNRALING
+    virtual void info( typename journaling::Traits<T>::NodeRef d ) const override {
+        iMutator<T>::info(d);
+        char bf[32];
+        snprintf( bf, sizeof(bf), "%.3f", _cache->hit_rate() );
+        journaling::Traits<T>::template add_field<double>( d, "memoHitRate", bf );
+    }
+    # endif
+};  // MemoizedMutator
+
+/**@brief Memoizing wrapper for pure observer.
+ *
+ * Caches only the result code, so is useful for expensive discriminators.
+ * */
+template< typename T
+        , typename KeyT
+        , EvictionPolicy policyT=EvictionPolicy::CLOCK >
+class MemoizedObserver : public iObserver<T> {
+public:
+    typedef typename Traits<T>::Routing::ResultCode ResultCode;
+    typedef MemoCache<KeyT, ResultCode, policyT> Cache;
+private:
+    iProcessor<const T> * _wrapped;
+    KeyT (* _key)( typename Traits<T>::CRef );
+    std::unique_ptr<Cache> _ownCache;
+    Cache * _cache;
+protected:
+    virtual ResultCode _V_eval( typename Traits<T>::CRef m ) override {
+        const KeyT k = _key(m);
+        ResultCode rc;
+        if( _cache->lookup( k, rc ) ) return rc;
+        rc = _wrapped->eval( m );
+        _cache->insert( k, rc );
+        return rc;
+    }
+public:
+    MemoizedObserver( iProcessor<const T> * wrapped
+                    , KeyT (*key)( typename Traits<T>::CRef )
+                    , size_t capacity=4096 )
+            : _wrapped(wrapped), _key(key)
+            , _ownCache( new Cache(capacity) ) { _cache = _ownCache.get(); }
+    MemoizedObserver( iProcessor<const T> * wrapped
+                    , KeyT (*key)( typename Traits<T>::CRef )
+                    , Cache & cache )
+            : _wrapped(wrapped), _key(key), _cache(&cache) {}
+
+    Cache & cache() { return *_cache; }
+
+    # ifndef PPT_DISABLE_JOUNRALING
+    virtual void info( typename journaling::Traits<T>::NodeRef d ) const override {
+        iObserver<T>::info(d);
+        char bf[32];
+        snprintf( bf, sizeof(bf), "%.3f", _cache->hit_rate() );
+        journaling::Traits<T>::template add_field<double>( d, "memoHitRate", bf );
+    }
+    # endif
+};  // MemoizedObserver
+
+//
+// Parallel evaluation
+/////////////////////
+
+/**@brief Fork-join pool of threads.
+ *
+ * The calling thread participates in evaluation as worker #0, so the pool of
+ * size N keeps N-1 threads.
+ * */
+class ThreadPool {
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _mtx
+             , _runMtx
+             ;
+    std::condition_variable _cv
+                          , _doneCV
+                          ;
+    const std::function<void(size_t)> * _task;
+    uint64_t _generation;
+    size_t _nRunning;
+    bool _stop;
+
+    /// Pool whose task is being run by current thread.
+    static const ThreadPool *& _running() {
+        static thread_local const ThreadPool * p = nullptr;
+        return p;
+    }
+
+    void _worker( size_t n ) {
+        uint64_t seen = 0;
+        _running() = this;
+        std::unique_lock<std::mutex> lock(_mtx);
+        for(;;) {
+            _cv.wait( lock, [&](){ return _stop || _generation != seen; } );
+            if( _stop ) return;
+            seen = _generation;
+            const std::function<void(size_t)> & task = *_task;
+            lock.unlock();
+            task( n );
+            lock.lock();
+            if( !--_nRunning ) _doneCV.notify_all();
+        }
+    }
+public:
+    ThreadPool( size_t n=std::thread::hardware_concurrency() )
+            : _task(nullptr), _generation(0), _nRunning(0), _stop(false) {
+        for( size_t i = 1; i < n; ++i ) {
+            _threads.emplace_back( &ThreadPool::_worker, this, i );
+        }
+    }
+    ThreadPool( const ThreadPool & ) = delete;
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stop = true;
+            _cv.notify_all();
+        }
+        for( auto & t : _threads ) t.join();
+    }
+
+    /// Number of workers, including the calling thread.
+    size_t size() const { return _threads.size() + 1; }
+
+    /// Invokes f(n) for each worker number n in [0, size()) concurrently
+    /// and waits for all of them to finish. Nested invocation (from the task
+    /// being run by this pool) evaluates f(n) sequentially.
+    void run( const std::function<void(size_t)> & f ) {
+        if( this == _running() ) {
+            for( size_t n = 0; n < size(); ++n ) f( n );
+            return;
+        }
+        std::unique_lock<std::mutex> runLock(_runMtx);
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _task = &f;
+            _nRunning = _threads.size();
+            ++_generation;
+            _cv.notify_all();
+        }
+        const ThreadPool * prev = _running();
+        _running() = this;
+        f( 0 );
+        _running() = prev;
+        std::unique_lock<std::mutex> lock(_mtx);
+        _doneCV.wait( lock, [this](){ return !_nRunning; } );
+    }
+};  // class ThreadPool
+
 //
 // Pipelines
 ///////////
@@ -489,18 +1332,149 @@ public:
     typedef typename std::conditional< std::is_const<T>::value
                                     , iObserver<T>
                                     , iMutator<T> >::type Parent;
+private:
+    typedef typename std::remove_const<T>::type Plain;
+    /// Clone of observer for concurrent evaluation of the run.
+    struct ObserverClone {
+        const AbstractProcessor<Plain> * orig;
+        std::unique_ptr<iProcessor<const Plain> > proc;
+        # ifndef PPT_DISABLE_JOUNRALING
+        std::unique_ptr<typename journaling::Traits<Plain>::Journal> journal;
+        # endif
+        ObserverClone() : orig(nullptr) {}
+    };
+    /// Observer clones, by position in the pipe.
+    std::vector<ObserverClone> _observerClones;
+
+    /// (Re-)creates clone of the observer at given position, in initial
+    /// state. Returns false if observer can not be cloned.
+    bool _reset_observer_clone( size_t n ) {
+        auto orig = static_cast<iProcessor<const Plain> *>((*this)[n]);
+        ObserverClone & c = _observerClones[n];
+        c.orig = orig;
+        c.proc.reset( orig->clone() );
+        if( !c.proc ) return false;
+        # ifndef PPT_DISABLE_JOUNRALING
+        c.journal.reset( new typename journaling::Traits<Plain>::Journal() );
+        c.proc->assign_journal( *c.journal );
+        c.proc->set_journal_issuer( orig->journal_issuer() );
+        # endif
+        return true;
+    }
+    /// Makes sure observers [b, e) have clones; returns false if some of
+    /// them can not be cloned.
+    bool _ensure_observer_clones( size_t b, size_t e ) {
+        if( _observerClones.size() < this->size() ) {
+            _observerClones.resize( this->size() );
+        }
+        for( size_t i = b; i < e; ++i ) {
+            if( _observerClones[i].proc
+             && _observerClones[i].orig == (*this)[i] ) continue;
+            if( !_reset_observer_clone( i ) ) return false;
+        }
+        return true;
+    }
+    /// Moves state, counters and journal entries of the clones [b, last]
+    /// into the observers; the work of clones (last, e) is discarded.
+    void _merge_observer_clones( size_t b, size_t last, size_t e ) {
+        for( size_t i = b; i < e; ++i ) {
+            if( i > last ) {
+                _reset_observer_clone( i );
+                continue;
+            }
+            ObserverClone & c = _observerClones[i];
+            auto orig = static_cast<iProcessor<const Plain> *>((*this)[i]);
+            orig->merge( *c.proc );
+            # ifndef PIPET_DISABLE_STATS
+            orig->stats().merge( c.proc->stats() );
+            # endif
+            # ifndef PPT_DISABLE_JOUNRALING
+            if( orig->has_journal() ) {
+                orig->journal().append( *c.journal );
+            } else {
+                c.journal->clear();
+            }
+            # endif
+        }
+    }
+
+    template<typename U, typename PipeT> friend size_t
+    _eval_observers_run( PipeT &, size_t, size_t
+                       , typename Traits<U>::CRef
+                       , typename Traits<U>::Routing::ResultCode & );
 protected:
     typename Traits<T>::Routing::ResultCode _rc;
+    /// Histogram of latencies of stamped messages passed the pipe.
+    stats::LatencyHistogram * _latency;
+    /// Pool for concurrent evaluation of consecutive observers (if set).
+    ThreadPool * _observersPool;
+    /// Whether observers runs are evaluated speculatively.
+    bool _speculativeObservers;
 
     virtual typename Traits<T>::Routing::ResultCode
     _V_eval( RefType m ) override {
         return _eval_pipe_on( this, m, _rc ); }
 public:
-    Pipe() {}
-    Pipe( const Pipe & o ) : std::vector<AbstractProcessor<typename std::remove_const<T>::type>*>(o) {}
+    Pipe() : _latency(nullptr), _observersPool(nullptr)
+           , _speculativeObservers(false) {}
+    Pipe( const Pipe & o ) : std::vector<AbstractProcessor<typename std::remove_const<T>::type>*>(o)
+                           , _latency(nullptr)
+                           , _observersPool(o._observersPool)
+                           , _speculativeObservers(o._speculativeObservers) {}
     typename Traits<T>::Routing::ResultCode lates_result_code() const {
         return _rc; }
 
+    /// Enables concurrent evaluation of the runs of two or more consecutive
+    /// observers on the message. All the observers of the run are evaluated
+    /// and joined before the next mutator. Results are combined as if the
+    /// run was evaluated sequentially: the first observer (in pipe order)
+    /// stopping propagation determines the result code.
+    ///
+    /// By default observers are evaluated on their clones (see
+    /// `iProcessor<const T>::clone()') which are merged back in pipe order
+    /// up to the stopping observer; the work of the following ones is
+    /// discarded, so observers state is the same as for sequential
+    /// evaluation. Runs with observers that can not be cloned are evaluated
+    /// sequentially. If `speculative' is set, the observers are evaluated
+    /// directly, and the ones following the stopping observer within the
+    /// run still see the message.
+    void set_observers_pool( ThreadPool * pool, bool speculative=false ) {
+        _observersPool = pool;
+        _speculativeObservers = speculative;
+        _observerClones.clear();
+    }
+    ThreadPool * observers_pool() const { return _observersPool; }
+    bool speculative_observers() const { return _speculativeObservers; }
+
+    /// Makes journaling sampling decision for the message entering the
+    /// top-level pipe.
+    virtual typename Traits<T>::Routing::ResultCode eval( RefType m ) override {
+        # ifndef PPT_DISABLE_JOUNRALING
+        journaling::SamplingScope<typename std::remove_const<T>::type> scope(
+                this->has_journal() ? &this->journal() : nullptr, m );
+        # endif
+        auto rc = Parent::eval( m );
+        if( _latency && !Traits<T>::Routing::do_stop_propagation( rc ) ) {
+            stats::record_latency( m, *_latency );
+        }
+        return rc;
+    }
+
+    /// Sets histogram to record the latency (time passed since message was
+    /// stamped by source) of messages passed the pipe.
+    void set_latency_histogram( stats::LatencyHistogram * h ) { _latency = h; }
+
+    # ifndef PIPET_DISABLE_STATS
+    /// Returns instrumentation snapshots of the processors, in order.
+    std::vector<stats::Snapshot> stats_snapshot() const {
+        std::vector<stats::Snapshot> r;
+        for( auto it = this->begin(); this->end() != it; ++it ) {
+            r.push_back( (*it)->stats().snapshot() );
+        }
+        return r;
+    }
+    # endif
+
     virtual void assign_journal( typename journaling::Traits<T>::Journal & j ) override {
         AbstractProcessor<typename std::remove_const<T>::type>::assign_journal(j);
         for( auto it = this->begin(); this->end() != it; ++it ) {
@@ -517,8 +1491,82 @@ public:
         }
     }
     # endif
+
+    /// Walks the pipe itself and its processors.
+    virtual void walk_state( const std::function<void(checkpointing::Stateful &)> & f ) override {
+        f(*this);
+        for( auto it = this->begin(); this->end() != it; ++it ) {
+            (*it)->walk_state( f );
+        }
+    }
 };  // Pipe
 
+// Evaluates the run [b, e) of the pipe observers concurrently (on their
+// clones, unless pipe evaluates them speculatively). Returns index of the
+// first observer that has stopped the propagation (setting rc to its
+// result), or e (with rc of the last one).
+template<typename T, typename PipeT> size_t
+_eval_observers_run( PipeT & p, size_t b, size_t e
+                   , typename Traits<T>::CRef m
+                   , typename Traits<T>::Routing::ResultCode & rc ) {
+    const bool cloned = !p.speculative_observers()
+                     && p._ensure_observer_clones( b, e );
+    if( !p.speculative_observers() && !cloned ) {
+        // Some of observers can not be cloned: sequential evaluation
+        for( size_t i = b; i < e; ++i ) {
+            auto proc = static_cast<iProcessor<const T>*>(p[i]);
+            {
+                std::unique_lock<std::mutex> lock(proc->busy_mutex());
+                while( !proc->is_vacant() ) {
+                    proc->busy_CV().wait( lock );
+                }
+            }
+            rc = proc->eval(m);
+            if( Traits<T>::Routing::do_stop_propagation( rc ) ) return i;
+            assert( ! Traits<T>::Routing::was_modified( rc ) );
+        }
+        return e;
+    }
+    const size_t n = e - b;
+    std::vector<typename Traits<T>::Routing::ResultCode> rcs(n);
+    std::atomic<size_t> next(0);
+    # ifndef PPT_DISABLE_JOUNRALING
+    const bool sampled = journaling::Sampling::sampled();
+    # endif
+    p.observers_pool()->run( [&]( size_t ) {
+        # ifndef PPT_DISABLE_JOUNRALING
+        // Propagate the sampling decision made by the caller
+        const bool wasSampled = journaling::Sampling::sampled();
+        journaling::Sampling::sampled() = sampled;
+        ++journaling::Sampling::depth();
+        # endif
+        for( size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1) ) {
+            iProcessor<const T> * proc = cloned
+                    ? p._observerClones[b + i].proc.get()
+                    : static_cast<iProcessor<const T>*>(p[b + i]);
+            {
+                std::unique_lock<std::mutex> lock(proc->busy_mutex());
+                while( !proc->is_vacant() ) {
+                    proc->busy_CV().wait( lock );
+                }
+            }
+            rcs[i] = proc->eval(m);
+        }
+        # ifndef PPT_DISABLE_JOUNRALING
+        --journaling::Sampling::depth();
+        journaling::Sampling::sampled() = wasSampled;
+        # endif
+    } );
+    size_t last = 0;
+    for( ; last < n; ++last ) {
+        rc = rcs[last];
+        if( Traits<T>::Routing::do_stop_propagation( rc ) ) break;
+        assert( ! Traits<T>::Routing::was_modified( rc ) );
+    }
+    if( cloned ) p._merge_observer_clones( b, b + last, e );
+    return b + last;
+}
+
 // Eval pipe with mutators
 template<typename T> typename std::enable_if< ! std::is_const<T>::value
                                             , typename Traits<T>::Routing::ResultCode >::type
@@ -527,6 +1575,21 @@ _eval_pipe_on( Pipe<T> * p
              , typename Traits<T>::Routing::ResultCode & rc ) {
     bool modified = false;
     for( auto it = p->begin(); p->end() != it; ++it ) {
+        if( p->observers_pool() && (*it)->is_observer() ) {
+            auto runEnd = it;
+            while( p->end() != runEnd && (*runEnd)->is_observer() ) ++runEnd;
+            if( runEnd - it > 1 ) {
+                if( size_t(runEnd - p->begin()) != _eval_observers_run<T>( *p
+                            , it - p->begin(), runEnd - p->begin(), m, rc ) ) {
+                    return modified
+                         ? rc
+                         : Traits<T>::Routing::mark_intact( rc )
+                         ;
+                }
+                it = runEnd - 1;
+                continue;
+            }
+        }
         {
             // whait processor becomes available
             std::unique_lock<std::mutex> lock((*it)->busy_mutex());
@@ -562,6 +1625,13 @@ template<typename T> typename std::enable_if< std::is_const<T>::value
 _eval_pipe_on( Pipe<T> * p
              , typename Traits<T>::CRef m
              , typename Traits<T>::Routing::ResultCode & rc ) {
+    if( p->observers_pool() && p->size() > 1 ) {
+        if( p->size() != _eval_observers_run<typename std::remove_const<T>::type>(
+                    *p, 0, p->size(), m, rc ) ) {
+            return Traits<T>::Routing::mark_intact( rc );
+        }
+        return Traits<T>::Routing::mark_intact( 0 );
+    }
     for( auto it = p->begin(); p->end() != it; ++it ) {
         assert( (*it)->is_observer() );
         rc = static_cast<iProcessor<const T>*>(*it)->eval(m);
@@ -627,17 +1697,71 @@ public:
         Recorder( Pipe<InT> * p
                 , typename Traits<OutT>::Ref container ) : _p(p), _container(container) {}
     };
-protected:
-    virtual typename Traits<OutT>::Routing::ResultCode
-    _V_eval( typename Traits<OutT>::Ref m ) override {
+private:
+    typedef ExtractionTraits<InT, OutT> Extraction;
+    /// Re-used buffer of the decoded chunk items.
+    std::vector<InT> _chunk;
+
+    typename Traits<OutT>::Routing::ResultCode
+    _process( typename Traits<OutT>::Ref m, std::false_type ) {
         Recorder r(this, m);
         // Make a temporary copy of the pipe with recorder processor appended.
         Pipe<InT> pCopy(*this);
         pCopy.push_back( &r );
-        return ExtractionTraits<InT, OutT>::process( m, pCopy );
+        return Extraction::process( m, pCopy );
+    }
+
+    typename Traits<OutT>::Routing::ResultCode
+    _process( typename Traits<OutT>::Ref m, std::true_type ) {
+        typename Traits<InT>::Routing::ResultCode rc = 0;
+        bool modified = false
+           , stop = false
+           ;
+        for( size_t n = 0; !stop; ++n ) {
+            _chunk.clear();
+            if( !Extraction::decode_chunk( m, n, _chunk ) ) break;
+            bool chunkModified = false;
+            for( auto it = _chunk.begin(); _chunk.end() != it; ++it ) {
+                rc = _eval_pipe_on<InT>( this, *it, this->_rc );
+                if( Traits<InT>::Routing::was_modified( rc ) ) {
+                    chunkModified = true;
+                }
+                if( Traits<InT>::Routing::do_stop_iteration( rc ) ) {
+                    stop = true;
+                    break;
+                }
+            }
+            if( chunkModified ) {
+                Extraction::encode_chunk( m, n, _chunk );
+                modified = true;
+            }
+        }
+        auto outRc = Extraction::translate_results( stop ? rc : 0 );
+        return modified ? outRc
+                        : Traits<OutT>::Routing::mark_intact( outRc )
+                        ;
+    }
+protected:
+    virtual typename Traits<OutT>::Routing::ResultCode
+    _V_eval( typename Traits<OutT>::Ref m ) override {
+        return _process( m, aux::IsChunked<Extraction>() );
     }
 public:
     Span( const Pipe<InT> & p ) : Pipe<InT>(p) {}
+
+    /// Walks the inner pipe.
+    virtual void walk_state( const std::function<void(checkpointing::Stateful &)> & f ) override {
+        Pipe<InT>::walk_state( f );
+    }
+
+    # ifndef PPT_DISABLE_JOUNRALING
+    /// Describes the inner pipe as nested processor of the "span" list.
+    virtual void info( typename journaling::Traits<OutT>::NodeRef d ) const override {
+        iMutator<OutT>::info(d);
+        auto spanList = journaling::Traits<OutT>::add_list( d, "span" );
+        Pipe<InT>::info( journaling::Traits<OutT>::new_list_node( spanList, d, "processor" ) );
+    }
+    # endif
 };
 
 template< typename OutT
@@ -649,13 +1773,217 @@ class Span<const OutT, InT> : public iObserver<OutT>
     // const, while intern type is supposed to be mutable
     static_assert( std::is_const<InT>::value
                  , "Spanning observer with mutable internal part." );
+    typedef ExtractionTraits<InT, const OutT> Extraction;
+    typedef typename std::remove_const<InT>::type InnerT;
+    /// Re-used buffer of the decoded chunk items.
+    std::vector<InnerT> _chunk;
+    /// Copy of inner pipe with cloned observers. Clones record the journal
+    /// entries on behalf of the originals into their own journals, which
+    /// are merged along with the state.
+    struct ClonePipe {
+        Pipe<InT> pipe;
+        std::vector<std::unique_ptr<iProcessor<InT> > > procs;
+        # ifndef PPT_DISABLE_JOUNRALING
+        std::vector<std::unique_ptr<typename journaling::Traits<InnerT>::Journal> > journals;
+        # endif
+    };
+    /// Pool for parallel evaluation (if set).
+    ThreadPool * _pool;
+    /// Clones in initial state, re-used for the chunks of next messages.
+    std::vector<std::unique_ptr<ClonePipe> > _spare;
+    /// Set when some of inner observers can not be cloned.
+    bool _serialOnly;
+
+    /// Returns copy of inner pipe with cloned observers, or null if some of
+    /// observers can not be cloned.
+    std::unique_ptr<ClonePipe> _clone_pipe() const {
+        std::unique_ptr<ClonePipe> cp( new ClonePipe() );
+        for( auto it = this->begin(); this->end() != it; ++it ) {
+            iProcessor<InT> * c = static_cast<iProcessor<InT> *>(*it)->clone();
+            if( !c ) return nullptr;
+            cp->procs.emplace_back( c );
+            cp->pipe.push_back( c );
+            # ifndef PPT_DISABLE_JOUNRALING
+            cp->journals.emplace_back( new typename journaling::Traits<InnerT>::Journal() );
+            c->assign_journal( *cp->journals.back() );
+            c->set_journal_issuer( (*it)->journal_issuer() );
+            # endif
+        }
+        return cp;
+    }
+
+    /// Checks that inner observers may be cloned; returns false otherwise.
+    bool _ensure_clones() {
+        if( _serialOnly ) return false;
+        if( !_spare.empty()
+         && _spare.front()->procs.size() == this->size() ) return true;
+        _spare.clear();
+        std::unique_ptr<ClonePipe> cp = _clone_pipe();
+        if( !cp ) {
+            _serialOnly = true;
+            return false;
+        }
+        _spare.push_back( std::move(cp) );
+        return true;
+    }
+
+    /// Moves state, counters and journal entries of the clones into inner
+    /// observers.
+    void _merge( ClonePipe & cp ) {
+        for( size_t i = 0; i < this->size(); ++i ) {
+            auto orig = static_cast<iProcessor<InT> *>((*this)[i]);
+            orig->merge( *cp.procs[i] );
+            # ifndef PIPET_DISABLE_STATS
+            orig->stats().merge( cp.procs[i]->stats() );
+            # endif
+            # ifndef PPT_DISABLE_JOUNRALING
+            if( orig->has_journal() ) {
+                orig->journal().append( *cp.journals[i] );
+            } else {
+                cp.journals[i]->clear();
+            }
+            # endif
+        }
+    }
+
+    /// Evaluates chunks concurrently, each on its own set of clones. The
+    /// clones state is merged in order of chunks, up to the lowest chunk
+    /// where the iteration was stopped, so the result is the same as for
+    /// serial evaluation.
+    typename Traits<const OutT>::Routing::ResultCode
+    _process_parallel( typename Traits<const OutT>::CRef m ) {
+        typedef typename Traits<InT>::Routing::ResultCode InnerRC;
+        const size_t none = size_t(-1);
+        std::atomic<size_t> nextChunk(0)
+                          , stopChunk(none)
+                          ;
+        InnerRC stopRc = 0;
+        // Evaluated chunks waiting for the preceding ones to be merged.
+        std::map<size_t, std::unique_ptr<ClonePipe> > done;
+        size_t nMerged = 0;
+        std::mutex mtx;
+        # ifndef PPT_DISABLE_JOUNRALING
+        const bool sampled = journaling::Sampling::sampled();
+        # endif
+        _pool->run( [&]( size_t ) {
+            # ifndef PPT_DISABLE_JOUNRALING
+            // Propagate the sampling decision made by the caller
+            const bool wasSampled = journaling::Sampling::sampled();
+            journaling::Sampling::sampled() = sampled;
+            ++journaling::Sampling::depth();
+            # endif
+            std::vector<InnerT> items;
+            for(;;) {
+                const size_t n = nextChunk.fetch_add(1);
+                // Chunks following the stopping one are not evaluated.
+                if( n > stopChunk.load() ) break;
+                items.clear();
+                if( !Extraction::decode_chunk( m, n, items ) ) break;
+                std::unique_ptr<ClonePipe> cp;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    if( !_spare.empty() ) {
+                        cp = std::move(_spare.back());
+                        _spare.pop_back();
+                    }
+                }
+                if( !cp ) cp = _clone_pipe();
+                InnerRC rc = 0
+                      , pipeRc = 0
+                      ;
+                bool stopped = false;
+                for( auto it = items.cbegin(); items.cend() != it; ++it ) {
+                    rc = _eval_pipe_on<InT>( &cp->pipe, *it, pipeRc );
+                    if( Traits<InT>::Routing::do_stop_iteration( rc ) ) {
+                        stopped = true;
+                        break;
+                    }
+                }
+                std::unique_lock<std::mutex> lock(mtx);
+                if( stopped && n < stopChunk.load() ) {
+                    stopChunk.store( n );
+                    stopRc = rc;
+                }
+                // Clones of the chunks following the stopping one are
+                // dropped with their state.
+                if( n > stopChunk.load() ) continue;
+                done.emplace( n, std::move(cp) );
+                for( auto it = done.begin()
+                   ; done.end() != it && nMerged == it->first
+                                      && nMerged <= stopChunk.load()
+                   ; it = done.erase(it), ++nMerged ) {
+                    _merge( *it->second );
+                    _spare.push_back( std::move(it->second) );
+                }
+            }
+            # ifndef PPT_DISABLE_JOUNRALING
+            --journaling::Sampling::depth();
+            journaling::Sampling::sampled() = wasSampled;
+            # endif
+        } );
+        return Traits<const OutT>::Routing::mark_intact(
+                        Extraction::translate_results(
+                                none != stopChunk.load() ? stopRc : 0 ) );
+    }
+
+    typename Traits<const OutT>::Routing::ResultCode
+    _process( typename Traits<const OutT>::CRef m, std::false_type ) {
+        return Extraction::process( m, *this );
+    }
+
+    typename Traits<const OutT>::Routing::ResultCode
+    _process( typename Traits<const OutT>::CRef m, std::true_type ) {
+        if( _pool && _pool->size() > 1 && _ensure_clones() ) {
+            return _process_parallel( m );
+        }
+        typename Traits<InT>::Routing::ResultCode rc = 0;
+        bool stop = false;
+        for( size_t n = 0; !stop; ++n ) {
+            _chunk.clear();
+            if( !Extraction::decode_chunk( m, n, _chunk ) ) break;
+            for( auto it = _chunk.cbegin(); _chunk.cend() != it; ++it ) {
+                rc = _eval_pipe_on<InT>( this, *it, this->_rc );
+                if( Traits<InT>::Routing::do_stop_iteration( rc ) ) {
+                    stop = true;
+                    break;
+                }
+            }
+        }
+        return Traits<const OutT>::Routing::mark_intact(
+                            Extraction::translate_results( stop ? rc : 0 ) );
+    }
 protected:
     virtual typename Traits<const OutT>::Routing::ResultCode
     _V_eval( typename Traits<const OutT>::CRef m ) override {
-        return ExtractionTraits<InT, const OutT>::process( m, *this );
+        return _process( m, aux::IsChunked<Extraction>() );
     }
 public:
-    Span( const Pipe<InT> & p ) : Pipe<InT>(p) {}
+    Span( const Pipe<InT> & p ) : Pipe<InT>(p), _pool(nullptr), _serialOnly(false) {}
+
+    /// Enables parallel evaluation of inner pipe on chunks of the container.
+    /// Requires chunked extraction traits and all the inner observers
+    /// to support `clone()'/`merge()', otherwise the evaluation is serial.
+    /// Upon stop-iteration code the result code and the observers state are
+    /// the same as for serial evaluation.
+    void set_thread_pool( ThreadPool * pool ) {
+        _pool = pool;
+        _spare.clear();
+        _serialOnly = false;
+    }
+
+    /// Walks the inner pipe.
+    virtual void walk_state( const std::function<void(checkpointing::Stateful &)> & f ) override {
+        Pipe<InT>::walk_state( f );
+    }
+
+    # ifndef PPT_DISABLE_JOUNRALING
+    /// Describes the inner pipe as nested processor of the "span" list.
+    virtual void info( typename journaling::Traits<OutT>::NodeRef d ) const override {
+        iObserver<OutT>::info(d);
+        auto spanList = journaling::Traits<OutT>::add_list( d, "span" );
+        Pipe<InT>::info( journaling::Traits<OutT>::new_list_node( spanList, d, "processor" ) );
+    }
+    # endif
 };
 
 //
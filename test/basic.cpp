@@ -180,5 +180,34 @@ BOOST_AUTO_TEST_CASE( LinearPipelineTC ) {
     }
 }
 
+BOOST_AUTO_TEST_CASE( OwningHandlersTC ) {
+    pipet::test::TestingArbiter ta;
+    pipet::test::TestingPipeline ppl;
+    pipet::test::Processor p1(0);
+    // Lvalue is referenced, temporaries and lambdas are owned by handlers
+    ppl.push_back( p1 );
+    ppl.push_back( pipet::test::Processor(1) );
+    ppl.push_back( pipet::test::Processor(2) );
+    int nCalls = 0;
+    ppl.push_back( [&nCalls]( pipet::test::Message & msg ) {
+            ++nCalls;
+            return int(msg.flags[3]);
+        } );
+
+    int n = pipet::test::TestingPipeline::TheHandlerTraits::process(
+            ta, ppl.upcast(), (pipet::test::Message *) pipet::test::gSrcMsgs );
+    BOOST_CHECK_EQUAL( 4, n );
+    BOOST_CHECK_EQUAL( 2, nCalls );
+
+    BOOST_CHECK_EQUAL( &p1, &ppl[0]->processor<pipet::test::Processor>() );
+    for( int i = 0; i < 3; ++i ) {
+        const auto & history = ppl[i]->processor<pipet::test::Processor>().ids_history();
+        BOOST_REQUIRE_EQUAL( history.size(), size_t(5 - i) );
+        for( size_t j = 0; j < history.size(); ++j ) {
+            BOOST_CHECK_EQUAL( pipet::test::pIDS[i][j], history[j] );
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
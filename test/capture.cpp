@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "capture.tcc"
+
+# include <chrono>
+# include <cstdio>
+# include <thread>
+
+/**This unit test checks that the stream captured at some point of pipeline
+ * is replayed in the same order, keeping (scaled) timing if requested.
+ * */
+
+namespace pipet {
+namespace aux {
+// Testing message is not trivially copyable; only its ID is recorded.
+template<>
+struct RecordTraits<test::Message> {
+    static size_t size( const test::Message & ) { return sizeof(int); }
+    static void pack( const test::Message & m, void * dest ) {
+        memcpy( dest, &m.id, sizeof(int) );
+    }
+    static void unpack( const void * src, size_t, test::Message & m ) {
+        memcpy( &m.id, src, sizeof(int) );
+        m.procPassed.clear();
+    }
+};
+}  // namespace aux
+
+namespace test {
+
+// Records odd messages of source, with 2ms interval.
+class CaptureFixture {
+protected:
+    std::string _path;
+public:
+    CaptureFixture() : _path("pipet-capture-test.bin") {
+        StreamRecorder<Message> r(_path);
+        Pipe<Message> p;
+        p.push_back( []( Message & m ) {
+                std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+                return bool(m.id % 2);
+            } );
+        p.push_back( r );
+        TestingSource2 src(20);
+        p <= src;
+        BOOST_REQUIRE_EQUAL( r.n_recorded(), 10 );
+    }
+    ~CaptureFixture() { remove( _path.c_str() ); }
+
+    /// Replays the file, checking the messages order.
+    typename StreamReplay<Message>::Report
+    replay( typename StreamReplay<Message>::Mode mode, double factor=1.
+          , double * targetRate=nullptr ) {
+        StreamReplay<Message> src( _path, mode, factor );
+        std::vector<int> ids;
+        Pipe<Message> p;
+        p.push_back( [&ids]( Message & m ) { ids.push_back( m.id ); return true; } );
+        p <= static_cast<interfaces::Source<Message> &>(src);
+        std::vector<int> expected = { 1, 3, 5, 7, 9, 11, 13, 15, 17, 19 };
+        BOOST_CHECK_EQUAL_COLLECTIONS( ids.begin(), ids.end()
+                                     , expected.begin(), expected.end() );
+        if( targetRate ) *targetRate = src.target_rate();
+        return src.report();
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_FIXTURE_TEST_SUITE( captureSuite, pipet::test::CaptureFixture )
+
+BOOST_AUTO_TEST_CASE( replayModes ) {
+    typedef pipet::StreamReplay<pipet::test::Message> Replay;
+    double target;
+    auto fast = replay( Replay::MaxSpeed, 1., &target );
+    BOOST_CHECK_EQUAL( fast.nMessages, 10 );
+    BOOST_CHECK_EQUAL( target, 0. );
+    BOOST_CHECK_EQUAL( fast.maxLag, 0 );
+    // Recorded interval is 2ms at least
+    BOOST_REQUIRE_GE( fast.recorded, 18000000 );
+
+    auto orig = replay( Replay::OriginalTiming, 1., &target );
+    BOOST_CHECK_GE( orig.elapsed, orig.recorded );
+    BOOST_CHECK_GT( target, 0. );
+    BOOST_CHECK_LE( orig.achieved_rate(), target );
+    BOOST_CHECK_LE( orig.maxLag, orig.elapsed );
+
+    auto scaled = replay( Replay::Scaled, 4., &target );
+    BOOST_CHECK_GE( scaled.elapsed, scaled.recorded/4 );
+    BOOST_CHECK_LT( scaled.elapsed, orig.elapsed );
+    BOOST_CHECK_GT( scaled.achieved_rate(), orig.achieved_rate() );
+}
+
+BOOST_AUTO_TEST_CASE( badFile ) {
+    {
+        FILE * f = fopen( "pipet-capture-bad.bin", "w" );
+        fputs( "not a capture file at all", f );
+        fclose( f );
+    }
+    BOOST_CHECK_THROW( pipet::StreamReplay<pipet::test::Message>( "pipet-capture-bad.bin" )
+                     , pipet::errors::Malfunction );
+    remove( "pipet-capture-bad.bin" );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
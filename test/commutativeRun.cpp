@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "commutative_run.tcc"
+
+/**This unit test checks that run of commutative discriminators gets
+ * re-ordered according to measured selectivity, while the overall result
+ * stays the same as for sequential application.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Rejects messages with id divisible by given number.
+class DivisibilityFilter {
+private:
+    int _div;
+public:
+    DivisibilityFilter( int div ) : _div(div) {}
+    bool operator()( Message & msg ) { return msg.id % _div; }
+    int divisor() const { return _div; }
+};
+
+// Collects ids of passed messages.
+class IDCollector : public std::vector<int> {
+public:
+    bool operator()( Message & msg ) { push_back( msg.id ); return true; }
+};
+
+// Accepts even ids, spinning for a while on each call.
+class SlowEvenFilter {
+public:
+    bool operator()( Message & msg ) {
+        auto t0 = std::chrono::steady_clock::now();
+        while( std::chrono::steady_clock::now() - t0
+                < std::chrono::microseconds(5) ) {}
+        return !(msg.id % 2);
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( commutativeRunSuite )
+
+BOOST_AUTO_TEST_CASE( selectivityReordering ) {
+    using namespace ::pipet::test;
+    // Least selective filter goes first.
+    DivisibilityFilter f7(7), f3(3), f2(2);
+    // No cost measurement, so ordering depends on selectivity only.
+    pipet::CommutativeRun<Message> run( 100, 0 );
+    run.push_back( f7 );
+    run.push_back( f3 );
+    run.push_back( f2 );
+
+    pipet::Pipe<Message> p;
+    IDCollector passed;
+    p.push_back( run );
+    p.push_back( passed );
+
+    TestingSource2 src(1000);
+    p <= src;
+
+    BOOST_CHECK_GE( run.n_reorders(), 9 );
+    // Most selective filter has to be applied first.
+    BOOST_CHECK_EQUAL( run[0].processor<DivisibilityFilter>().divisor(), 2 );
+    BOOST_CHECK_EQUAL( run[1].processor<DivisibilityFilter>().divisor(), 3 );
+    BOOST_CHECK_EQUAL( run[2].processor<DivisibilityFilter>().divisor(), 7 );
+    // Results are the same as for any fixed order.
+    std::vector<int> expected;
+    for( int i = 1; i <= 1000; ++i ) {
+        if( i % 2 && i % 3 && i % 7 ) expected.push_back(i);
+    }
+    BOOST_CHECK_EQUAL_COLLECTIONS( passed.begin(), passed.end()
+                                 , expected.begin(), expected.end() );
+}
+
+// Slow filter placed after the one rejecting all the timed messages never
+// gets timed itself; it should not be moved ahead of the cheap one each time
+// its previous measurement is forgotten.
+BOOST_AUTO_TEST_CASE( untimedFilterOrderStable ) {
+    using namespace ::pipet::test;
+    DivisibilityFilter f16(16);
+    SlowEvenFilter slow;
+    pipet::CommutativeRun<Message> run( 64, 16 );
+    run.push_back( f16 );
+    run.push_back( slow );
+
+    size_t nReorders = 0
+         , nFlips = 0
+         ;
+    pipet::CommutativeRun<Message>::Filter * first = &run[0];
+    for( int i = 1; i <= 64*40; ++i ) {
+        Message msg(i);
+        run( msg );
+        if( run.n_reorders() == nReorders ) continue;
+        nReorders = run.n_reorders();
+        // first re-orderings settle the measurements
+        if( nReorders > 2 && first != &run[0] ) ++nFlips;
+        first = &run[0];
+    }
+    BOOST_CHECK_EQUAL( nFlips, 0 );
+    BOOST_CHECK_EQUAL( run[0].processor<DivisibilityFilter>().divisor(), 16 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
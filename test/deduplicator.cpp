@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "deduplicator.tcc"
+
+# include <chrono>
+# include <random>
+# include <thread>
+# include <unordered_map>
+
+/**This unit test checks that deduplicating handler drops the duplicates
+ * within the horizon, forgets the keys beyond it and keeps the memory
+ * bounded.
+ * */
+
+namespace pipet {
+namespace test {
+
+static int message_key( const Message & m ) { return m.id; }
+
+// Evaluates handler on message with given ID.
+template<typename HandlerT> bool
+pass( HandlerT & h, int id ) {
+    Message m;
+    m.id = id;
+    return h( m );
+}
+
+}  // namespace test
+}  // namespace pipet
+
+using pipet::test::Message;
+using pipet::test::pass;
+
+BOOST_AUTO_TEST_SUITE( deduplicatorSuite )
+
+BOOST_AUTO_TEST_CASE( countHorizon ) {
+    // Horizon of 100 messages, 4 generations of 34 keys
+    pipet::Deduplicator<Message, int> d( pipet::test::message_key, 100 );
+    for( int i = 0; i < 500; ++i ) {
+        BOOST_CHECK( pass( d, i ) );
+    }
+    // Recent ones are dropped...
+    for( int i = 400; i < 500; ++i ) {
+        BOOST_CHECK( !pass( d, i ) );
+    }
+    // ...and old ones are forgotten
+    for( int i = 0; i < 300; ++i ) {
+        BOOST_CHECK( pass( d, i ) );
+    }
+    BOOST_CHECK_EQUAL( d.n_passed(), 800 );
+    BOOST_CHECK_EQUAL( d.n_dropped(), 100 );
+}
+
+BOOST_AUTO_TEST_CASE( matchesExactWithinHorizon ) {
+    // Compare with unbounded reference on random keys: duplicates within
+    // horizon are always dropped, and beyond the horizon plus one
+    // generation are always passed.
+    const size_t horizon = 1000;
+    pipet::Deduplicator<Message, int> d( pipet::test::message_key, horizon, 5 );
+    const size_t slack = d.key_set().per_generation()
+               , nBytes = d.key_set().n_bytes()
+               ;
+    std::mt19937 rng(1337);
+    std::vector<int> passed;  // keys in order they have passed
+    std::unordered_map<int, size_t> lastPassed;
+    size_t nWithin = 0, nBeyond = 0;
+    for( size_t i = 0; i < 200000; ++i ) {
+        int k = rng() % 20000;
+        auto it = lastPassed.find( k );
+        bool p = pass( d, k );
+        if( lastPassed.end() != it ) {
+            const size_t age = passed.size() - it->second;
+            if( age <= horizon ) {
+                BOOST_REQUIRE( !p );
+                ++nWithin;
+            } else if( age > horizon + slack ) {
+                BOOST_REQUIRE( p );
+                ++nBeyond;
+            }
+        }
+        if( p ) {
+            lastPassed[k] = passed.size();
+            passed.push_back( k );
+        }
+    }
+    BOOST_CHECK_GT( nWithin, 0 );
+    BOOST_CHECK_GT( nBeyond, 0 );
+    // Memory is allocated once
+    BOOST_CHECK_EQUAL( d.key_set().n_bytes(), nBytes );
+    BOOST_CHECK_GT( d.key_set().n_rotations(), 100 );
+}
+
+BOOST_AUTO_TEST_CASE( timeWindow ) {
+    pipet::Deduplicator<Message, int> d( pipet::test::message_key
+                                       , std::chrono::milliseconds(40), 1000 );
+    BOOST_CHECK( pass( d, 1 ) );
+    BOOST_CHECK( pass( d, 2 ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds(5) );
+    BOOST_CHECK( !pass( d, 1 ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds(80) );
+    BOOST_CHECK( pass( d, 2 ) );
+    BOOST_CHECK_EQUAL( d.n_early_rotations(), 0 );
+    // Too many keys within window shrink the horizon
+    for( int i = 100; i < 3000; ++i ) pass( d, i );
+    BOOST_CHECK_GT( d.n_early_rotations(), 0 );
+    BOOST_CHECK( pass( d, 100 ) );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
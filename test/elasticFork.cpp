@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "elastic_fork.tcc"
+
+# include <chrono>
+# include <thread>
+
+/**This unit test checks that elastic fork adds workers while the backlog
+ * builds up, retires them once the load drops and merges the state of
+ * retired handler clones, so no message is lost in accounting.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Slow stateful handler, merged on clone retirement.
+struct SlowCounter {
+    size_t n;
+    std::chrono::microseconds delay;
+    SlowCounter( std::chrono::microseconds d ) : n(0), delay(d) {}
+    bool operator()( Message & ) {
+        std::this_thread::sleep_for( delay );
+        ++n;
+        return true;
+    }
+    void merge( SlowCounter & o ) {
+        n += o.n;
+        o.n = 0;
+    }
+};
+
+// Source emitting messages with given period.
+class PacedSource : public interfaces::Source<Message> {
+private:
+    TestingSource2 _src;
+    std::chrono::microseconds _period;
+public:
+    PacedSource( size_t n, std::chrono::microseconds period ) : _src(n)
+                                                             , _period(period) {}
+    virtual Message * get() override {
+        std::this_thread::sleep_for( _period );
+        return _src.get();
+    }
+    virtual void release( Message * m ) override { _src.release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+};
+
+struct PassedCounter {
+    size_t n;
+    PassedCounter() : n(0) {}
+    bool operator()( Message & ) { ++n; return true; }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( elasticForkSuite )
+
+BOOST_AUTO_TEST_CASE( growsAndShrinks ) {
+    typedef pipet::ElasticFork<pipet::test::Message, pipet::test::SlowCounter> Fork;
+    Fork::Policy policy(1, 4);
+    policy.window = std::chrono::milliseconds(2);
+    Fork f( pipet::test::SlowCounter( std::chrono::microseconds(200) )
+          , policy, 256 );
+    pipet::test::PassedCounter passed;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( f );
+    p.push_back( passed );
+    // Backlog: workers have to be added up to maximum
+    pipet::test::TestingSource2 burst(2000);
+    p <= burst;
+    BOOST_CHECK_EQUAL( f.fork_stats().peakWorkers, 4 );
+    BOOST_CHECK_EQUAL( f.n_workers(), 4 );
+    BOOST_CHECK_EQUAL( passed.n, 2000 );
+    // Sparse messages: workers have to be retired down to minimum
+    pipet::test::PacedSource sparse( 150, std::chrono::microseconds(1000) );
+    p <= static_cast<pipet::interfaces::Source<pipet::test::Message> &>(sparse);
+    BOOST_CHECK_EQUAL( f.n_workers(), 1 );
+    BOOST_CHECK_EQUAL( passed.n, 2150 );
+    BOOST_CHECK_GE( f.fork_stats().nRetired, 3 );
+    // All the clones state has to be merged
+    BOOST_CHECK_EQUAL( f.collect().n, 2150 );
+    BOOST_CHECK_EQUAL( f.fork_stats().nRetired, f.fork_stats().nSpawned );
+    BOOST_CHECK_EQUAL( f.fork_stats().nProcessed, 2150 );
+}
+
+BOOST_AUTO_TEST_CASE( statelessClones ) {
+    // Handler with no merge() method; discarded messages are released.
+    auto oddOnly = []( pipet::test::Message & m ) { return bool(m.id % 2); };
+    pipet::ElasticFork<pipet::test::Message, decltype(oddOnly)> f( oddOnly
+            , decltype(f)::Policy(2, 3), 64 );
+    pipet::test::PassedCounter passed;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( f );
+    p.push_back( passed );
+    pipet::test::TestingSource2 src(1000);
+    p <= src;
+    BOOST_CHECK_EQUAL( passed.n, 500 );
+    BOOST_CHECK_GE( f.n_workers(), 2 );
+    f.collect();
+    BOOST_CHECK_EQUAL( f.n_workers(), 0 );
+    BOOST_CHECK_EQUAL( f.fork_stats().nProcessed, 1000 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
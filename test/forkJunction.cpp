@@ -49,16 +49,17 @@ namespace test {
 class PipelineTestingFixture {
 protected:
     pipet::GenericArbiter<int> _a;
+    aux::MessagePool<Message> _pool;
     OrderCheck _oc[4];
     ForkMimic _fork2
             , _fork3
             , _fork4
             ;
 public:
-    PipelineTestingFixture() : _fork2(2, 12)
-                             , _fork3(3, 13)
-                             , _fork4(4, 14)
-                             , _oc{ {1}, {2}, {3}, {4} } {}
+    PipelineTestingFixture() : _oc{ {1}, {2}, {3}, {4} }
+                             , _fork2(2, 12, &_pool)
+                             , _fork3(3, 13, &_pool)
+                             , _fork4(4, 14, &_pool) {}
     ~PipelineTestingFixture() {}
 };
 
@@ -103,7 +104,7 @@ BOOST_AUTO_TEST_CASE( singularPropagation
     pipet::Pipe<pipet::test::Message> mf;
     mf.push_back( _oc[0] );
     for( size_t nMsgsMax = 1; nMsgsMax < 30; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         // Check that ALL the messages have passed throught the pipe.
@@ -118,7 +119,7 @@ BOOST_AUTO_TEST_CASE( singularPropagationPull
     pipet::Pipe<pipet::test::Message> mf;
     mf.push_back( _oc[0] );
     for( size_t nMsgsMax = 1; nMsgsMax < 30; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         for( size_t n = 0; n < nMsgsMax; ++n ) {
             pipet::test::Message msg;
             pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
@@ -141,7 +142,7 @@ BOOST_AUTO_TEST_CASE( simplePropagation
     mf.push_back( _oc[1] );
     mf.push_back( _oc[2] );
     for( size_t nMsgsMax = 1; nMsgsMax < 30; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         // Check that ALL the messages have passed throught the pipe.
@@ -164,7 +165,7 @@ BOOST_AUTO_TEST_CASE( simpleFork2
     mf.push_back( _fork2 );
     mf.push_back( _oc[1] );
     for( size_t nMsgsMax = 2; nMsgsMax < 10; nMsgsMax += 2 ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         // Check that ALL the messages have passed through the pipe.
@@ -185,7 +186,7 @@ BOOST_AUTO_TEST_CASE( simpleFork3
     mf.push_back( _fork3 );
     mf.push_back( _oc[1] );
     for( size_t nMsgsMax = 3; nMsgsMax < 15; nMsgsMax += 3 ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         // Check that ALL the messages have passed through the pipe.
@@ -206,7 +207,7 @@ BOOST_AUTO_TEST_CASE( simpleFork4
     mf.push_back( _fork4 );
     mf.push_back( _oc[1] );
     for( size_t nMsgsMax = 4; nMsgsMax < 20; nMsgsMax += 4 ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         BOOST_CHECK_EQUAL( nMsgsMax, _oc[0].latest_id() );
@@ -227,7 +228,7 @@ BOOST_AUTO_TEST_CASE( singleFork
     mf.push_back( _fork4 );
     mf.push_back( _oc[1] );
     for( size_t nMsgsMax = 1; nMsgsMax < 12; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         BOOST_CHECK_EQUAL( nMsgsMax, _oc[0].latest_id() );
@@ -252,7 +253,7 @@ BOOST_AUTO_TEST_CASE( singleForkPull
     mf.push_back( _fork4 );
     mf.push_back( _oc[1] );
     for( size_t nMsgsMax = 1; nMsgsMax < 12; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         for( size_t n = 0; n < nMsgsMax; ++n ) {
             pipet::test::Message msg;
             pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
@@ -268,6 +269,66 @@ BOOST_AUTO_TEST_CASE( singleForkPull
     }
 }
 
+// Same as singleForkPull, but with greedy arbiter: fork has to be filled
+// before emitting messages, unless the source is depleted.
+BOOST_AUTO_TEST_CASE( greedyForkPull
+                    , *boost::unit_test::depends_on("forkJunctionLogicSuite/singleForkPull") ) {
+    pipet::Pipe<pipet::test::Message> mf;
+    mf.push_back( _oc[0] );
+    mf.push_back( _fork4 );
+    mf.push_back( _oc[1] );
+    pipet::GenericArbiter<int> a( true );
+    BOOST_REQUIRE( a.is_greedy() );
+    for( size_t nMsgsMax = 1; nMsgsMax < 12; ++nMsgsMax ) {
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
+        for( size_t n = 0; n < nMsgsMax; ++n ) {
+            pipet::test::Message msg;
+            pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
+                a, mf.upcast(), src, msg );
+            BOOST_CHECK_EQUAL( n + 1, msg.id );
+            // Upstream handler is ahead, up to the fork's capacity
+            BOOST_CHECK_EQUAL( std::min( nMsgsMax, (n/4 + 1)*4 )
+                             , _oc[0].latest_id() );
+        }
+        BOOST_CHECK_EQUAL( nMsgsMax, _oc[1].latest_id() );
+        BOOST_CHECK_EQUAL( nMsgsMax >= 4, _fork4.was_full() );
+        _oc[0].reset();
+        _oc[1].reset();
+        _fork4.reset();
+    }
+}
+
+// Same as greedyForkPull, but messages come from the pool foreign to the
+// fork, so it copies their content (`Absorbed'): originals have to be
+// released to the source while the fork is being filled.
+BOOST_AUTO_TEST_CASE( greedyForkPullAbsorbed
+                    , *boost::unit_test::depends_on("forkJunctionLogicSuite/greedyForkPull") ) {
+    pipet::Pipe<pipet::test::Message> mf;
+    mf.push_back( _oc[0] );
+    mf.push_back( _fork4 );
+    mf.push_back( _oc[1] );
+    pipet::GenericArbiter<int> a( true );
+    pipet::aux::MessagePool<pipet::test::Message> srcPool(2);
+    for( size_t nMsgsMax = 1; nMsgsMax < 12; ++nMsgsMax ) {
+        pipet::test::TestingSource2 src(nMsgsMax, &srcPool);
+        for( size_t n = 0; n < nMsgsMax; ++n ) {
+            pipet::test::Message msg;
+            pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
+                a, mf.upcast(), src, msg );
+            BOOST_CHECK_EQUAL( n + 1, msg.id );
+            BOOST_CHECK_EQUAL( std::min( nMsgsMax, (n/4 + 1)*4 )
+                             , _oc[0].latest_id() );
+        }
+        BOOST_CHECK_EQUAL( nMsgsMax, _oc[1].latest_id() );
+        _oc[0].reset();
+        _oc[1].reset();
+        _fork4.reset();
+    }
+    // No source messages were kept or lost
+    BOOST_CHECK_EQUAL( srcPool.n_free(), srcPool.n_slots() );
+    BOOST_CHECK_EQUAL( srcPool.n_slots(), 2 );
+}
+
 // Like singularPropagation TC but with fork. Checks that single f/j node can
 // be adequately processed.
 BOOST_AUTO_TEST_CASE( standaloneFork
@@ -275,7 +336,7 @@ BOOST_AUTO_TEST_CASE( standaloneFork
     pipet::Pipe<pipet::test::Message> mf;
     mf.push_back( _fork4 );
     for( size_t nMsgsMax = 1; nMsgsMax < 11; ++nMsgsMax ) {  // todo: < 12
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         if( nMsgsMax >= 4 ) {
@@ -297,7 +358,7 @@ BOOST_AUTO_TEST_CASE( forks3to2
     mf.push_back( _oc[1] );
 
     for( size_t nMsgsMax = 1; nMsgsMax < 4; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         BOOST_CHECK_EQUAL( nMsgsMax, _oc[0].latest_id() );
@@ -329,7 +390,7 @@ BOOST_AUTO_TEST_CASE( forks2to3
     mf.push_back( _oc[1] );
 
     for( size_t nMsgsMax = 1; nMsgsMax < 30; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         // Check that ALL the messages have passed throught the pipe.
@@ -356,7 +417,7 @@ BOOST_AUTO_TEST_CASE( combinedForks
     mf.push_back( _oc[3] );
 
     for( size_t nMsgsMax = 1; nMsgsMax < 30; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
             _a, mf.upcast(), src );
         // Check that ALL the messages have passed throught the pipe.
@@ -403,7 +464,7 @@ BOOST_AUTO_TEST_CASE( combinedForksPull
     mf.push_back( _oc[3] );
 
     for( size_t nMsgsMax = 1; nMsgsMax < 30; ++nMsgsMax ) {
-        pipet::test::TestingSource2 src(nMsgsMax);
+        pipet::test::TestingSource2 src(nMsgsMax, &_pool);
         for( size_t n = 0; n < nMsgsMax; ++n ) {
             pipet::test::Message msg;
             pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
@@ -42,6 +42,12 @@ struct ProcessorClass {
     int operator()( double & val ) { _some++; return val > 0 ? 1 : -1; }
 };
 
+// Processor of considerable size.
+struct BulkyProcessor {
+    double table[64];
+    int operator()( double & val ) { return val > table[0] ? 1 : -1; }
+};
+
 struct ComplicatedHandlerResult {
     bool a, b;
 };
@@ -118,6 +124,39 @@ BOOST_AUTO_TEST_CASE( WrappingHandlers, * boost::unit_test::depends_on("Pipeline
     BOOST_CHECK( p1._some == 2 );
 }
 
+// This case checks that referencing handler does not reserve the room for
+// the callable, while the owning one keeps it within the handler instance.
+BOOST_AUTO_TEST_CASE( CallableStorageLayout ) {
+    typedef pipet::PrimitiveHandler< double
+                                   , int
+                                   , pipet::test::BulkyProcessor > RefHandler;
+    typedef pipet::PrimitiveHandler< double
+                                   , int
+                                   , pipet::test::BulkyProcessor
+                                   , pipet::iBasicHandler
+                                   , true > OwningHandler;
+    BOOST_CHECK_LT( sizeof(RefHandler), sizeof(pipet::test::BulkyProcessor) );
+    BOOST_CHECK_GE( sizeof(OwningHandler), sizeof(pipet::test::BulkyProcessor) );
+    double someVal = 1.;
+    pipet::test::BulkyProcessor p;
+    p.table[0] = 0.;
+    RefHandler h1( p );
+    BOOST_CHECK( !h1.owns_callable() );
+    BOOST_CHECK_EQUAL( &p, &h1.processor() );
+    BOOST_CHECK_EQUAL( h1.process( someVal ), 1 );
+    pipet::test::BulkyProcessor tmp;
+    tmp.table[0] = 2.;
+    OwningHandler h2( std::move(tmp) );
+    BOOST_CHECK( h2.owns_callable() );
+    BOOST_CHECK_EQUAL( h2.process( someVal ), -1 );
+    // Both are accessible via the abstract handler
+    pipet::iBasicHandler<double, int> & ah1 = h1
+                                    , & ah2 = h2
+                                    ;
+    BOOST_CHECK_EQUAL( &p, &ah1.processor<pipet::test::BulkyProcessor>() );
+    BOOST_CHECK_EQUAL( &h2.processor(), &ah2.processor<pipet::test::BulkyProcessor>() );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
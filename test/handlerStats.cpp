@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+
+/**This unit test checks the instrumentation: numbers of messages passed,
+ * rejected and held by handlers have to be accounted once the
+ * instrumentation is enabled at runtime, and latency of messages stamped by
+ * source has to be recorded at the end of chain.
+ * */
+
+BOOST_AUTO_TEST_SUITE( handlerStatsSuite )
+
+# ifndef PIPET_DISABLE_STATS
+BOOST_AUTO_TEST_CASE( countersAccounting ) {
+    pipet::test::FilteringProcessor f({2, 4, 6});
+    pipet::test::ForkMimic fork(2);
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( f );
+    p.push_back( fork );
+    // Disabled instrumentation does not account anything.
+    {
+        pipet::test::TestingSource2 src(4);
+        p <= src;
+    }
+    BOOST_CHECK_EQUAL( pipet::stats_snapshot(p)[0].nCalls, 0 );
+    pipet::stats::enable();
+    {
+        pipet::test::TestingSource2 src(10);
+        p <= src;
+    }
+    pipet::stats::enable( false );
+    auto s = pipet::stats_snapshot(p);
+    BOOST_REQUIRE_EQUAL( s.size(), 2 );
+    BOOST_CHECK_EQUAL( s[0].nCalls, 10 );
+    BOOST_CHECK_EQUAL( s[0].nPassed, 7 );
+    BOOST_CHECK_EQUAL( s[0].nRejected, 3 );
+    // Fork holds all the messages, passing further each second one.
+    BOOST_CHECK_EQUAL( s[1].nCalls, 7 );
+    BOOST_CHECK_EQUAL( s[1].nPassed, 3 );
+    BOOST_CHECK_EQUAL( s[1].nRejected, 0 );
+    uint64_t nTimed = 0;
+    for( size_t i = 0; i < pipet::stats::nLatencyBuckets; ++i ) {
+        nTimed += s[0].latency[i];
+    }
+    BOOST_CHECK_EQUAL( nTimed, 10 );
+    BOOST_CHECK_GT( s[0].latency_percentile(.99), 0 );
+}
+# endif
+
+// Log-linear histogram has to estimate percentiles with bounded relative
+// error.
+BOOST_AUTO_TEST_CASE( latencyHistogram ) {
+    pipet::stats::LatencyHistogram h;
+    for( uint64_t v = 1; v <= 100000; ++v ) {
+        h.record( v );
+    }
+    BOOST_CHECK_EQUAL( h.count(), 100000 );
+    BOOST_CHECK_CLOSE( double(h.percentile(.5)), 50000., 100./16 );
+    BOOST_CHECK_CLOSE( double(h.percentile(.99)), 99000., 100./16 );
+    BOOST_CHECK_CLOSE( double(h.percentile(.999)), 99900., 100./16 );
+    BOOST_CHECK_EQUAL( h.percentile(0), 1 );
+}
+
+// Messages stamped by source have their latency recorded once they have
+// passed the whole chain or are pulled.
+BOOST_AUTO_TEST_CASE( endToEndLatency ) {
+    pipet::stats::LatencyHistogram h;
+    pipet::GenericArbiter<int> a;
+    a.set_latency_histogram( &h );
+    pipet::test::FilteringProcessor f({2, 4, 6});
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( f );
+    {
+        pipet::test::TestingSource2 src(10);
+        pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
+                a, p.upcast(), src );
+    }
+    BOOST_CHECK_EQUAL( h.count(), 7 );
+    {
+        pipet::test::TestingSource2 src(10);
+        pipet::test::Message msg;
+        pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
+                a, p.upcast(), src, msg );
+        BOOST_CHECK_EQUAL( msg.id, 1 );
+        BOOST_CHECK_GT( msg.seqID, 0 );
+    }
+    BOOST_CHECK_EQUAL( h.count(), 8 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "hot_pipeline.tcc"
+
+# include <thread>
+
+/**This unit test checks re-configuration of the pipeline while it is being
+ * evaluated: handlers inserted/replaced in the middle of the stream have to
+ * take effect from the next message, and removed handlers have to be deleted
+ * only once no processing loop may refer them.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Counts messages passed.
+class Counter {
+private:
+    std::atomic<size_t> _n;
+public:
+    Counter() : _n(0) {}
+    bool operator()( Message & ) { ++_n; return true; }
+    size_t n() const { return _n.load(); }
+};
+
+// Inserts given handler into the pipe once message with certain id comes.
+class Reconfigurer {
+private:
+    HotPipe<Message> & _p;
+    Counter & _toInsert;
+    int _triggerID;
+public:
+    Reconfigurer( HotPipe<Message> & p, Counter & c, int id )
+            : _p(p), _toInsert(c), _triggerID(id) {}
+    bool operator()( Message & msg ) {
+        if( msg.id == _triggerID ) {
+            _p.push_back( _toInsert );
+        }
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( hotPipelineSuite )
+
+// Handler appended by handler itself has to be applied starting from the next
+// message; previous chain version must not be deleted while the loop refers
+// it.
+BOOST_AUTO_TEST_CASE( selfReconfiguration ) {
+    pipet::HotPipe<pipet::test::Message> p;
+    pipet::test::Counter c1, c2;
+    pipet::test::Reconfigurer r( p, c2, 4 );
+    p.push_back( c1 );
+    p.push_back( r );
+    pipet::test::TestingSource2 src(10);
+    p <= src;
+    BOOST_CHECK_EQUAL( c1.n(), 10 );
+    BOOST_CHECK_EQUAL( c2.n(), 6 );
+    BOOST_CHECK_EQUAL( p.size(), 3 );
+    // No loops are active, so everything retired may be deleted.
+    p.collect();
+    p.erase( 2 );
+    BOOST_CHECK_EQUAL( p.size(), 2 );
+}
+
+// Handlers are replaced on concurrent thread while pipe streams messages.
+// Each message has to be counted exactly once by one of the replaced
+// handlers.
+BOOST_AUTO_TEST_CASE( concurrentReplacement
+                    , *boost::unit_test::depends_on("hotPipelineSuite/selfReconfiguration") ) {
+    const size_t nMsgs = 200000;
+    pipet::HotPipe<pipet::test::Message> p;
+    pipet::test::Counter first, cs[2], last;
+    p.push_back( first );
+    p.push_back( cs[0] );
+    p.push_back( last );
+    std::atomic<bool> done(false);
+    std::thread writer( [&]() {
+        size_t n = 0;
+        while( !done.load() ) {
+            p.replace( 1, cs[++n % 2] );
+            std::this_thread::yield();
+        }
+    } );
+    pipet::test::TestingSource2 src(nMsgs);
+    p <= src;
+    done.store( true );
+    writer.join();
+    BOOST_CHECK_EQUAL( first.n(), nMsgs );
+    BOOST_CHECK_EQUAL( last.n(), nMsgs );
+    BOOST_CHECK_EQUAL( cs[0].n() + cs[1].n(), nMsgs );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
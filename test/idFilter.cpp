@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "id_filter.tcc"
+
+# include <random>
+# include <set>
+
+/**This unit test checks the ID discrimination handler: lookups with all the
+ * backends have to agree with the reference set, and the set has to be
+ * replaceable while the filter is evaluated.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Checks single and batched lookups against the reference set.
+template<typename KeyT>
+void check_id_set( const aux::IDSet<KeyT> & s
+                 , const std::set<KeyT> & ref
+                 , const std::vector<KeyT> & probes ) {
+    BOOST_CHECK_EQUAL( s.size(), ref.size() );
+    std::unique_ptr<bool[]> out( new bool [probes.size()] );
+    s.contains( probes.data(), probes.size(), out.get() );
+    for( size_t i = 0; i < probes.size(); ++i ) {
+        const bool expected = ref.count( probes[i] );
+        BOOST_CHECK_EQUAL( s.contains( probes[i] ), expected );
+        BOOST_CHECK_EQUAL( out[i], expected );
+    }
+}
+
+template<typename KeyT>
+void check_id_set( const std::vector<KeyT> & ids
+                 , const std::vector<KeyT> & probes
+                 , typename aux::IDSet<KeyT>::Backend expectedBackend ) {
+    std::set<KeyT> ref( ids.begin(), ids.end() );
+    aux::IDSet<KeyT> s( ids );
+    BOOST_CHECK_EQUAL( s.backend(), expectedBackend );
+    check_id_set( s, ref, probes );
+    aux::IDSet<KeyT> sb( ids, true );
+    BOOST_CHECK_EQUAL( sb.has_bloom(), aux::IDSet<KeyT>::FlatHash == expectedBackend );
+    check_id_set( sb, ref, probes );
+}
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( idFilterSuite )
+
+BOOST_AUTO_TEST_CASE( idSetBackends ) {
+    std::mt19937_64 rng(1337);
+    // Dense range of channels, including negative ones
+    {
+        std::vector<int> ids, probes;
+        for( int i = -500; i < 500; ++i ) {
+            if( rng() % 3 == 0 ) ids.push_back( i );
+            probes.push_back( i );
+        }
+        probes.push_back( std::numeric_limits<int>::min() );
+        probes.push_back( std::numeric_limits<int>::max() );
+        pipet::test::check_id_set( ids, probes, pipet::aux::IDSet<int>::Bitmap );
+    }
+    // Sparse 64-bit IDs
+    {
+        std::vector<uint64_t> ids, probes;
+        for( int i = 0; i < 5000; ++i ) {
+            ids.push_back( rng() );
+            probes.push_back( i % 2 ? ids.back() : rng() );
+        }
+        // The vacant slot marker must not clash with IDs
+        ids.push_back( UINT64_MAX );
+        probes.push_back( UINT64_MAX );
+        probes.push_back( UINT64_MAX - 1 );
+        pipet::test::check_id_set( ids, probes, pipet::aux::IDSet<uint64_t>::FlatHash );
+    }
+    // Empty set
+    pipet::test::check_id_set( std::vector<int>(), std::vector<int>{ 0, 1, -1 }
+                             , pipet::aux::IDSet<int>::Bitmap );
+}
+
+BOOST_AUTO_TEST_CASE( filterInPipeline ) {
+    pipet::IDFilter<pipet::test::Message, int> f(
+            []( const pipet::test::Message & m ) { return m.id; }
+            , { 2, 3, 5, 7, 11, 13 } );
+    std::vector<int> passed;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( f );
+    p.push_back( [&passed]( pipet::test::Message & m ) {
+            passed.push_back( m.id );
+            return true;
+        } );
+    {
+        pipet::test::TestingSource2 src(15);
+        p <= src;
+        std::vector<int> expected = { 1, 4, 6, 8, 9, 10, 12, 14, 15 };
+        BOOST_CHECK_EQUAL_COLLECTIONS( passed.begin(), passed.end()
+                                     , expected.begin(), expected.end() );
+    }
+    // Replace the set and check batched evaluation
+    f.assign( { 1, 15 } );
+    BOOST_CHECK_EQUAL( f.size(), 2 );
+    std::vector<pipet::test::Message> msgs(15);
+    std::vector<pipet::test::Message *> ptrs;
+    for( size_t i = 0; i < msgs.size(); ++i ) {
+        msgs[i].id = i + 1;
+        ptrs.push_back( &msgs[i] );
+    }
+    std::unique_ptr<bool[]> pass( new bool [ptrs.size()] );
+    BOOST_CHECK_EQUAL( f.select( ptrs.data(), ptrs.size(), pass.get() ), 13 );
+    BOOST_CHECK( !pass[0] );
+    BOOST_CHECK( pass[1] );
+    BOOST_CHECK( !pass[14] );
+}
+
+BOOST_AUTO_TEST_CASE( concurrentReplacement ) {
+    // Filter keeps only the IDs of current "generation", that is replaced
+    // by another thread while evaluating.
+    pipet::IDFilter<pipet::test::Message, int> f(
+            []( const pipet::test::Message & m ) { return m.id; }
+            , { 0 }, true );
+    std::atomic<bool> stop(false);
+    std::thread writer( [&]() {
+        for( int g = 1; !stop; g = g % 4 + 1 ) {
+            std::vector<int> ids;
+            for( int i = 0; i < 1000; ++i ) ids.push_back( i*g );
+            f.assign( ids );
+        }
+    } );
+    pipet::test::Message m;
+    size_t nPassed = 0;
+    for( int i = 0; i < 100000; ++i ) {
+        m.id = i % 4000;
+        nPassed += f( m );
+    }
+    stop = true;
+    writer.join();
+    BOOST_CHECK( f.keeps_listed() );
+    BOOST_CHECK_LT( nPassed, 100000 );
+}
+
+BOOST_AUTO_TEST_CASE( interleavedInstances ) {
+    // Several filters evaluated in turn by the same threads have to use
+    // their own readers.
+    typedef pipet::IDFilter<pipet::test::Message, int> Filter;
+    auto getKey = []( const pipet::test::Message & m ) { return m.id; };
+    std::vector<std::unique_ptr<Filter> > filters;
+    for( int n = 0; n < 20; ++n ) {
+        std::vector<int> ids;
+        for( int i = 0; i < 100; i += n + 2 ) ids.push_back( i );
+        filters.emplace_back( new Filter( getKey, ids, true ) );
+    }
+    std::atomic<size_t> nErrors(0);
+    std::vector<std::thread> threads;
+    for( int t = 0; t < 4; ++t ) {
+        threads.emplace_back( [&]() {
+            pipet::test::Message m;
+            for( int i = 0; i < 1000; ++i ) {
+                m.id = i % 100;
+                for( size_t n = 0; n < filters.size(); ++n ) {
+                    if( (*filters[n])( m ) != !(m.id % (n + 2)) ) ++nErrors;
+                }
+                // set is replaced with the same one to get readers involved
+                if( i % 100 == 0 ) {
+                    std::vector<int> ids;
+                    for( int j = 0; j < 100; j += 2 ) ids.push_back( j );
+                    filters[0]->assign( ids );
+                }
+            }
+        } );
+    }
+    for( auto & t : threads ) t.join();
+    BOOST_CHECK_EQUAL( nErrors.load(), 0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "key_router.tcc"
+
+# include <atomic>
+# include <map>
+# include <thread>
+
+/**This unit test checks the key-partitioned routing: messages with the same
+ * key have to be processed on the same thread in order of their arrival, and
+ * all the messages passed sub-pipelines have to be merged back into the main
+ * pipeline.
+ * */
+
+namespace pipet {
+namespace test {
+
+static int message_key( const Message & m ) { return m.id % 7; }
+
+// Stateful per-key handler: checks that messages with the same key come in
+// increasing order and on the same thread. Runs on worker thread, so only
+// counts the violations.
+class PerKeyOrderCheck {
+private:
+    std::map<int, std::pair<int, std::thread::id> > _last;
+    std::atomic<size_t> & _nViolations;
+public:
+    PerKeyOrderCheck( std::atomic<size_t> & nv ) : _nViolations(nv) {}
+    bool operator()( Message & msg ) {
+        auto ir = _last.emplace( message_key(msg)
+                    , std::make_pair( msg.id, std::this_thread::get_id() ) );
+        if( !ir.second ) {
+            if( ir.first->second.first >= msg.id
+             || ir.first->second.second != std::this_thread::get_id() ) {
+                ++_nViolations;
+            }
+            ir.first->second = std::make_pair( msg.id, std::this_thread::get_id() );
+        }
+        // Discard every 10-th message
+        return msg.id % 10;
+    }
+};
+
+// Checks per-key order of messages merged back into main pipe.
+class MergedOrderCheck {
+private:
+    std::map<int, int> _last;
+public:
+    size_t n;
+    MergedOrderCheck() : n(0) {}
+    bool operator()( Message & msg ) {
+        int & last = _last[message_key(msg)];
+        BOOST_CHECK_LT( last, msg.id );
+        last = msg.id;
+        ++n;
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( keyRouterSuite )
+
+BOOST_AUTO_TEST_CASE( perKeyOrdering ) {
+    const size_t nMsgs = 10000
+               , nWorkers = 3
+               ;
+    std::atomic<size_t> nViolations(0);
+    pipet::KeyRouter<pipet::test::Message, int> router( pipet::test::message_key
+                                                      , nWorkers, 64 );
+    std::vector<std::unique_ptr<pipet::test::PerKeyOrderCheck> > checks;
+    for( size_t i = 0; i < nWorkers; ++i ) {
+        checks.emplace_back( new pipet::test::PerKeyOrderCheck(nViolations) );
+        router.sub(i).push_back( *checks.back() );
+    }
+    pipet::test::MergedOrderCheck merged;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( router );
+    p.push_back( merged );
+    pipet::test::TestingSource2 src(nMsgs);
+    p <= src;
+    BOOST_CHECK_EQUAL( nViolations.load(), 0 );
+    BOOST_CHECK_EQUAL( merged.n, nMsgs - nMsgs/10 );
+    size_t nRouted = 0;
+    for( size_t i = 0; i < nWorkers; ++i ) {
+        BOOST_CHECK_GT( router.n_routed(i), 0 );
+        nRouted += router.n_routed(i);
+    }
+    BOOST_CHECK_EQUAL( nRouted, nMsgs );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
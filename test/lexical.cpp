@@ -115,6 +115,59 @@ BOOST_AUTO_TEST_CASE( TemporarySourceProcessing ) {
                                  );
 }
 
+// Checks that messages given as rvalues are moved into the proxy and the
+// result is moved out, with no copies of the payload made.
+BOOST_AUTO_TEST_CASE( MoveSemantics ) {
+    using namespace ::pipet;
+    using namespace ::pipet::test;
+    Pipe<Message> p;
+    OrderCheck o(1);
+    p |= o;
+
+    Message msg1(1), res;
+    msg1.procPassed.reserve( 128 );
+    const int * payload = msg1.procPassed.data();
+
+    p << std::move(msg1) >> res;
+
+    BOOST_CHECK_EQUAL( res.id, 1 );
+    BOOST_REQUIRE_EQUAL( res.procPassed.size(), 1 );
+    BOOST_CHECK_EQUAL( res.procPassed[0], 1 );
+    // Same buffer has to be delivered.
+    BOOST_CHECK_EQUAL( res.procPassed.data(), payload );
+}
+
+// Checks the view mode: lease provides access to the message owned by the
+// proxy, returning it back once reset.
+BOOST_AUTO_TEST_CASE( LeaseExtraction ) {
+    using namespace ::pipet;
+    using namespace ::pipet::test;
+    Pipe<Message> p;
+    OrderCheck o(1);
+    FilteringProcessor fp( {1}, 2 );
+    p |= o;
+    p |= fp;
+
+    auto proxy = p << Message(1) << Message(2);
+    aux::MessageLease<Message> lease;
+    proxy >> lease;
+    BOOST_REQUIRE( lease );
+    BOOST_CHECK_EQUAL( lease->id, 2 );
+    BOOST_CHECK_EQUAL( lease->procPassed.size(), 2 );
+    lease.reset();
+    BOOST_CHECK( !lease );
+
+    // Lease from the pooled source.
+    TestingSource2 src(3);
+    Pipe<Message> p2;
+    (src | p2) >> lease;
+    BOOST_REQUIRE( lease );
+    BOOST_CHECK_EQUAL( lease->id, 1 );
+    BOOST_CHECK( lease.disposable() );
+    // Lease must not outlive the source.
+    lease.reset();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
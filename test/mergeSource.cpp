@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "merge_source.tcc"
+
+# include <algorithm>
+# include <atomic>
+# include <chrono>
+# include <cstdlib>
+# include <thread>
+
+/**This unit test checks that merge source produces ordered stream of
+ * messages from ordered inputs, including the empty ones and the ones
+ * temporarily having no data.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Emits messages with given (ordered) IDs; not ready until gate is open.
+class ListSource : public interfaces::Source<Message> {
+private:
+    aux::MessagePool<Message> _pool;
+    std::vector<int> _ids;
+    size_t _next;
+    const std::atomic<bool> * _gate;
+public:
+    ListSource( const std::vector<int> & ids
+              , const std::atomic<bool> * gate=nullptr )
+            : _ids(ids), _next(0), _gate(gate) {}
+    virtual Message * get() override {
+        while( _gate && !_gate->load() ) std::this_thread::yield();
+        if( _next == _ids.size() ) return nullptr;
+        Message * m = _pool.acquire();
+        m->id = _ids[_next++];
+        m->procPassed.clear();
+        return m;
+    }
+    virtual void release( Message * m ) override { _pool.release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+    virtual bool ready() const override { return !_gate || _gate->load(); }
+    size_t n_free() const { return _pool.n_free(); }
+    size_t n_slots() const { return _pool.n_slots(); }
+};
+
+// Emits given IDs re-using single message instance.
+class ReentrantListSource : public interfaces::Source<Message> {
+private:
+    Message _msg;
+    std::vector<int> _ids;
+    size_t _next;
+public:
+    ReentrantListSource( const std::vector<int> & ids ) : _ids(ids), _next(0) {}
+    virtual Message * get() override {
+        if( _next == _ids.size() ) return nullptr;
+        _msg.id = _ids[_next++];
+        return &_msg;
+    }
+};
+
+struct IDRecorder : public std::vector<int> {
+    bool operator()( Message & m ) {
+        push_back( m.id );
+        return true;
+    }
+};
+
+static int message_time( const Message & m ) { return m.id; }
+
+}  // namespace test
+}  // namespace pipet
+
+using pipet::test::Message;
+typedef pipet::MergeSource<Message, int> Merge;
+
+BOOST_AUTO_TEST_SUITE( mergeSourceSuite )
+
+BOOST_AUTO_TEST_CASE( mergesOrdered ) {
+    const size_t nInputs = 7;
+    srand(1337);
+    std::vector<std::unique_ptr<pipet::test::ListSource> > inputs;
+    std::vector<int> all;
+    for( size_t i = 0; i < nInputs; ++i ) {
+        // Input #3 is empty, #5 has single message
+        size_t n = 3 == i ? 0 : ( 5 == i ? 1 : 100 + rand()%200 );
+        std::vector<int> ids;
+        int t = rand()%50;
+        for( size_t j = 0; j < n; ++j ) {
+            ids.push_back( t += rand()%20 );
+        }
+        all.insert( all.end(), ids.begin(), ids.end() );
+        inputs.emplace_back( new pipet::test::ListSource(ids) );
+    }
+    Merge merge( pipet::test::message_time, 16 );
+    for( auto & in : inputs ) merge.add( *in );
+    pipet::test::IDRecorder ids;
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(merge);
+    std::sort( all.begin(), all.end() );
+    BOOST_REQUIRE_EQUAL( ids.size(), all.size() );
+    BOOST_CHECK( ids == all );
+    BOOST_CHECK_EQUAL( merge.n_late(), 0 );
+    BOOST_CHECK_EQUAL( merge.n_taken(3), 0 );
+    BOOST_CHECK_EQUAL( merge.n_taken(5), 1 );
+    for( auto & in : inputs ) {
+        BOOST_CHECK_EQUAL( in->n_free(), in->n_slots() );
+    }
+}
+
+// Reentrant inputs overwrite the message on each get(), so the prefetched
+// messages have to be copied.
+BOOST_AUTO_TEST_CASE( reentrantInputs ) {
+    pipet::test::ReentrantListSource a( {1, 3, 5, 7, 9, 11} )
+                                   , b( {2, 4, 6, 8, 10, 12} )
+                                   ;
+    Merge merge( pipet::test::message_time, 4 );
+    merge.add( a );
+    merge.add( b );
+    pipet::test::IDRecorder ids;
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(merge);
+    BOOST_REQUIRE_EQUAL( ids.size(), 12 );
+    for( size_t i = 0; i < ids.size(); ++i ) {
+        BOOST_CHECK_EQUAL( ids[i], i + 1 );
+    }
+    BOOST_CHECK_EQUAL( merge.n_late(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( waitsForIdleInput ) {
+    std::atomic<bool> gate(false);
+    pipet::test::ListSource a( {1, 4, 7, 10} )
+                          , b( {2, 5, 8, 11}, &gate )
+                          , c( {3, 6, 9, 12} )
+                          ;
+    Merge merge( pipet::test::message_time, 2 );
+    merge.add( a );
+    merge.add( b );
+    merge.add( c );
+    std::thread opener( [&gate](){
+            std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+            gate.store( true );
+        } );
+    pipet::test::IDRecorder ids;
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(merge);
+    opener.join();
+    BOOST_REQUIRE_EQUAL( ids.size(), 12 );
+    for( size_t i = 0; i < ids.size(); ++i ) {
+        BOOST_CHECK_EQUAL( ids[i], i + 1 );
+    }
+    BOOST_CHECK_EQUAL( merge.n_bypassed(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( bypassesIdleInput ) {
+    std::atomic<bool> gate(false);
+    pipet::test::ListSource a( {1, 4, 7, 10} )
+                          , b( {2, 5}, &gate )
+                          ;
+    Merge merge( pipet::test::message_time, 2 );
+    merge.set_idle_timeout( std::chrono::milliseconds(5) );
+    merge.add( a );
+    merge.add( b );
+    std::thread opener( [&gate](){
+            std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+            gate.store( true );
+        } );
+    pipet::test::IDRecorder ids;
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(merge);
+    opener.join();
+    // Input `a' is not held back by idle `b'; late messages of `b' are
+    // emitted once available.
+    const int expected[] = { 1, 4, 7, 10, 2, 5 };
+    BOOST_REQUIRE_EQUAL( ids.size(), 6 );
+    for( size_t i = 0; i < ids.size(); ++i ) {
+        BOOST_CHECK_EQUAL( ids[i], expected[i] );
+    }
+    BOOST_CHECK_EQUAL( merge.n_bypassed(), 1 );
+    BOOST_CHECK_EQUAL( merge.n_late(), 2 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
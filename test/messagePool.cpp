@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+
+/**This unit test checks the message slots ownership handoff between the
+ * pooled source, pipeline handlers and fork/junction handlers. Slots taken
+ * from the pool have to return to its free list once propagation is over,
+ * regardless of whether the message was discriminated, kept by fork or has
+ * passed the entire chain.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Remembers addresses of messages passing through.
+class AddressCollector : public std::vector<const Message *> {
+public:
+    bool operator()( Message & msg ) {
+        push_back( &msg );
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( messagePoolSuite )
+
+// Checks basic acquire/release cycle.
+BOOST_AUTO_TEST_CASE( acquireRelease ) {
+    pipet::aux::MessagePool<pipet::test::Message> pool(2);
+    pipet::test::Message * m1 = pool.acquire()
+                       , * m2 = pool.acquire()
+                       , * m3 = pool.acquire()
+                       ;
+    BOOST_CHECK( m1 != m2 && m2 != m3 && m1 != m3 );
+    BOOST_CHECK( pool.owns(m1) && pool.owns(m2) && pool.owns(m3) );
+    pipet::test::Message foreign;
+    BOOST_CHECK( !pool.owns(&foreign) );
+    BOOST_CHECK_EQUAL( pool.n_slots() - pool.n_free(), 3 );
+    pool.release( m2 );
+    BOOST_CHECK_EQUAL( pool.acquire(), m2 );  // LIFO free list
+    pool.release( m1 );
+    pool.release( m2 );
+    pool.release( m3 );
+    BOOST_CHECK_EQUAL( pool.n_slots(), pool.n_free() );
+}
+
+// Checks that messages discriminated or passed through the chain are returned
+// to the pool.
+BOOST_AUTO_TEST_CASE( linearRelease
+                    , *boost::unit_test::depends_on("messagePoolSuite/acquireRelease") ) {
+    pipet::aux::MessagePool<pipet::test::Message> pool(1);
+    pipet::GenericArbiter<int> a;
+    pipet::test::FilteringProcessor fp( {2, 4, 5} );
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( fp );
+    pipet::test::TestingSource2 src( 10, &pool );
+    pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
+        a, p.upcast(), src );
+    // Single slot shall be re-used by the source all the time.
+    BOOST_CHECK_EQUAL( pool.n_slots(), 1 );
+    BOOST_CHECK_EQUAL( pool.n_free(), 1 );
+}
+
+// Checks that forks keep the pooled messages by pointer, with no copying, and
+// the slots are returned once messages leave the chain.
+BOOST_AUTO_TEST_CASE( forkHandoff
+                    , *boost::unit_test::depends_on("messagePoolSuite/linearRelease") ) {
+    pipet::aux::MessagePool<pipet::test::Message> pool(1);
+    pipet::GenericArbiter<int> a;
+    pipet::test::AddressCollector before, after;
+    pipet::test::ForkMimic fork3(3, 1, &pool);
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( before );
+    p.push_back( fork3 );
+    p.push_back( after );
+    pipet::test::TestingSource2 src( 10, &pool );
+    pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
+        a, p.upcast(), src );
+    BOOST_REQUIRE_EQUAL( before.size(), 10 );
+    BOOST_REQUIRE_EQUAL( after.size(), 10 );
+    // Same instances have to appear after the fork.
+    BOOST_CHECK_EQUAL_COLLECTIONS( before.begin(), before.end()
+                                 , after.begin(), after.end() );
+    // No more slots than the fork capacity may be allocated simultaneously.
+    BOOST_CHECK_LE( pool.n_slots(), 4 );
+    BOOST_CHECK_EQUAL( pool.n_slots(), pool.n_free() );
+}
+
+// Checks that messages of the pool not shared with fork are copied by it,
+// while originals are returned to their source at once.
+BOOST_AUTO_TEST_CASE( foreignPoolHandoff
+                    , *boost::unit_test::depends_on("messagePoolSuite/forkHandoff") ) {
+    pipet::aux::MessagePool<pipet::test::Message> srcPool(1), forkPool(1);
+    pipet::GenericArbiter<int> a;
+    pipet::test::OrderCheck after;
+    pipet::test::ForkMimic fork3(3, 1, &forkPool);
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( fork3 );
+    p.push_back( after );
+    pipet::test::TestingSource2 src( 10, &srcPool );
+    pipet::Pipe<pipet::test::Message>::TheHandlerTraits::process(
+        a, p.upcast(), src );
+    BOOST_CHECK_EQUAL( after.latest_id(), 10 );
+    BOOST_CHECK_EQUAL( srcPool.n_slots(), 1 );
+    BOOST_CHECK_EQUAL( srcPool.n_free(), 1 );
+    BOOST_CHECK_LE( forkPool.n_slots(), 4 );
+    BOOST_CHECK_EQUAL( forkPool.n_slots(), forkPool.n_free() );
+}
+
+// Checks that pull_one() lets the filled fork emit its messages instead of
+// forwarding the latest one while it is still held by the fork.
+BOOST_AUTO_TEST_CASE( forkCompletePull
+                    , *boost::unit_test::depends_on("messagePoolSuite/forkHandoff") ) {
+    pipet::aux::MessagePool<pipet::test::Message> pool(1);
+    pipet::GenericArbiter<int> a;
+    pipet::test::OrderCheck after;
+    pipet::test::ForkMimic fork4(4, 1, &pool);
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( fork4 );
+    p.push_back( after );
+    pipet::test::TestingSource2 src( 10, &pool );
+    for( int n = 1; n <= 8; ++n ) {
+        pipet::test::Message msg;
+        pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
+            a, p.upcast(), src, msg );
+        BOOST_CHECK_EQUAL( msg.id, n );
+    }
+    BOOST_CHECK_EQUAL( after.latest_id(), 8 );
+    // Every slot is released exactly once.
+    BOOST_CHECK_LE( pool.n_slots(), 5 );
+    BOOST_CHECK_EQUAL( pool.n_slots(), pool.n_free() );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
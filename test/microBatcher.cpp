@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "micro_batcher.tcc"
+
+# include <chrono>
+# include <thread>
+
+/**This unit test checks that micro-batching handler flushes batches once
+ * they are full, or once the deadline of the oldest message is exceeded.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Collects IDs of messages (from the worker thread).
+struct IDCollector : public std::vector<int> {
+    bool operator()( Message & m ) {
+        push_back( m.id );
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( microBatcherSuite )
+
+BOOST_AUTO_TEST_CASE( flushBySize ) {
+    pipet::MicroBatcher<pipet::test::Message> b( 4, std::chrono::seconds(10) );
+    pipet::test::IDCollector c;
+    b.sub().push_back( c );
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( b );
+    pipet::test::TestingSource2 src(10);
+    p <= src;
+    b.drain();
+    std::vector<int> expected = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    BOOST_CHECK_EQUAL_COLLECTIONS( c.begin(), c.end()
+                                 , expected.begin(), expected.end() );
+    auto s = b.batch_stats();
+    BOOST_CHECK_EQUAL( s.nBatches, 3 );
+    BOOST_CHECK_EQUAL( s.nMessages, 10 );
+    BOOST_CHECK_EQUAL( s.nBySize, 2 );
+    BOOST_CHECK_EQUAL( s.nByDeadline, 0 );
+    BOOST_CHECK_EQUAL( s.nByDrain, 1 );
+    BOOST_CHECK_CLOSE( s.mean_fill( b.max_size() ), 10./12, 1e-6 );
+    BOOST_CHECK_EQUAL( b.latency().count(), 10 );
+}
+
+BOOST_AUTO_TEST_CASE( flushByDeadline ) {
+    pipet::MicroBatcher<pipet::test::Message> b( 100, std::chrono::milliseconds(5) );
+    pipet::test::IDCollector c;
+    b.sub().push_back( c );
+    // Foreign (not pooled) messages are copied by batcher
+    for( int i = 1; i <= 3; ++i ) {
+        pipet::test::Message m(i);
+        BOOST_CHECK( pipet::PipeRC::Absorbed == b( m ) );
+    }
+    std::this_thread::sleep_for( std::chrono::milliseconds(100) );
+    auto s = b.batch_stats();
+    BOOST_CHECK_EQUAL( s.nByDeadline, 1 );
+    BOOST_CHECK_EQUAL( s.nBatches, 1 );
+    BOOST_REQUIRE_EQUAL( c.size(), 3 );
+    BOOST_CHECK_EQUAL( c[2], 3 );
+    BOOST_CHECK_EQUAL( b.latency().count(), 3 );
+    BOOST_CHECK_GE( b.latency().percentile(0.), 4000000 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include <boost/test/unit_test.hpp>
+
+# include "new.tcc"
+
+# include <cstdio>
+
+/**This unit test checks that the state and cursor are restored from a valid
+ * snapshot only, and are kept intact otherwise, and that the failure of
+ * snapshot writing is reported.
+ * */
+
+namespace ppt {
+namespace test {
+
+// Keeps single integer as the state.
+struct Counter : public checkpointing::Stateful {
+    uint64_t value;
+    Counter() : value(0) {}
+    virtual void save_state( checkpointing::Blob & b ) const override {
+        checkpointing::put( b, value );
+    }
+    virtual void load_state( const checkpointing::Blob & b ) override {
+        size_t offset = 0;
+        checkpointing::get( b, offset, value );
+    }
+};
+
+static checkpointing::Blob read_file( const std::string & path ) {
+    std::ifstream is( path, std::ios::binary );
+    return checkpointing::Blob( (std::istreambuf_iterator<char>(is))
+                              , std::istreambuf_iterator<char>() );
+}
+
+static void write_file( const std::string & path, const checkpointing::Blob & b ) {
+    std::ofstream os( path, std::ios::binary | std::ios::trunc );
+    os.write( b.data(), b.size() );
+}
+
+}  // namespace test
+}  // namespace ppt
+
+BOOST_AUTO_TEST_SUITE( pptCheckpointSuite )
+
+BOOST_AUTO_TEST_CASE( restoreValidatesSnapshot ) {
+    const std::string path = "pptCheckpoint.snapshot";
+    ppt::test::Counter c;
+    c.value = 42;
+    {
+        ppt::checkpointing::Checkpointer cp( c, path, 0 );
+        cp.checkpoint( 1337 );
+        cp.wait();
+    }
+    const ppt::checkpointing::Blob snapshot = ppt::test::read_file( path );
+    BOOST_REQUIRE( !snapshot.empty() );
+    ppt::checkpointing::Checkpointer cp( c, path, 0 );
+    uint64_t cursor = 7;
+    c.value = 0;
+    // Truncated state blob
+    ppt::test::write_file( path, snapshot.substr( 0, snapshot.size() - 1 ) );
+    BOOST_CHECK( !cp.restore( cursor ) );
+    BOOST_CHECK_EQUAL( cursor, 7 );
+    BOOST_CHECK_EQUAL( c.value, 0 );
+    // Trailing garbage
+    ppt::test::write_file( path, snapshot + "x" );
+    BOOST_CHECK( !cp.restore( cursor ) );
+    BOOST_CHECK_EQUAL( cursor, 7 );
+    BOOST_CHECK_EQUAL( c.value, 0 );
+    // Intact snapshot
+    ppt::test::write_file( path, snapshot );
+    BOOST_CHECK( cp.restore( cursor ) );
+    BOOST_CHECK_EQUAL( cursor, 1337 );
+    BOOST_CHECK_EQUAL( c.value, 42 );
+    std::remove( path.c_str() );
+}
+
+BOOST_AUTO_TEST_CASE( writeFailureReported ) {
+    ppt::test::Counter c;
+    ppt::checkpointing::Checkpointer cp( c, "no-such-dir/pptCheckpoint.snapshot", 0 );
+    cp.checkpoint( 1 );
+    BOOST_CHECK_THROW( cp.wait(), std::runtime_error );
+    // Failure is reported once
+    BOOST_CHECK_NO_THROW( cp.wait() );
+    // Failure of previous snapshot is reported by the next one, that is
+    // not written then
+    cp.checkpoint( 2 );
+    BOOST_CHECK_THROW( cp.checkpoint( 3 ), std::runtime_error );
+    BOOST_CHECK_NO_THROW( cp.wait() );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include <boost/test/unit_test.hpp>
+
+# include "new.tcc"
+
+# include <map>
+
+/**This unit test checks the journal sampling: period and predicate are
+ * mutually exclusive, and the decision made at the top-level pipe is
+ * inherited by nested pipes.
+ * */
+
+namespace ppt {
+namespace test {
+
+struct Sample {
+    int x, y;
+};
+
+struct Doubler : public iMutator<Sample> {
+protected:
+    virtual Traits<Sample>::Routing::ResultCode _V_eval( Sample & s ) override {
+        s.y = 2*s.x;
+        return 0;
+    }
+};
+
+struct Checker : public iObserver<Sample> {
+protected:
+    virtual Traits<Sample>::Routing::ResultCode _V_eval( const Sample & ) override {
+        return Traits<Sample>::Routing::mark_intact( 0 );
+    }
+};
+
+// Counts `procBgn' entries per issuer and clears the journal.
+static std::map<void *, size_t>
+count_entries( journaling::Journal<Sample> & j ) {
+    std::map<void *, size_t> r;
+    for( const auto & e : j ) {
+        if( journaling::procBgn == e.type ) ++r[e.issuer];
+    }
+    j.clear();
+    return r;
+}
+
+// Evaluates the pipe on messages with x = 0..n-1.
+static void feed( Pipe<Sample> & p, int n ) {
+    for( int i = 0; i < n; ++i ) {
+        Sample s = { i, 0 };
+        p.eval( s );
+    }
+}
+
+}  // namespace test
+}  // namespace ppt
+
+BOOST_AUTO_TEST_SUITE( pptJournalSuite )
+
+BOOST_AUTO_TEST_CASE( samplingModes ) {
+    using ppt::test::Sample;
+    ppt::test::Doubler d;
+    ppt::test::Checker c;
+    ppt::Pipe<Sample> inner, outer;
+    inner.push_back( &c );
+    outer.push_back( &d );
+    outer.push_back( &inner );
+    ppt::journaling::Journal<Sample> j;
+    outer.assign_journal( j );
+    void * const issuers[] = { &outer, &d, &inner, &c };
+
+    // Each n-th message; nested pipe does not count messages on its own
+    j.sample_every( 3 );
+    ppt::test::feed( outer, 10 );
+    auto counts = ppt::test::count_entries( j );
+    for( void * p : issuers ) BOOST_CHECK_EQUAL( counts[p], 4 );
+
+    // Predicate overrides the period
+    j.sample_if( []( const Sample & s ) { return !(s.x % 2); } );
+    ppt::test::feed( outer, 10 );
+    counts = ppt::test::count_entries( j );
+    for( void * p : issuers ) BOOST_CHECK_EQUAL( counts[p], 5 );
+
+    // Dropping the predicate does not bring the period back
+    j.sample_if( nullptr );
+    ppt::test::feed( outer, 10 );
+    counts = ppt::test::count_entries( j );
+    for( void * p : issuers ) BOOST_CHECK_EQUAL( counts[p], 10 );
+
+    // Period drops the predicate and restarts the counting
+    j.sample_if( []( const Sample & ) { return false; } );
+    j.sample_every( 4 );
+    ppt::test::feed( outer, 10 );
+    counts = ppt::test::count_entries( j );
+    for( void * p : issuers ) BOOST_CHECK_EQUAL( counts[p], 3 );
+
+    j.sample_every( 0 );
+    ppt::test::feed( outer, 10 );
+    BOOST_CHECK( j.empty() );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
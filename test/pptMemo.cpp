@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include <boost/test/unit_test.hpp>
+
+# include "new.tcc"
+
+/**This unit test checks the memoization cache and wrappers: hits/misses
+ * accounting, equivalence of replayed mutations to direct evaluation,
+ * eviction at capacity and consistency of concurrent lookups.
+ * */
+
+namespace ppt {
+namespace test {
+
+struct Point {
+    int x, y;
+};
+
+// Pure mutator counting its invocations; discriminates negative points.
+struct Squarer : public iMutator<Point> {
+    size_t nCalls;
+    Squarer() : nCalls(0) {}
+protected:
+    virtual Traits<Point>::Routing::ResultCode _V_eval( Point & p ) override {
+        ++nCalls;
+        if( p.x < 0 ) {
+            return Traits<Point>::Routing::mark_intact( DefaultRoutingFlags::noPropFlag );
+        }
+        p.y = p.x*p.x + 1;
+        return 0;
+    }
+};
+
+// Pure observer counting its invocations.
+struct Parity : public iObserver<Point> {
+    size_t nCalls;
+    Parity() : nCalls(0) {}
+protected:
+    virtual Traits<Point>::Routing::ResultCode _V_eval( const Point & p ) override {
+        ++nCalls;
+        return Traits<Point>::Routing::mark_intact( p.x % 2
+                                        ? DefaultRoutingFlags::noPropFlag : 0 );
+    }
+};
+
+static int point_x( const Point & p ) { return p.x; }
+
+}  // namespace test
+}  // namespace ppt
+
+using ppt::test::Point;
+
+BOOST_AUTO_TEST_SUITE( pptMemoSuite )
+
+BOOST_AUTO_TEST_CASE( hitsAndMisses ) {
+    ppt::MemoCache<int, int> cache(64);
+    int v = 0;
+    BOOST_CHECK( !cache.lookup( 1, v ) );
+    cache.insert( 1, 10 );
+    BOOST_CHECK( cache.lookup( 1, v ) );
+    BOOST_CHECK_EQUAL( v, 10 );
+    BOOST_CHECK( cache.lookup( 1, v ) );
+    BOOST_CHECK( !cache.lookup( 2, v ) );
+    BOOST_CHECK_EQUAL( cache.n_hits(), 2 );
+    BOOST_CHECK_EQUAL( cache.n_misses(), 2 );
+    BOOST_CHECK_CLOSE( cache.hit_rate(), .5, 1e-6 );
+    cache.reset_counters();
+    BOOST_CHECK_EQUAL( cache.n_hits() + cache.n_misses(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( mutatorReplay ) {
+    ppt::test::Squarer direct, wrapped;
+    ppt::MemoizedMutator<Point, int> memo( &wrapped, ppt::test::point_x );
+    const int xs[] = { 3, 1, 3, -2, 5, 1, -2, 3, 0, 5 };
+    for( int x : xs ) {
+        Point a = { x, -1 }
+            , b = { x, -1 }
+            ;
+        const int rcDirect = direct.eval( a )
+                , rcMemo = memo.eval( b )
+                ;
+        BOOST_CHECK_EQUAL( rcMemo, rcDirect );
+        BOOST_CHECK_EQUAL( b.y, a.y );
+    }
+    // Wrapped mutator is invoked once per distinct key.
+    BOOST_CHECK_EQUAL( direct.nCalls, 10 );
+    BOOST_CHECK_EQUAL( wrapped.nCalls, 5 );
+    BOOST_CHECK_EQUAL( memo.cache().n_hits(), 5 );
+    BOOST_CHECK_EQUAL( memo.cache().n_misses(), 5 );
+}
+
+BOOST_AUTO_TEST_CASE( observerResultCode ) {
+    ppt::test::Parity wrapped;
+    ppt::MemoizedObserver<Point, int> memo( &wrapped, ppt::test::point_x );
+    for( int i = 0; i < 20; ++i ) {
+        Point p = { i % 4, 0 };
+        const int rc = memo.eval( p );
+        BOOST_CHECK_EQUAL( ppt::DefaultRoutingTraits::do_stop_propagation( rc )
+                         , bool(p.x % 2) );
+    }
+    BOOST_CHECK_EQUAL( wrapped.nCalls, 4 );
+}
+
+// Single bucket of the cache is filled; next insertion evicts the entry
+// chosen by the policy.
+BOOST_AUTO_TEST_CASE( evictionAtCapacity ) {
+    const size_t n = ppt::MemoCache<int, int>::nWays;
+    int v;
+    {
+        ppt::MemoCache<int, int, ppt::EvictionPolicy::LRU> lru( n );
+        for( size_t i = 0; i < n; ++i ) lru.insert( i, i );
+        BOOST_CHECK( lru.lookup( 0, v ) );  // 1 is now least recently used
+        lru.insert( n, n );
+        BOOST_CHECK( !lru.lookup( 1, v ) );
+        BOOST_CHECK( lru.lookup( 0, v ) );
+        BOOST_CHECK( lru.lookup( n, v ) );
+        BOOST_CHECK_EQUAL( v, n );
+    }
+    {
+        ppt::MemoCache<int, int, ppt::EvictionPolicy::CLOCK> clock( n );
+        for( size_t i = 0; i < n; ++i ) clock.insert( i, i );
+        // All entries are referenced: scan clears the bits and evicts the
+        // first one.
+        clock.insert( n, n );
+        BOOST_CHECK( !clock.lookup( 0, v ) );
+        for( size_t i = 1; i <= n; ++i ) {
+            BOOST_CHECK( clock.lookup( i, v ) );
+            BOOST_CHECK_EQUAL( v, i );
+        }
+    }
+}
+
+// Concurrent readers and writers must never get value of another key.
+BOOST_AUTO_TEST_CASE( concurrentLookups ) {
+    ppt::MemoCache<int, long> cache(32);
+    const int nThreads = 4
+            , nIter = 20000
+            ;
+    std::atomic<int> nWrong(0);
+    std::vector<std::thread> threads;
+    for( int t = 0; t < nThreads; ++t ) {
+        threads.emplace_back( [&cache, &nWrong, t]() {
+                for( int i = 0; i < nIter; ++i ) {
+                    const int k = (i*7 + t*13) % 128;
+                    long v;
+                    if( cache.lookup( k, v ) ) {
+                        if( v != 3L*k ) ++nWrong;
+                    } else {
+                        cache.insert( k, 3L*k );
+                    }
+                }
+            } );
+    }
+    for( auto & t : threads ) t.join();
+    BOOST_CHECK_EQUAL( nWrong.load(), 0 );
+    BOOST_CHECK_EQUAL( cache.n_hits() + cache.n_misses(), nThreads*nIter );
+    BOOST_CHECK_GT( cache.n_hits(), 0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
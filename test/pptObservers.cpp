@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include <boost/test/unit_test.hpp>
+
+# include "new.tcc"
+
+# include <chrono>
+
+/**This unit test checks concurrent evaluation of the observers runs: the
+ * run is joined before the next mutator, and the result is combined as for
+ * sequential evaluation, regardless of which observer finishes first. For
+ * non-speculative evaluation, the state of observers has to be the same as
+ * for sequential one as well.
+ * */
+
+namespace ppt {
+namespace test {
+
+struct Event {
+    int value;
+};
+
+// Sets the value, recording how many observers were done by then.
+struct Setter : public iMutator<Event> {
+    int value;
+    const std::atomic<int> * nDone;
+    int nDoneSeen;
+    size_t nCalls;
+    Setter( int v, const std::atomic<int> * n ) : value(v), nDone(n)
+                                                , nDoneSeen(-1), nCalls(0) {}
+protected:
+    virtual Traits<Event>::Routing::ResultCode _V_eval( Event & e ) override {
+        ++nCalls;
+        nDoneSeen = nDone->load();
+        e.value = value;
+        return 0;
+    }
+};
+
+// Observer sleeping for given time; may stop the propagation returning its
+// tag within the result code.
+struct Probe : public iObserver<Event> {
+    const int tag;
+    bool stop;
+    std::chrono::microseconds delay;
+    std::atomic<int> * nDone;
+    int valueSeen;
+    size_t nCalls;
+    Probe( int t, std::atomic<int> * n ) : tag(t), stop(false), delay(0)
+                                         , nDone(n), valueSeen(-1), nCalls(0) {}
+protected:
+    virtual Traits<Event>::Routing::ResultCode _V_eval( const Event & e ) override {
+        std::this_thread::sleep_for( delay );
+        ++nCalls;
+        valueSeen = e.value;
+        ++*nDone;
+        return Traits<Event>::Routing::mark_intact( stop
+                ? DefaultRoutingFlags::noPropFlag | DefaultRoutingFlags::noNextFlag | (tag << 4)
+                : 0 );
+    }
+};
+
+// Counts the messages, stopping on the given value. Earlier observers of
+// the run are slower. Supports cloning and merging.
+struct Tally : public iObserver<Event> {
+    const int stopOn;
+    const std::chrono::microseconds delay;
+    size_t n;
+    Tally( int s, std::chrono::microseconds d ) : stopOn(s), delay(d), n(0) {}
+    virtual iProcessor<const Event> * clone() const override {
+        return new Tally( stopOn, delay );
+    }
+    virtual void merge( iProcessor<const Event> & o ) override {
+        Tally & t = static_cast<Tally &>(o);
+        n += t.n;
+        t.n = 0;
+    }
+protected:
+    virtual Traits<Event>::Routing::ResultCode _V_eval( const Event & e ) override {
+        std::this_thread::sleep_for( delay );
+        ++n;
+        return Traits<Event>::Routing::mark_intact( e.value == stopOn
+                ? DefaultRoutingFlags::noPropFlag | (stopOn << 4)
+                : 0 );
+    }
+};
+
+}  // namespace test
+}  // namespace ppt
+
+using ppt::test::Event;
+
+BOOST_AUTO_TEST_SUITE( pptObserversRunSuite )
+
+BOOST_AUTO_TEST_CASE( joinAndStopCombination ) {
+    const int nProbes = 4;
+    std::atomic<int> nDone(0);
+    ppt::test::Setter before( 1, &nDone ), after( 2, &nDone );
+    std::vector<std::unique_ptr<ppt::test::Probe> > probes;
+    ppt::Pipe<Event> p;
+    p.push_back( &before );
+    for( int i = 0; i < nProbes; ++i ) {
+        probes.emplace_back( new ppt::test::Probe( i, &nDone ) );
+        p.push_back( probes.back().get() );
+    }
+    p.push_back( &after );
+    ppt::ThreadPool pool( nProbes );
+    // Probes can not be cloned, so are evaluated directly
+    p.set_observers_pool( &pool, true );
+    BOOST_CHECK( p.speculative_observers() );
+
+    // All the observers see the message modified by preceding mutator and
+    // are done before the next one; earlier observers are slower.
+    for( int i = 0; i < nProbes; ++i ) {
+        probes[i]->delay = std::chrono::microseconds( 1000*(nProbes - i) );
+    }
+    Event e = { 0 };
+    int rc = p.eval( e );
+    BOOST_CHECK( !ppt::DefaultRoutingTraits::do_stop_propagation( rc ) );
+    BOOST_CHECK_EQUAL( after.nCalls, 1 );
+    BOOST_CHECK_EQUAL( after.nDoneSeen, nProbes );
+    BOOST_CHECK_EQUAL( e.value, 2 );
+    for( const auto & pr : probes ) {
+        BOOST_CHECK_EQUAL( pr->nCalls, 1 );
+        BOOST_CHECK_EQUAL( pr->valueSeen, 1 );
+    }
+
+    // Observers #1 and #3 stop the propagation, #3 finishes first. Result
+    // is of #1, observers following it within the run still see the message
+    // (speculative evaluation) while the mutator after the run does not.
+    probes[1]->stop = probes[3]->stop = true;
+    for( int n = 0; n < 5; ++n ) {
+        nDone = 0;
+        e.value = 0;
+        rc = p.eval( e );
+        BOOST_CHECK( ppt::DefaultRoutingTraits::do_stop_propagation( rc ) );
+        BOOST_CHECK_EQUAL( rc >> 4, 1 );
+        BOOST_CHECK_EQUAL( nDone.load(), nProbes );
+        BOOST_CHECK_EQUAL( e.value, 1 );
+    }
+    BOOST_CHECK_EQUAL( after.nCalls, 1 );
+    for( const auto & pr : probes ) {
+        BOOST_CHECK_EQUAL( pr->nCalls, 6 );
+    }
+}
+
+// Observers following the stopping one within the run do not accumulate
+// the state, as for sequential evaluation; non-clonable observers cause
+// sequential evaluation of the run.
+BOOST_AUTO_TEST_CASE( stopDiscardsFollowing ) {
+    const int stopOn[] = { -1, 3, 5, -1 };
+    const size_t nTallies = sizeof(stopOn)/sizeof(*stopOn);
+    ppt::ThreadPool pool( nTallies );
+    std::vector<size_t> serialCounts;
+    for( int mode = 0; mode < 3; ++mode ) {
+        std::vector<std::unique_ptr<ppt::test::Tally> > tallies;
+        ppt::Pipe<Event> p;
+        for( size_t i = 0; i < nTallies; ++i ) {
+            tallies.emplace_back( new ppt::test::Tally( stopOn[i]
+                        , std::chrono::microseconds( mode ? 200*(nTallies - i) : 0 ) ) );
+            p.push_back( tallies.back().get() );
+        }
+        std::atomic<int> nDone(0);
+        ppt::test::Probe probe( 0, &nDone );
+        if( 2 == mode ) p.push_back( &probe );
+        if( mode ) p.set_observers_pool( &pool );
+        BOOST_CHECK( !p.speculative_observers() );
+        for( int v = 0; v < 10; ++v ) {
+            Event e = { v };
+            const int rc = p.eval( e );
+            BOOST_CHECK_EQUAL( ppt::DefaultRoutingTraits::do_stop_propagation( rc )
+                             , 3 == v || 5 == v );
+            if( 3 == v || 5 == v ) BOOST_CHECK_EQUAL( rc >> 4, v );
+        }
+        std::vector<size_t> counts;
+        for( const auto & t : tallies ) counts.push_back( t->n );
+        if( !mode ) {
+            serialCounts = counts;
+            BOOST_CHECK_EQUAL( counts[0], 10 );
+            BOOST_CHECK_EQUAL( counts[2], 9 );
+            BOOST_CHECK_EQUAL( counts[3], 8 );
+            continue;
+        }
+        BOOST_CHECK_EQUAL_COLLECTIONS( counts.begin(), counts.end()
+                                     , serialCounts.begin(), serialCounts.end() );
+        if( 2 == mode ) BOOST_CHECK_EQUAL( probe.nCalls, 8 );
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
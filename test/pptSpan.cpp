@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include <boost/test/unit_test.hpp>
+
+# include "new.tcc"
+
+# include <chrono>
+
+/**This unit test checks that the concurrent evaluation of const span on the
+ * chunks of container gives the same result code and observers state as
+ * the serial one, including the case of iteration stopped within a chunk.
+ * */
+
+namespace ppt {
+namespace test {
+
+// Container of items stored as independent chunks.
+struct Chunked {
+    static constexpr size_t chunkSize = 16;
+    std::vector<int> items;
+};
+
+// Sums up the items (delaying on the special one). Supports cloning and
+// merging.
+struct Summator : public iObserver<int> {
+    static constexpr int slowItem = 100;
+    long sum;
+    size_t n;
+    Summator() : sum(0), n(0) {}
+    virtual iProcessor<const int> * clone() const override {
+        return new Summator();
+    }
+    virtual void merge( iProcessor<const int> & o ) override {
+        Summator & s = static_cast<Summator &>(o);
+        sum += s.sum;
+        n += s.n;
+        s.sum = 0;
+        s.n = 0;
+    }
+protected:
+    virtual Traits<int>::Routing::ResultCode _V_eval( int v ) override {
+        if( slowItem == v ) {
+            std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+        }
+        sum += v;
+        ++n;
+        return Traits<int>::Routing::mark_intact(0);
+    }
+};
+
+// Stops the iteration on negative items; the result code carries the item.
+struct Stopper : public iObserver<int> {
+    virtual iProcessor<const int> * clone() const override {
+        return new Stopper();
+    }
+protected:
+    virtual Traits<int>::Routing::ResultCode _V_eval( int v ) override {
+        if( v >= 0 ) return Traits<int>::Routing::mark_intact(0);
+        return Traits<int>::Routing::mark_intact( DefaultRoutingFlags::noPropFlag
+                                                | DefaultRoutingFlags::noNextFlag
+                                                | ((-v) << 4) );
+    }
+};
+
+// Inner journal entries and counters of span evaluation.
+struct SpanRecords {
+    size_t nBgn[2], nEnd[2];
+    uint64_t nCalls[2];
+};
+
+}  // namespace test
+
+template<>
+struct ExtractionTraits<const int, const test::Chunked> {
+    static bool decode_chunk( const test::Chunked & c, size_t n
+                            , std::vector<int> & items ) {
+        const size_t b = n*test::Chunked::chunkSize;
+        if( b >= c.items.size() ) return false;
+        const size_t e = std::min( b + test::Chunked::chunkSize, c.items.size() );
+        items.insert( items.end(), c.items.begin() + b, c.items.begin() + e );
+        return true;
+    }
+    static Traits<test::Chunked>::Routing::ResultCode
+    translate_results( Traits<int>::Routing::ResultCode rc ) {
+        return rc & ~DefaultRoutingFlags::intactFlag;
+    }
+};
+
+}  // namespace ppt
+
+typedef ppt::Span<const ppt::test::Chunked, const int> Span;
+typedef ppt::iObserver<ppt::test::Chunked> Observer;
+
+BOOST_AUTO_TEST_SUITE( pptSpanSuite )
+
+BOOST_AUTO_TEST_CASE( parallelMatchesSerial ) {
+    ppt::test::Chunked c;
+    for( int i = 0; i < 64*16; ++i ) c.items.push_back( i % 7 );
+    // Stops within chunks #10, #11 and #40, the first one is evaluated
+    // slowly, so the others are likely reached by concurrent workers first.
+    c.items[10*16 + 1] = ppt::test::Summator::slowItem;
+    c.items[10*16 + 5] = -1;
+    c.items[11*16 + 2] = -2;
+    c.items[40*16] = -3;
+    ppt::ThreadPool pool(4);
+    ppt::test::Summator serialSum;
+    ppt::test::Stopper serialStop;
+    ppt::Pipe<const int> sp;
+    sp.push_back( &serialSum );
+    sp.push_back( &serialStop );
+    Span serial( sp );
+    const int serialRc = static_cast<Observer &>(serial).eval( c );
+    BOOST_CHECK( ppt::DefaultRoutingTraits::do_stop_iteration( serialRc ) );
+    BOOST_CHECK_EQUAL( serialRc >> 4, 1 );
+    BOOST_CHECK_EQUAL( serialSum.n, 10*16 + 6 );
+    for( int attempt = 0; attempt < 20; ++attempt ) {
+        ppt::test::Summator parSum;
+        ppt::test::Stopper parStop;
+        ppt::Pipe<const int> pp;
+        pp.push_back( &parSum );
+        pp.push_back( &parStop );
+        Span parallel( pp );
+        parallel.set_thread_pool( &pool );
+        BOOST_CHECK_EQUAL( static_cast<Observer &>(parallel).eval( c ), serialRc );
+        BOOST_CHECK_EQUAL( parSum.n, serialSum.n );
+        BOOST_CHECK_EQUAL( parSum.sum, serialSum.sum );
+    }
+    // With no stopping item all the chunks are merged.
+    c.items[10*16 + 5] = c.items[11*16 + 2] = c.items[40*16] = 1;
+    ppt::test::Summator allSum;
+    ppt::test::Stopper allStop;
+    ppt::Pipe<const int> ap;
+    ap.push_back( &allSum );
+    ap.push_back( &allStop );
+    Span all( ap );
+    all.set_thread_pool( &pool );
+    BOOST_CHECK( !ppt::DefaultRoutingTraits::do_stop_iteration( static_cast<Observer &>(all).eval( c ) ) );
+    BOOST_CHECK_EQUAL( allSum.n, c.items.size() );
+}
+
+// Evaluates span twice within outer pipe recording every second message,
+// with given pool (may be null).
+static ppt::test::SpanRecords
+record_span( const ppt::test::Chunked & c, ppt::ThreadPool * pool ) {
+    ppt::test::Summator sum;
+    ppt::test::Stopper stop;
+    ppt::Pipe<const int> ip;
+    ip.push_back( &sum );
+    ip.push_back( &stop );
+    ppt::journaling::Journal<int> innerJournal;
+    ip.assign_journal( innerJournal );
+    Span span( ip );
+    span.set_thread_pool( pool );
+    ppt::Pipe<const ppt::test::Chunked> outer;
+    outer.push_back( &span );
+    ppt::journaling::Journal<ppt::test::Chunked> outerJournal;
+    outer.assign_journal( outerJournal );
+    outerJournal.sample_every( 2 );
+    outer.eval( c );
+    outer.eval( c );
+    ppt::test::SpanRecords r = {};
+    void * issuers[2] = { &sum, &stop };
+    for( const auto & e : innerJournal ) {
+        for( int i = 0; i < 2; ++i ) {
+            if( e.issuer != issuers[i] ) continue;
+            if( ppt::journaling::procBgn == e.type ) ++r.nBgn[i];
+            if( ppt::journaling::procEnd == e.type ) ++r.nEnd[i];
+        }
+    }
+    # ifndef PIPET_DISABLE_STATS
+    r.nCalls[0] = sum.stats().snapshot().nCalls;
+    r.nCalls[1] = stop.stats().snapshot().nCalls;
+    # endif
+    return r;
+}
+
+// Journal entries and counters of inner observers evaluated on clones are
+// attributed to the originals, and only for the sampled messages.
+BOOST_AUTO_TEST_CASE( parallelJournalAndStats ) {
+    ppt::test::Chunked c;
+    for( int i = 0; i < 64*16; ++i ) c.items.push_back( i % 7 );
+    c.items[10*16 + 1] = ppt::test::Summator::slowItem;
+    c.items[10*16 + 5] = -1;
+    c.items[40*16] = -3;
+    const bool wasEnabled = pipet::stats::enabled();
+    pipet::stats::enable();
+    const ppt::test::SpanRecords serial = record_span( c, nullptr );
+    // First message only is sampled
+    BOOST_CHECK_EQUAL( serial.nBgn[0], 10*16 + 6 );
+    # ifndef PIPET_DISABLE_STATS
+    BOOST_CHECK_EQUAL( serial.nCalls[0], 2*(10*16 + 6) );
+    # endif
+    ppt::ThreadPool pool(4);
+    for( int attempt = 0; attempt < 5; ++attempt ) {
+        const ppt::test::SpanRecords par = record_span( c, &pool );
+        for( int i = 0; i < 2; ++i ) {
+            BOOST_CHECK_EQUAL( par.nBgn[i], serial.nBgn[i] );
+            BOOST_CHECK_EQUAL( par.nEnd[i], serial.nEnd[i] );
+            BOOST_CHECK_EQUAL( par.nCalls[i], serial.nCalls[i] );
+        }
+    }
+    pipet::stats::enable( wasEnabled );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "priority_source.tcc"
+
+# include <algorithm>
+
+/**This unit test checks the scheduling of composite source inputs: shares
+ * of weighted round-robin, strict priority with starvation protection and
+ * skipping of the inputs that have no data yet.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Emits messages with IDs base+1, ..., base+n; may be gated.
+class TaggedSource : public interfaces::Source<Message> {
+private:
+    aux::MessagePool<Message> _pool;
+    int _base, _n, _emitted;
+    const bool * _gate;
+public:
+    TaggedSource( int base, int n, const bool * gate=nullptr )
+            : _base(base), _n(n), _emitted(0), _gate(gate) {}
+    virtual Message * get() override {
+        if( _emitted == _n ) return nullptr;
+        Message * m = _pool.acquire();
+        m->id = _base + ++_emitted;
+        m->procPassed.clear();
+        return m;
+    }
+    virtual void release( Message * m ) override { _pool.release( m ); }
+    virtual bool messages_disposable() const override { return true; }
+    virtual bool ready() const override { return !_gate || *_gate; }
+    size_t n_free() const { return _pool.n_free(); }
+};
+
+// Records IDs of messages, optionally opening the gate upon certain one.
+struct IDRecorder : public std::vector<int> {
+    bool * gate;
+    int openOn;
+    IDRecorder( bool * g=nullptr, int o=0 ) : gate(g), openOn(o) {}
+    bool operator()( Message & m ) {
+        push_back( m.id );
+        if( gate && m.id == openOn ) *gate = true;
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+using pipet::test::Message;
+typedef pipet::PrioritySource<Message> PSource;
+
+BOOST_AUTO_TEST_SUITE( prioritySourceSuite )
+
+BOOST_AUTO_TEST_CASE( weightedRoundRobin ) {
+    pipet::test::TaggedSource a(0, 300), b(1000, 300);
+    PSource src( PSource::WeightedRoundRobin );
+    src.add( a, 3 );
+    src.add( b, 1 );
+    pipet::test::IDRecorder ids;
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(src);
+    BOOST_REQUIRE_EQUAL( ids.size(), 600 );
+    // Shares are interleaved smoothly: a, a, b, a, ...
+    const int expected[] = { 1, 2, 1001, 3, 4, 5, 1002, 6 };
+    for( size_t i = 0; i < sizeof(expected)/sizeof(*expected); ++i ) {
+        BOOST_CHECK_EQUAL( ids[i], expected[i] );
+    }
+    size_t nA = std::count_if( ids.begin(), ids.begin() + 400
+                             , []( int id ){ return id < 1000; } );
+    BOOST_CHECK_EQUAL( nA, 300 );
+    BOOST_CHECK_EQUAL( src.input_stats(0).nEmitted, 300 );
+    BOOST_CHECK_EQUAL( src.input_stats(1).nEmitted, 300 );
+    BOOST_CHECK( src.input_stats(0).depleted && src.input_stats(1).depleted );
+    // All the messages are returned to inputs
+    BOOST_CHECK_EQUAL( a.n_free(), 16 );
+    BOOST_CHECK_EQUAL( b.n_free(), 16 );
+}
+
+BOOST_AUTO_TEST_CASE( strictPriorityStarvation ) {
+    pipet::test::TaggedSource hi(0, 100), lo(1000, 100);
+    PSource src( PSource::StrictPriority, 4 );
+    src.add( lo, 1 );
+    src.add( hi, 2 );
+    pipet::test::IDRecorder ids;
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(src);
+    BOOST_REQUIRE_EQUAL( ids.size(), 200 );
+    // Low priority input gets one message after each four of high one
+    const int expected[] = { 1, 2, 3, 4, 1001, 5, 6, 7, 8, 1002 };
+    for( size_t i = 0; i < sizeof(expected)/sizeof(*expected); ++i ) {
+        BOOST_CHECK_EQUAL( ids[i], expected[i] );
+    }
+    BOOST_CHECK_EQUAL( src.input_stats(0).nForced, 25 );
+    BOOST_CHECK_EQUAL( src.input_stats(1).nForced, 0 );
+    BOOST_CHECK_EQUAL( ids[123], 100 );
+    BOOST_CHECK_EQUAL( ids[124], 1025 );
+}
+
+BOOST_AUTO_TEST_CASE( notReadySkipped ) {
+    bool gate = false;
+    pipet::test::TaggedSource hi(0, 10, &gate), lo(1000, 10);
+    PSource src( PSource::StrictPriority );
+    src.add( hi, 10 );
+    src.add( lo, 1 );
+    pipet::test::IDRecorder ids( &gate, 1003 );
+    pipet::Pipe<Message> p;
+    p.push_back( ids );
+    p <= static_cast<pipet::interfaces::Source<Message> &>(src);
+    BOOST_REQUIRE_EQUAL( ids.size(), 20 );
+    // Low priority input is served until high one has data, then the high
+    // one takes over
+    BOOST_CHECK_EQUAL( ids[2], 1003 );
+    BOOST_CHECK_EQUAL( ids[3], 1 );
+    BOOST_CHECK_EQUAL( ids[12], 10 );
+    BOOST_CHECK_EQUAL( ids[13], 1004 );
+    BOOST_CHECK_EQUAL( src.input_stats(0).nNotReady, 3 );
+}
+
+// Messages leased from the different inputs and released out of order are
+// returned to the inputs that have emitted them.
+BOOST_AUTO_TEST_CASE( lateReleaseReturnedToInput ) {
+    pipet::test::TaggedSource a(0, 10), b(1000, 10);
+    PSource src( PSource::WeightedRoundRobin );
+    src.add( a, 1 );
+    src.add( b, 1 );
+    std::vector<Message *> leased;
+    for( int i = 0; i < 6; ++i ) {
+        leased.push_back( src.get() );
+        BOOST_REQUIRE( leased.back() );
+    }
+    BOOST_CHECK_EQUAL( a.n_free(), 13 );
+    BOOST_CHECK_EQUAL( b.n_free(), 13 );
+    // Release the last emitted one first, then the rest in reverse order
+    // mixed with the newly emitted one
+    src.release( leased.back() );
+    leased.pop_back();
+    Message * m = src.get();
+    BOOST_REQUIRE( m );
+    for( auto it = leased.rbegin(); it != leased.rend(); ++it ) {
+        src.release( *it );
+    }
+    src.release( m );
+    BOOST_CHECK_EQUAL( a.n_free(), 16 );
+    BOOST_CHECK_EQUAL( b.n_free(), 16 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "shm_ring.tcc"
+
+# include <sys/wait.h>
+
+/**This unit test checks the shared memory transport: messages written by
+ * the sink in one process have to be read by the source in another one, in
+ * order, including the records wrapping around the ring buffer. Descriptor
+ * of the object that can not be mapped as a ring has to be closed.
+ * */
+
+namespace pipet {
+namespace aux {
+// Variable-length record: ID, stamp and the list of handlers passed.
+template<>
+struct RecordTraits<test::Message> {
+    static size_t size( const test::Message & m ) {
+        return sizeof(int) + sizeof(stats::Stamped)
+             + m.procPassed.size()*sizeof(int);
+    }
+    static void pack( const test::Message & m, void * dest ) {
+        char * c = static_cast<char *>(dest);
+        memcpy( c, &m.id, sizeof(int) );
+        memcpy( c + sizeof(int), static_cast<const stats::Stamped *>(&m)
+              , sizeof(stats::Stamped) );
+        if( !m.procPassed.empty() ) {
+            memcpy( c + sizeof(int) + sizeof(stats::Stamped), m.procPassed.data()
+                  , m.procPassed.size()*sizeof(int) );
+        }
+    }
+    static void unpack( const void * src, size_t len, test::Message & m ) {
+        const char * c = static_cast<const char *>(src);
+        memcpy( &m.id, c, sizeof(int) );
+        memcpy( static_cast<stats::Stamped *>(&m), c + sizeof(int)
+              , sizeof(stats::Stamped) );
+        const int * b = reinterpret_cast<const int *>(c + sizeof(int) + sizeof(stats::Stamped));
+        m.procPassed.assign( b, b + (len - sizeof(int) - sizeof(stats::Stamped))/sizeof(int) );
+    }
+};
+}  // namespace aux
+
+namespace test {
+
+// Appends message ID modulo 5 number of entries to message.
+struct Inflate {
+    bool operator()( Message & m ) {
+        m.procPassed.assign( m.id % 5, m.id );
+        return true;
+    }
+};
+
+// Checks the messages content.
+struct InflatedCheck {
+    size_t n, nErrors;
+    InflatedCheck() : n(0), nErrors(0) {}
+    bool operator()( Message & m ) {
+        if( m.id != int(++n) || m.procPassed.size() != size_t(m.id % 5) ) {
+            ++nErrors;
+        }
+        for( int v : m.procPassed ) if( v != m.id ) ++nErrors;
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( shmRingSuite )
+
+BOOST_AUTO_TEST_CASE( crossProcessTransport ) {
+    const size_t nMsgs = 20000;
+    // Small ring makes writer block and records wrap around frequently.
+    pipet::aux::ShmRing ring = pipet::aux::ShmRing::anonymous( 512 );
+    pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( !pid ) {
+        // Child: acquisition side. Must not return to test framework.
+        try {
+            pipet::test::Inflate inflate;
+            pipet::ShmSink<pipet::test::Message> sink( ring );
+            pipet::Pipe<pipet::test::Message> p;
+            p.push_back( inflate );
+            p.push_back( sink );
+            pipet::test::TestingSource2 src(nMsgs);
+            p <= src;
+            sink.close();
+        } catch( ... ) {
+            ring.close_stream();
+            _exit(1);
+        }
+        _exit(0);
+    }
+    // Parent: analysis side.
+    pipet::test::InflatedCheck check;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( check );
+    pipet::ShmSource<pipet::test::Message> src( ring );
+    p <= static_cast<pipet::interfaces::Source<pipet::test::Message> &>(src);
+    int status;
+    waitpid( pid, &status, 0 );
+    BOOST_CHECK( WIFEXITED(status) && !WEXITSTATUS(status) );
+    BOOST_CHECK_EQUAL( check.n, nMsgs );
+    BOOST_CHECK_EQUAL( check.nErrors, 0 );
+}
+
+// Objects that are too small or not initialized as a ring are rejected,
+// with descriptor (owned by the ring) closed.
+BOOST_AUTO_TEST_CASE( invalidObjectClosed ) {
+    const size_t sizes[] = { 16, 4096 };
+    for( size_t sz : sizes ) {
+        int fd = memfd_create( "pipet-ring-test", 0 );
+        BOOST_REQUIRE( fd >= 0 );
+        BOOST_REQUIRE( !ftruncate( fd, sz ) );
+        BOOST_CHECK_THROW( pipet::aux::ShmRing::from_fd( fd )
+                         , pipet::errors::Malfunction );
+        BOOST_CHECK_EQUAL( fcntl( fd, F_GETFD ), -1 );
+        BOOST_CHECK_EQUAL( errno, EBADF );
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -24,6 +24,7 @@
 # define H_PIPET_TEST_STUB_CLASSES_H
 
 # include "pipeline.tcc"
+# include "message_pool.tcc"
 
 # include <set>
 
@@ -33,7 +34,7 @@
 namespace pipet {
 namespace test {
 
-struct Message {
+struct Message : public stats::Stamped {
     int id;
     std::vector<int> procPassed;
 
@@ -65,16 +66,15 @@ public:
 class ForkMimic : public interfaces::Source<Message> {
 private:
     int _nAcc;
-    std::vector<Message> _acc;
-    Message _cMsg;
+    aux::PooledQueue<Message> _acc;
     bool _wasFull;
     int _id;
 public:
-    ForkMimic( int nAcc ) : _nAcc(nAcc), _wasFull(false), _id(-1)
-        { _acc.reserve(_nAcc); }
+    ForkMimic( int nAcc, aux::MessagePool<Message> * pool=nullptr )
+            : _nAcc(nAcc), _acc(pool), _wasFull(false), _id(-1) {}
 
-    ForkMimic( int nAcc, int id ) : _nAcc(nAcc), _wasFull(false), _id(id)
-        { _acc.reserve(_nAcc); }
+    ForkMimic( int nAcc, int id, aux::MessagePool<Message> * pool=nullptr )
+            : _nAcc(nAcc), _acc(pool), _wasFull(false), _id(id) {}
 
     pipet::PipeRC operator()(Message & msg) {
         // We aborting propagation here until the fork is filled. Upon
@@ -82,23 +82,25 @@ public:
         // loop to continue propagation from this fork as the messages source.
         BOOST_CHECK_LT( _acc.size(), _nAcc );
         msg.procPassed.push_back( _id );
-        _acc.push_back( msg );
+        // Foreign messages are copied, originals return to their source.
+        const bool held = _acc.hold( msg );
         if( _acc.size() >= _nAcc ) {
             _wasFull = true;
-            return PipeRC::Complete;
+            return held ? PipeRC::Complete : PipeRC::Filled;
         }
-        return PipeRC::MessageKept;
+        return held ? PipeRC::MessageKept : PipeRC::Absorbed;
     }
 
     virtual Message * get() override {
-        if( !_acc.empty() ) {
-            _cMsg = *_acc.begin();
-            _acc.erase(_acc.begin());
-            return &_cMsg;
-        }
-        return nullptr;
+        return _acc.pop();
+    }
+
+    virtual void release( Message * msg ) override {
+        _acc.release( msg );
     }
 
+    virtual bool messages_disposable() const override { return true; }
+
     void reset() {
         _acc.clear();
         _wasFull = false;
@@ -124,20 +126,33 @@ public:
 };
 
 // Testing source, emitting messages with id set to the simple increasing
-// natural series.
+// natural series. Messages are acquired from the pool, so they may be kept
+// by forks with no copying.
 class TestingSource2 {
 private:
     size_t _nMsgsMax;
-    Message _reentrantMessage;
+    int _lastID;
+    aux::MessagePool<Message> _ownPool;
+    aux::MessagePool<Message> * _pool;
 public:
-    TestingSource2(size_t nMsgsMax) : _nMsgsMax( nMsgsMax )
-                                   , _reentrantMessage(0) {}
+    TestingSource2(size_t nMsgsMax, aux::MessagePool<Message> * pool=nullptr )
+            : _nMsgsMax( nMsgsMax )
+            , _lastID(0)
+            , _pool( pool ? pool : &_ownPool ) {}
     virtual Message * get() {
-        if( ++ _reentrantMessage.id > _nMsgsMax ) {
+        if( ++ _lastID > (int) _nMsgsMax ) {
             return nullptr;
         }
-        return &_reentrantMessage;
+        Message * msg = _pool->acquire();
+        msg->id = _lastID;
+        msg->procPassed.clear();
+        stats::stamp( *msg );
+        return msg;
     }
+    virtual void release( Message * msg ) {
+        _pool->release( msg );
+    }
+    virtual bool messages_disposable() const { return true; }
 };
 
 }  // namespace test
@@ -155,6 +170,12 @@ struct SourceTraits< test::TestingSource2
         virtual pipet::test::Message * get() {
             return _srcRef.get();
         }
+        virtual void release( pipet::test::Message * msg ) override {
+            _srcRef.release( msg );
+        }
+        virtual bool messages_disposable() const override {
+            return _srcRef.messages_disposable();
+        }
     };
 };
 }  // namespace aux
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+# include "tstStubs.hpp"
+# include "window_aggregator.tcc"
+
+/**This unit test checks the windowed aggregation: aggregates have to be
+ * emitted as new messages once windows are closed, for both count- and
+ * time-based windows.
+ * */
+
+namespace pipet {
+namespace test {
+
+// Sums up messages IDs; the emitted message carries the sum as ID.
+struct IDSum {
+    typedef int Value;
+    Value identity() const { return 0; }
+    Value lift( const Message & m ) const { return m.id; }
+    Value combine( Value a, Value b ) const { return a + b; }
+    void lower( Value v, Message & m ) const {
+        m.id = v;
+        m.procPassed.clear();
+    }
+};
+
+// Concatenates IDs as decimal digits to check that the order of combination
+// is preserved (operation is not commutative).
+struct IDConcat : public IDSum {
+    Value combine( Value a, Value b ) const {
+        int s = 1;
+        while( s <= b ) s *= 10;
+        return a*s + b;
+    }
+};
+
+// Collects IDs of messages.
+struct IDCollector : public std::vector<int> {
+    bool operator()( Message & m ) {
+        push_back( m.id );
+        return true;
+    }
+};
+
+}  // namespace test
+}  // namespace pipet
+
+BOOST_AUTO_TEST_SUITE( windowAggregatorSuite )
+
+BOOST_AUTO_TEST_CASE( tumblingByCount ) {
+    pipet::WindowAggregator<pipet::test::Message, pipet::test::IDSum> w(4);
+    pipet::test::IDCollector c;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( w );
+    p.push_back( c );
+    pipet::test::TestingSource2 src(14);
+    p <= src;
+    std::vector<int> expected = { 1+2+3+4, 5+6+7+8, 9+10+11+12 };
+    BOOST_CHECK_EQUAL_COLLECTIONS( c.begin(), c.end()
+                                 , expected.begin(), expected.end() );
+    BOOST_CHECK_EQUAL( w.n_windows(), 3 );
+    BOOST_CHECK_EQUAL( w.size(), 2 );
+}
+
+BOOST_AUTO_TEST_CASE( slidingByCount ) {
+    pipet::WindowAggregator<pipet::test::Message, pipet::test::IDConcat> w(3, 1);
+    pipet::test::IDCollector c;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( w );
+    p.push_back( c );
+    pipet::test::TestingSource2 src(7);
+    p <= src;
+    std::vector<int> expected = { 123, 234, 345, 456, 567 };
+    BOOST_CHECK_EQUAL_COLLECTIONS( c.begin(), c.end()
+                                 , expected.begin(), expected.end() );
+}
+
+BOOST_AUTO_TEST_CASE( byTimestamp ) {
+    // Timestamps are 10, 20, ..., 100, windows of width 30 slide by 15.
+    pipet::WindowAggregator<pipet::test::Message, pipet::test::IDSum> w(
+            []( const pipet::test::Message & m ) { return m.id*10; }, 30, 15 );
+    pipet::test::IDCollector c;
+    pipet::Pipe<pipet::test::Message> p;
+    p.push_back( w );
+    p.push_back( c );
+    pipet::test::TestingSource2 src(10);
+    p <= src;
+    // Windows [0, 15), [0, 30), [15, 45), [30, 60), ..., [60, 90)
+    std::vector<int> expected = { 1, 1+2, 2+3+4, 3+4+5, 5+6+7, 6+7+8 };
+    BOOST_CHECK_EQUAL_COLLECTIONS( c.begin(), c.end()
+                                 , expected.begin(), expected.end() );
+}
+
+// Checks that messages closing the window return to their source, both on
+// push and pull evaluation.
+BOOST_AUTO_TEST_CASE( pooledRelease ) {
+    pipet::aux::MessagePool<pipet::test::Message> pool(1);
+    {
+        pipet::WindowAggregator<pipet::test::Message, pipet::test::IDSum> w(3);
+        pipet::test::IDCollector c;
+        pipet::Pipe<pipet::test::Message> p;
+        p.push_back( w );
+        p.push_back( c );
+        pipet::test::TestingSource2 src(10, &pool);
+        p <= src;
+        BOOST_CHECK_EQUAL( c.size(), 3 );
+    }
+    BOOST_CHECK_EQUAL( pool.n_slots(), 1 );
+    BOOST_CHECK_EQUAL( pool.n_free(), 1 );
+    {
+        pipet::WindowAggregator<pipet::test::Message, pipet::test::IDSum> w(3);
+        pipet::GenericArbiter<int> a;
+        pipet::Pipe<pipet::test::Message> p;
+        p.push_back( w );
+        pipet::test::TestingSource2 src(10, &pool);
+        for( int n = 0; n < 3; ++n ) {
+            pipet::test::Message msg;
+            pipet::Pipe<pipet::test::Message>::TheHandlerTraits::pull_one(
+                    a, p.upcast(), src, msg );
+            BOOST_CHECK_EQUAL( msg.id, 9*n + 6 );
+        }
+    }
+    BOOST_CHECK_EQUAL( pool.n_slots(), 1 );
+    BOOST_CHECK_EQUAL( pool.n_free(), 1 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
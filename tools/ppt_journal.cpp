@@ -0,0 +1,455 @@
+/*
+ * Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+ * Author: Renat R. Dusaev <crank@qcrypt.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Offline analysis of the journals written by ppt::journaling::Journal<T>.
+ *
+ * Reads the processing history (either XML produced by `Journal::print()',
+ * or the `Journal::print_plain_ascii()' output) and, optionally, the
+ * processors description produced by `journaling::Traits<T>::print_info()'.
+ * Both may reside in the same file. The `procBgn'/`procEnd' entries are
+ * paired by issuer, message ID and thread; evaluations enclosed within
+ * another one on the same thread are considered to be nested, so their time
+ * is subtracted from the exclusive time of enclosing processor. Evaluations
+ * run on the pool workers (parallel spans and observer runs) are accounted
+ * as top-level ones of the worker thread, so the waiting for them remains
+ * within the exclusive time of the enclosing pipe.
+ *
+ * Usage:
+ *      ppt-journal [-n <N>] [-i <info-file>] <journal-file|-> ...
+ * */
+
+# include <algorithm>
+# include <cctype>
+# include <cstdint>
+# include <cstdio>
+# include <cstdlib>
+# include <cstring>
+# include <fstream>
+# include <iostream>
+# include <iterator>
+# include <map>
+# include <memory>
+# include <sstream>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+namespace {
+
+//
+// Input
+///////
+
+/// Journal entry type codes, as in ppt::journaling::EntryType.
+enum EntryType { unspecified = 0, procBgn = 1, procEnd = 2 };
+
+/// Journal entry read from the file; times are in nanoseconds.
+struct Entry {
+    uint64_t time;
+    uint64_t issuer;
+    int type;
+    uint64_t msgID;
+    uint64_t thread;
+};
+
+/// Minimal XML element: only the nested elements and the text are kept,
+/// attributes, comments and declarations are skipped.
+struct Node {
+    std::string name;
+    std::string text;
+    std::vector< std::unique_ptr<Node> > children;
+
+    const Node * child( const char * n ) const {
+        for( const auto & c : children ) {
+            if( c->name == n ) return c.get();
+        }
+        return nullptr;
+    }
+    std::string field( const char * n ) const {
+        const Node * c = child(n);
+        return c ? c->text : std::string();
+    }
+};
+
+/// Parses the sequence of XML elements at the top level of the document
+/// into `roots'. Returns false on malformed input.
+bool
+parse_xml( const std::string & s, std::vector< std::unique_ptr<Node> > & roots ) {
+    std::vector<Node *> stack;
+    size_t i = 0;
+    while( i < s.size() ) {
+        if( '<' != s[i] ) {
+            size_t e = s.find( '<', i );
+            if( std::string::npos == e ) e = s.size();
+            if( !stack.empty() ) stack.back()->text.append( s, i, e - i );
+            i = e;
+            continue;
+        }
+        if( !s.compare( i, 4, "<!--" ) ) {
+            size_t e = s.find( "-->", i );
+            if( std::string::npos == e ) return false;
+            i = e + 3;
+            continue;
+        }
+        size_t e = s.find( '>', i );
+        if( std::string::npos == e ) return false;
+        if( '?' == s[i+1] || '!' == s[i+1] ) {
+            i = e + 1;
+            continue;
+        }
+        if( '/' == s[i+1] ) {
+            if( stack.empty() ) return false;
+            std::string name = s.substr( i + 2, e - i - 2 );
+            name.erase( name.find_last_not_of( " \t\r\n" ) + 1 );
+            if( name != stack.back()->name ) return false;
+            stack.pop_back();
+            i = e + 1;
+            continue;
+        }
+        bool selfClosing = '/' == s[e-1];
+        size_t nameEnd = i + 1;
+        while( nameEnd < e && !isspace(s[nameEnd]) && '/' != s[nameEnd] ) ++nameEnd;
+        std::unique_ptr<Node> n( new Node() );
+        n->name = s.substr( i + 1, nameEnd - i - 1 );
+        Node * nPtr = n.get();
+        if( stack.empty() ) roots.push_back( std::move(n) );
+        else stack.back()->children.push_back( std::move(n) );
+        if( !selfClosing ) stack.push_back( nPtr );
+        i = e + 1;
+    }
+    return stack.empty();
+}
+
+uint64_t
+to_u64( const std::string & s, int base=0 ) {
+    return strtoull( s.c_str(), nullptr, base );
+}
+
+/// Reads the entries of `processingHistory' element.
+void
+read_xml_history( const Node & h, std::vector<Entry> & entries ) {
+    for( const auto & c : h.children ) {
+        if( "event" != c->name ) continue;
+        Entry e;
+        e.time = to_u64( c->field("time") );
+        e.issuer = to_u64( c->field("issuer") );
+        e.type = (int) to_u64( c->field("type"), 16 );
+        e.msgID = to_u64( c->field("msgID") );
+        e.thread = to_u64( c->field("thread") );
+        entries.push_back( e );
+    }
+}
+
+/// Reads the lines of `Journal::print_plain_ascii()' output:
+///     <time>:<issuer> <type> <msgID> <thread>
+/// Thread column is absent in older journals.
+bool
+read_plain_history( std::istream & is, std::vector<Entry> & entries ) {
+    std::string line;
+    while( std::getline( is, line ) ) {
+        if( line.find_first_not_of( " \t\r" ) == std::string::npos ) continue;
+        size_t colon = line.find( ':' );
+        if( std::string::npos == colon ) return false;
+        Entry e;
+        e.time = to_u64( line.substr( 0, colon ), 10 );
+        std::istringstream ss( line.substr( colon + 1 ) );
+        std::string issuer, thread;
+        if( !(ss >> issuer >> e.type >> e.msgID) ) return false;
+        e.issuer = to_u64( issuer, 16 );
+        e.thread = (ss >> thread) ? to_u64( thread, 16 ) : 0;
+        entries.push_back( e );
+    }
+    return true;
+}
+
+/// Reads the file (or standard input for "-"), collecting the journal
+/// entries and processor description trees found.
+bool
+read_file( const std::string & path
+         , std::vector<Entry> & entries
+         , std::vector< std::unique_ptr<Node> > & infoRoots ) {
+    std::ifstream f;
+    if( "-" != path ) {
+        f.open( path );
+        if( !f ) {
+            std::cerr << "Unable to open \"" << path << "\"." << std::endl;
+            return false;
+        }
+    }
+    std::istream & is = ("-" == path) ? std::cin : f;
+    std::string content( (std::istreambuf_iterator<char>(is))
+                       , std::istreambuf_iterator<char>() );
+    size_t first = content.find_first_not_of( " \t\r\n" );
+    if( std::string::npos == first ) return true;
+    if( '<' != content[first] ) {
+        std::istringstream ss( content );
+        if( !read_plain_history( ss, entries ) ) {
+            std::cerr << "\"" << path << "\" is neither XML, nor plain ASCII"
+                         " journal." << std::endl;
+            return false;
+        }
+        return true;
+    }
+    std::vector< std::unique_ptr<Node> > roots;
+    if( !parse_xml( content, roots ) ) {
+        std::cerr << "Malformed XML in \"" << path << "\"." << std::endl;
+        return false;
+    }
+    for( auto & r : roots ) {
+        if( "processingHistory" == r->name ) read_xml_history( *r, entries );
+        else if( "processor" == r->name ) infoRoots.push_back( std::move(r) );
+    }
+    return true;
+}
+
+//
+// Analysis
+//////////
+
+/// Timing summary of single processor.
+struct ProcessorTiming {
+    std::vector<uint64_t> inclusive;
+    uint64_t exclusiveSum;
+    uint64_t inclusiveSum;
+    ProcessorTiming() : exclusiveSum(0), inclusiveSum(0) {}
+
+    uint64_t percentile( double p ) const {
+        if( inclusive.empty() ) return 0;
+        size_t n = (size_t) (p*inclusive.size());
+        return inclusive[ n < inclusive.size() ? n : inclusive.size() - 1 ];
+    }
+};
+
+/// Complete evaluation of the message by top-level processor.
+struct MessageTiming {
+    uint64_t msgID;
+    uint64_t issuer;
+    uint64_t thread;
+    uint64_t inclusive;
+};
+
+struct Analysis {
+    std::map<uint64_t, ProcessorTiming> processors;
+    std::vector<MessageTiming> messages;
+    size_t nUnmatchedBgn, nUnmatchedEnd;
+    Analysis() : nUnmatchedBgn(0), nUnmatchedEnd(0) {}
+};
+
+/// Pairs the entries, building per-thread stacks of opened evaluations.
+void
+analyze( const std::vector<Entry> & entries, Analysis & a ) {
+    struct Frame {
+        uint64_t issuer, msgID, bgn, children;
+    };
+    std::unordered_map< uint64_t, std::vector<Frame> > stacks;
+    // Issuers that were ever evaluated within another evaluation can not be
+    // the top-level ones
+    std::map<uint64_t, bool> nested;
+    std::vector<MessageTiming> topLevel;
+    for( const Entry & e : entries ) {
+        std::vector<Frame> & stack = stacks[e.thread];
+        if( procBgn == e.type ) {
+            nested[e.issuer] = nested[e.issuer] || !stack.empty();
+            stack.push_back( Frame{ e.issuer, e.msgID, e.time, 0 } );
+            continue;
+        }
+        if( procEnd != e.type ) continue;
+        auto it = stack.rbegin();
+        while( stack.rend() != it
+            && !(it->issuer == e.issuer && it->msgID == e.msgID) ) ++it;
+        if( stack.rend() == it ) {
+            ++a.nUnmatchedEnd;
+            continue;
+        }
+        // Evaluations opened after the matching one were not closed
+        size_t nUnclosed = it - stack.rbegin();
+        a.nUnmatchedBgn += nUnclosed;
+        stack.resize( stack.size() - nUnclosed );
+        Frame f = stack.back();
+        stack.pop_back();
+        const uint64_t incl = e.time > f.bgn ? e.time - f.bgn : 0;
+        const uint64_t excl = incl > f.children ? incl - f.children : 0;
+        ProcessorTiming & pt = a.processors[f.issuer];
+        pt.inclusive.push_back( incl );
+        pt.inclusiveSum += incl;
+        pt.exclusiveSum += excl;
+        if( !stack.empty() ) {
+            stack.back().children += incl;
+        } else {
+            topLevel.push_back( MessageTiming{ f.msgID, f.issuer, e.thread, incl } );
+        }
+    }
+    for( const auto & s : stacks ) {
+        a.nUnmatchedBgn += s.second.size();
+    }
+    for( auto & p : a.processors ) {
+        std::sort( p.second.inclusive.begin(), p.second.inclusive.end() );
+    }
+    for( const MessageTiming & m : topLevel ) {
+        if( !nested[m.issuer] ) a.messages.push_back( m );
+    }
+    std::sort( a.messages.begin(), a.messages.end()
+             , []( const MessageTiming & l, const MessageTiming & r ) {
+                    return l.inclusive > r.inclusive; } );
+}
+
+//
+// Report
+////////
+
+double us( uint64_t ns ) { return ns*1e-3; }
+
+void
+print_header() {
+    printf( "%-44s %8s %12s %10s %10s %10s %10s %10s %12s %10s\n"
+          , "processor", "calls", "incl.total", "incl.mean", "p50", "p90"
+          , "p99", "max", "excl.total", "excl.mean" );
+}
+
+void
+print_row( const std::string & label, const ProcessorTiming * pt ) {
+    if( !pt || pt->inclusive.empty() ) {
+        printf( "%-44s %8d\n", label.c_str(), 0 );
+        return;
+    }
+    const size_t n = pt->inclusive.size();
+    printf( "%-44s %8zu %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f %12.3f %10.3f\n"
+          , label.c_str(), n
+          , us(pt->inclusiveSum), us(pt->inclusiveSum)/n
+          , us(pt->percentile(.5)), us(pt->percentile(.9))
+          , us(pt->percentile(.99)), us(pt->inclusive.back())
+          , us(pt->exclusiveSum), us(pt->exclusiveSum)/n );
+}
+
+/// Prints the processor described by info node and its nested processors,
+/// marking the printed ones.
+void
+print_tree( const Node & n, const Analysis & a
+          , std::map<uint64_t, bool> & printed
+          , unsigned depth, const char * role ) {
+    const uint64_t addr = to_u64( n.field("address") );
+    const Node * pipeline = n.child("pipeline");
+    std::string label( 2*depth, ' ' );
+    label += role;
+    label += pipeline ? "pipe" : ("true" == n.field("isObesrver") ? "observer" : "mutator");
+    label += " " + n.field("address");
+    // Processor-specific scalar fields
+    for( const auto & c : n.children ) {
+        if( !c->children.empty() || "address" == c->name
+         || "isObesrver" == c->name ) continue;
+        label += " " + c->name + "=" + c->text;
+    }
+    auto it = a.processors.find( addr );
+    print_row( label, a.processors.end() == it ? nullptr : &it->second );
+    printed[addr] = true;
+    if( pipeline ) {
+        for( const auto & c : pipeline->children ) {
+            if( "processor" == c->name ) print_tree( *c, a, printed, depth + 1, "" );
+        }
+    }
+    if( const Node * span = n.child("span") ) {
+        for( const auto & c : span->children ) {
+            if( "processor" == c->name ) print_tree( *c, a, printed, depth + 1, "span:" );
+        }
+    }
+}
+
+void
+usage( const char * appName ) {
+    std::cerr << "Usage:" << std::endl
+              << "    " << appName << " [-n <N>] [-i <info-file>] <journal-file|-> ..." << std::endl
+              << "Reports per-processor timing and N (default 10) slowest"
+                 " messages from the" << std::endl
+              << "pipeline journal(s). Processors hierarchy is taken from"
+                 " the info file (which" << std::endl
+              << "may also be the journal file itself, if info was printed"
+                 " into it)." << std::endl;
+}
+
+}  // anonymous namespace
+
+int
+main( int argc, char * argv[] ) {
+    size_t nTop = 10;
+    std::vector<std::string> files;
+    std::vector<Entry> entries;
+    std::vector< std::unique_ptr<Node> > infoRoots;
+    for( int i = 1; i < argc; ++i ) {
+        if( !strcmp( argv[i], "-h" ) || !strcmp( argv[i], "--help" ) ) {
+            usage( argv[0] );
+            return 0;
+        } else if( !strcmp( argv[i], "-n" ) && i + 1 < argc ) {
+            nTop = strtoul( argv[++i], nullptr, 10 );
+        } else if( !strcmp( argv[i], "-i" ) && i + 1 < argc ) {
+            std::vector<Entry> unused;
+            if( !read_file( argv[++i], unused, infoRoots ) ) return EXIT_FAILURE;
+        } else if( '-' == argv[i][0] && argv[i][1] ) {
+            usage( argv[0] );
+            return EXIT_FAILURE;
+        } else {
+            files.push_back( argv[i] );
+        }
+    }
+    if( files.empty() ) {
+        usage( argv[0] );
+        return EXIT_FAILURE;
+    }
+    for( const auto & f : files ) {
+        if( !read_file( f, entries, infoRoots ) ) return EXIT_FAILURE;
+    }
+
+    Analysis a;
+    analyze( entries, a );
+
+    printf( "%zu entries, %zu processors, %zu top-level evaluations;"
+            " times are in microseconds.\n"
+          , entries.size(), a.processors.size(), a.messages.size() );
+    if( a.nUnmatchedBgn || a.nUnmatchedEnd ) {
+        printf( "Warning: %zu evaluation(s) were not finished, %zu finish"
+                " record(s) have no start.\n", a.nUnmatchedBgn, a.nUnmatchedEnd );
+    }
+    printf( "\n" );
+    print_header();
+    std::map<uint64_t, bool> printed;
+    for( const auto & r : infoRoots ) {
+        print_tree( *r, a, printed, 0, "" );
+    }
+    for( const auto & p : a.processors ) {
+        if( printed[p.first] ) continue;
+        char bf[32];
+        snprintf( bf, sizeof(bf), "%#lx", (unsigned long) p.first );
+        print_row( infoRoots.empty() ? bf : std::string("(not described) ") + bf
+                 , &p.second );
+    }
+
+    if( nTop && !a.messages.empty() ) {
+        printf( "\nTop %zu slowest messages:\n", std::min( nTop, a.messages.size() ) );
+        printf( "%-20s %-16s %-18s %12s\n", "msgID", "processor", "thread", "time" );
+        for( size_t i = 0; i < nTop && i < a.messages.size(); ++i ) {
+            const MessageTiming & m = a.messages[i];
+            printf( "%#-20lx %#-16lx %#-18lx %12.3f\n"
+                  , (unsigned long) m.msgID, (unsigned long) m.issuer
+                  , (unsigned long) m.thread, us(m.inclusive) );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+# Copyright (c) 2016 Renat R. Dusaev <crank@qcrypt.org>
+# Author: Renat R. Dusaev <crank@qcrypt.org>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy of
+# this software and associated documentation files (the "Software"), to deal in
+# the Software without restriction, including without limitation the rights to
+# use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+# the Software, and to permit persons to whom the Software is furnished to do so,
+# subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+# FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+# COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+# IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+# Runs ppt-journal on the journal file and compares its output with the
+# expected one. Invoked by CTest as:
+#   cmake -DPPT_JOURNAL=<exe> -DJOURNAL=<file> -DEXPECTED=<file> -P <this>
+
+execute_process( COMMAND ${PPT_JOURNAL} -n 2 ${JOURNAL}
+                 OUTPUT_VARIABLE output
+                 RESULT_VARIABLE rc )
+if( NOT rc EQUAL 0 )
+    message( FATAL_ERROR "ppt-journal exited with ${rc} on ${JOURNAL}." )
+endif( NOT rc EQUAL 0 )
+file( READ ${EXPECTED} expected )
+if( NOT output STREQUAL expected )
+    message( FATAL_ERROR "Unexpected output for ${JOURNAL}:\n${output}" )
+endif( NOT output STREQUAL expected )